@@ -11,23 +11,37 @@
       'target_name': 'libdn',
       'type': 'static_library',
       'sources': [
+        'src/common/action_cache.cc',
+        'src/common/action_cache.h',
         'src/common/async_subprocess_win.cc',
         'src/common/async_subprocess_posix.cc',
         'src/common/async_subprocess.h',
         'src/common/command_executor.cc',
         'src/common/command_executor.h',
+        'src/common/compression.cc',
+        'src/common/compression.h',
+        'src/common/curl_helper.cc',
+        'src/common/curl_helper.h',
+        'src/common/digest.cc',
+        'src/common/digest.h',
+        'src/common/digest_cache.cc',
+        'src/common/digest_cache.h',
+        'src/common/fetch_engine.cc',
+        'src/common/fetch_engine.h',
         'src/common/main_runner.cc',
         'src/common/main_runner.h',
         'src/common/options.cc',
         'src/common/options.h',
         'src/common/util.cc',
         'src/common/util.h',
-        'src/master/curl_helper.cc',
-        'src/master/curl_helper.h',
         'src/master/master_main_runner.cc',
         'src/master/master_main_runner.h',
         'src/master/master_rpc.cc',
         'src/master/master_rpc.h',
+        'src/master/slave_info.cc',
+        'src/master/slave_info.h',
+        'src/master/slave_selector.cc',
+        'src/master/slave_selector.h',
         'src/master/webui_thread.cc',
         'src/master/webui_thread.h',
         'src/net/address_family.h',
@@ -66,10 +80,20 @@
         'src/net/winsock_init.h',
         'src/net/winsock_util.cc',
         'src/net/winsock_util.h',
+        'src/ninja/critical_path.cc',
+        'src/ninja/critical_path.h',
         'src/ninja/dn_builder.cc',
         'src/ninja/dn_builder.h',
         'src/ninja/ninja_main.cc',
         'src/ninja/ninja_main.h',
+        'src/ninja/partitioner.cc',
+        'src/ninja/partitioner.h',
+        'src/ninja/pch_affinity.cc',
+        'src/ninja/pch_affinity.h',
+        'src/ninja/placement.cc',
+        'src/ninja/placement.h',
+        'src/ninja/speculator.cc',
+        'src/ninja/speculator.h',
         'src/proto/rpc_message.proto',
         'src/proto/slave_services.proto',
         'src/rpc/rpc_connection.cc',
@@ -138,6 +162,7 @@
             'link_settings': {
               'libraries': [
                 '-lcurl',
+                '-lz',
               ],
             },
           },
@@ -162,9 +187,21 @@
       'target_name': 'dn_unittest',
       'type': 'executable',
       'sources': [
+        'src/common/action_cache_unittest.cc',
         'src/common/async_subprocess_unittest.cc',
         'src/common/command_executor_unittest.cc',
-        'src/master/curl_helper_unittest.cc',
+        'src/common/compression_unittest.cc',
+        'src/common/curl_helper_unittest.cc',
+        'src/common/digest_cache_unittest.cc',
+        'src/common/digest_unittest.cc',
+        'src/master/slave_selector_unittest.cc',
+        'src/ninja/critical_path_unittest.cc',
+        'src/ninja/partitioner_unittest.cc',
+        'src/ninja/pch_affinity_unittest.cc',
+        'src/ninja/placement_unittest.cc',
+        'src/ninja/speculator_unittest.cc',
+        'src/ninja/test_util.cc',
+        'src/ninja/test_util.h',
         'src/proto/echo_unittest.proto',
         'src/rpc/rpc_socket_unittest.cc',
         'src/run_all_unittest.cc',
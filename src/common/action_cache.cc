@@ -0,0 +1,362 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/action_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "base/files/file_enumerator.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/md5.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
+#include "base/time/time.h"
+#include "common/util.h"
+#include "third_party/ninja/src/depfile_parser.h"
+#include "third_party/ninja/src/util.h"
+
+namespace {
+
+// Files of an entry. Outputs are stored by their index.
+const char kDepsFile[] = "deps";
+const char kOutputFile[] = "output";
+
+const char kTempPrefix[] = "tmp";
+
+base::FilePath::StringType TempPrefix() {
+  return base::FilePath::FromUTF8Unsafe(kTempPrefix).value();
+}
+
+// Escapes |path| the way ninja's DepfileParser unescapes it: backslashes are
+// literal unless they precede a space or '#', and '$' is doubled.
+std::string EscapeForDepfile(const std::string& path) {
+  std::string escaped;
+  size_t backslashes = 0;
+  for (size_t i = 0; i < path.size(); ++i) {
+    char c = path[i];
+    if (c == ' ') {
+      escaped.append(backslashes + 1, '\\');
+    } else if (c == '#') {
+      escaped += '\\';
+    } else if (c == '$') {
+      escaped += '$';
+    }
+    escaped += c;
+    backslashes = c == '\\' ? backslashes + 1 : 0;
+  }
+  return escaped;
+}
+
+bool WriteDepfile(const std::string& depfile,
+                  const std::string& output_path,
+                  const std::vector<std::string>& deps) {
+  std::string content = EscapeForDepfile(output_path) + ":";
+  for (size_t i = 0; i < deps.size(); ++i)
+    content += " " + EscapeForDepfile(deps[i]);
+  content += "\n";
+
+  base::FilePath path = base::FilePath::FromUTF8Unsafe(depfile);
+  return base::CreateDirectory(path.DirName()) &&
+         base::WriteFile(path, content.data(), content.size()) ==
+             static_cast<int>(content.size());
+}
+
+// Copies |from| to |to|, keeping the permissions, e.g. of an executable.
+bool CopyCacheFile(const base::FilePath& from, const base::FilePath& to) {
+  base::DeleteFile(to, false);
+  if (!base::CopyFile(from, to))
+    return false;
+
+#if defined(OS_POSIX)
+  int mode;
+  if (base::GetPosixFilePermissions(from, &mode))
+    base::SetPosixFilePermissions(to, mode);
+#endif
+  return true;
+}
+
+}  // namespace
+
+namespace common {
+
+ActionCache::ActionCache(const base::FilePath& cache_dir, int64 max_size)
+    : cache_dir_(cache_dir),
+      max_size_(max_size),
+      size_(0) {
+}
+
+ActionCache::~ActionCache() {
+}
+
+bool ActionCache::Init() {
+  if (!base::CreateDirectory(cache_dir_))
+    return false;
+
+  std::vector<std::pair<base::Time, std::string> > keys;
+  std::map<std::string, int64> sizes;
+  base::FileEnumerator enumerator(
+      cache_dir_, false, base::FileEnumerator::DIRECTORIES);
+  for (base::FilePath path = enumerator.Next();
+       !path.empty();
+       path = enumerator.Next()) {
+    // Temporary directories are left over by an interrupted store or
+    // eviction.
+    std::string key = path.BaseName().AsUTF8Unsafe();
+    if (StartsWithASCII(key, kTempPrefix, true)) {
+      base::DeleteFile(path, true);
+      continue;
+    }
+
+    keys.push_back(
+        std::make_pair(enumerator.GetInfo().GetLastModifiedTime(), key));
+    sizes[key] = base::ComputeDirectorySize(path);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<base::FilePath> victims;
+  {
+    base::AutoLock lock(lock_);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      lru_.push_front(keys[i].second);
+      Entry& entry = entries_[keys[i].second];
+      entry.size = sizes[keys[i].second];
+      entry.position = lru_.begin();
+      size_ += entry.size;
+    }
+    EvictLocked(&victims);
+  }
+
+  for (size_t i = 0; i < victims.size(); ++i)
+    base::DeleteFile(victims[i], true);
+  return true;
+}
+
+// static
+std::string ActionCache::GetKeyCommand(const std::string& command,
+                                       const std::string& rspfile_content) {
+  if (rspfile_content.empty())
+    return command;
+  return command + ";rspfile=" + rspfile_content;
+}
+
+// static
+bool ActionCache::ReadDepfile(const std::string& depfile, PathVector* deps) {
+  std::string content;
+  if (!base::ReadFileToString(base::FilePath::FromUTF8Unsafe(depfile),
+                              &content)) {
+    return false;
+  }
+
+  DepfileParser parser;
+  std::string error;
+  if (!parser.Parse(&content, &error)) {
+    LOG(ERROR) << depfile << ": " << error;
+    return false;
+  }
+
+  for (size_t i = 0; i < parser.ins_.size(); ++i) {
+    std::string path = parser.ins_[i].AsString();
+    unsigned int slash_bits;
+    if (!CanonicalizePath(&path, &slash_bits, &error))
+      return false;
+    deps->push_back(path);
+  }
+  return true;
+}
+
+bool ActionCache::Lookup(const std::string& command,
+                         const PathVector& input_paths,
+                         const PathVector& output_paths,
+                         const std::string& depfile,
+                         std::string* key,
+                         PathVector* deps,
+                         std::string* output) {
+  std::string prefix = command + "\n";
+  for (size_t i = 0; i < output_paths.size(); ++i)
+    prefix += output_paths[i] + "\n";
+  *key = ComputeKey(prefix, input_paths);
+  if (key->empty() || !Touch(*key))
+    return false;
+
+  std::string content;
+  if (!base::ReadFileToString(GetEntryPath(*key).AppendASCII(kDepsFile),
+                              &content)) {
+    return false;
+  }
+  std::vector<std::string> lines;
+  base::SplitString(content, '\n', &lines);
+  deps->clear();
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (!lines[i].empty())
+      deps->push_back(lines[i]);
+  }
+
+  std::string action_key = ComputeKey(*key + "\n", *deps);
+  if (action_key.empty() || !Touch(action_key))
+    return false;
+
+  base::FilePath entry_path = GetEntryPath(action_key);
+  if (!base::ReadFileToString(entry_path.AppendASCII(kOutputFile), output))
+    return false;
+
+  for (size_t i = 0; i < output_paths.size(); ++i) {
+    base::FilePath output_path =
+        base::FilePath::FromUTF8Unsafe(output_paths[i]);
+    if (!base::CreateDirectory(output_path.DirName()) ||
+        !CopyCacheFile(entry_path.AppendASCII(base::SizeTToString(i)),
+                       output_path)) {
+      return false;
+    }
+  }
+
+  return depfile.empty() || output_paths.empty() ||
+         WriteDepfile(depfile, output_paths[0], *deps);
+}
+
+bool ActionCache::Store(const std::string& key,
+                        const PathVector& deps,
+                        const PathVector& output_paths,
+                        const std::string& output) {
+  std::string action_key = ComputeKey(key + "\n", deps);
+  if (action_key.empty())
+    return false;
+
+  base::FilePath temp_dir;
+  if (!base::CreateTemporaryDirInDir(cache_dir_, TempPrefix(), &temp_dir))
+    return false;
+  for (size_t i = 0; i < output_paths.size(); ++i) {
+    if (!CopyCacheFile(base::FilePath::FromUTF8Unsafe(output_paths[i]),
+                       temp_dir.AppendASCII(base::SizeTToString(i)))) {
+      base::DeleteFile(temp_dir, true);
+      return false;
+    }
+  }
+  if (base::WriteFile(temp_dir.AppendASCII(kOutputFile),
+                      output.data(), output.size()) !=
+      static_cast<int>(output.size())) {
+    base::DeleteFile(temp_dir, true);
+    return false;
+  }
+
+  // The outputs go first, so that the deps of |key| always lead to them.
+  if (!Commit(action_key, temp_dir))
+    return false;
+
+  std::string content;
+  for (size_t i = 0; i < deps.size(); ++i)
+    content += deps[i] + "\n";
+  if (!base::CreateTemporaryDirInDir(cache_dir_, TempPrefix(), &temp_dir))
+    return false;
+  if (base::WriteFile(temp_dir.AppendASCII(kDepsFile),
+                      content.data(), content.size()) !=
+      static_cast<int>(content.size())) {
+    base::DeleteFile(temp_dir, true);
+    return false;
+  }
+  return Commit(key, temp_dir);
+}
+
+int64 ActionCache::GetSize() {
+  base::AutoLock lock(lock_);
+  return size_;
+}
+
+// static
+std::string ActionCache::ComputeKey(const std::string& prefix,
+                                    const PathVector& paths) {
+  base::MD5Context context;
+  base::MD5Init(&context);
+  base::MD5Update(&context, prefix);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    std::string md5 = GetMd5Digest(base::FilePath::FromUTF8Unsafe(paths[i]));
+    if (md5.empty())
+      return std::string();
+
+    base::MD5Update(&context, paths[i]);
+    base::MD5Update(&context, base::StringPiece("\0", 1));
+    base::MD5Update(&context, md5);
+    base::MD5Update(&context, "\n");
+  }
+
+  base::MD5Digest digest;
+  base::MD5Final(&digest, &context);
+  return base::MD5DigestToBase16(digest);
+}
+
+base::FilePath ActionCache::GetEntryPath(const std::string& key) const {
+  return cache_dir_.AppendASCII(key);
+}
+
+bool ActionCache::Commit(const std::string& key,
+                         const base::FilePath& temp_dir) {
+  int64 size = base::ComputeDirectorySize(temp_dir);
+  std::vector<base::FilePath> victims;
+  bool success;
+  {
+    base::AutoLock lock(lock_);
+    if (entries_.find(key) != entries_.end())
+      RemoveLocked(key, &victims);
+
+    success = base::Move(temp_dir, GetEntryPath(key));
+    if (success) {
+      lru_.push_front(key);
+      Entry& entry = entries_[key];
+      entry.size = size;
+      entry.position = lru_.begin();
+      size_ += size;
+      EvictLocked(&victims);
+    }
+  }
+
+  if (!success)
+    victims.push_back(temp_dir);
+  for (size_t i = 0; i < victims.size(); ++i)
+    base::DeleteFile(victims[i], true);
+  return success;
+}
+
+bool ActionCache::Touch(const std::string& key) {
+  base::AutoLock lock(lock_);
+  EntryMap::iterator it = entries_.find(key);
+  if (it == entries_.end())
+    return false;
+
+  lru_.splice(lru_.begin(), lru_, it->second.position);
+
+  // The modification time keeps the order across runs, see Init().
+  base::Time now = base::Time::Now();
+  base::TouchFile(GetEntryPath(key), now, now);
+  return true;
+}
+
+void ActionCache::EvictLocked(std::vector<base::FilePath>* victims) {
+  lock_.AssertAcquired();
+  // Keep the most recent entry, even if it is larger than the whole cache.
+  while (size_ > max_size_ && lru_.size() > 1)
+    RemoveLocked(lru_.back(), victims);
+}
+
+void ActionCache::RemoveLocked(const std::string& key,
+                               std::vector<base::FilePath>* victims) {
+  lock_.AssertAcquired();
+  EntryMap::iterator it = entries_.find(key);
+  DCHECK(it != entries_.end());
+  size_ -= it->second.size;
+  lru_.erase(it->second.position);
+  entries_.erase(it);
+
+  // Renaming is cheap, the directory is deleted without holding |lock_|.
+  base::FilePath victim;
+  if (base::CreateTemporaryDirInDir(cache_dir_, TempPrefix(), &victim)) {
+    victims->push_back(victim);
+    if (base::Move(GetEntryPath(key), victim.AppendASCII(key)))
+      return;
+  }
+  base::DeleteFile(GetEntryPath(key), true);
+}
+
+}  // namespace common
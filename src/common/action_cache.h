@@ -0,0 +1,125 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_ACTION_CACHE_H_
+#define  COMMON_ACTION_CACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+
+namespace common {
+
+// ActionCache keeps the outputs and the output stream of commands on disk, so
+// that a command which runs again with the same inputs is satisfied without
+// running it. Each action is looked up in two steps:
+//   1. The command and the md5 of its inputs give the input key. Under the
+//      input key, the cache keeps the dependencies discovered by the last run
+//      of the action, e.g. the headers listed in the depfile.
+//   2. The input key and the md5 of the discovered dependencies give the
+//      action key, under which the outputs are kept.
+// This way a hit never depends on a stale deps log. Entries are directories
+// under |cache_dir|, the least recently used ones are evicted when the total
+// size exceeds |max_size|.
+//
+// All the methods block, they are called on the blocking pool and are
+// thread-safe.
+class ActionCache : public base::RefCountedThreadSafe<ActionCache> {
+ public:
+  typedef std::vector<std::string> PathVector;
+
+  ActionCache(const base::FilePath& cache_dir, int64 max_size);
+
+  // Loads the index of the entries from |cache_dir|, creating it if needed.
+  bool Init();
+
+  // Returns the command which the input key of |command| is computed from,
+  // i.e. with the content of its response file, if any, the same way as
+  // Edge::EvaluateCommand(true). The command itself is evaluated once and
+  // then run on a miss.
+  static std::string GetKeyCommand(const std::string& command,
+                                   const std::string& rspfile_content);
+
+  // Reads the inputs listed in the gcc-style |depfile| into |deps|.
+  static bool ReadDepfile(const std::string& depfile, PathVector* deps);
+
+  // Looks up the command whose inputs are |input_paths|. Sets |key| to its
+  // input key, which is empty if an input can not be read. On a hit, copies
+  // the cached outputs to |output_paths|, fills |deps| and |output|, then
+  // returns true. If |depfile| is not empty, it is written from |deps| on a
+  // hit, since depfiles are not cached.
+  bool Lookup(const std::string& command,
+              const PathVector& input_paths,
+              const PathVector& output_paths,
+              const std::string& depfile,
+              std::string* key,
+              PathVector* deps,
+              std::string* output);
+
+  // Stores the result of the action of input key |key|, see Lookup().
+  bool Store(const std::string& key,
+             const PathVector& deps,
+             const PathVector& output_paths,
+             const std::string& output);
+
+  // Returns the total size in bytes of the entries.
+  int64 GetSize();
+
+ private:
+  friend class base::RefCountedThreadSafe<ActionCache>;
+  ~ActionCache();
+
+  // Returns the md5 of |prefix| and the content of |paths|, or an empty
+  // string if a file can not be read.
+  static std::string ComputeKey(const std::string& prefix,
+                                const PathVector& paths);
+
+  base::FilePath GetEntryPath(const std::string& key) const;
+
+  // Moves the entry built in |temp_dir| to |key|, replacing an older one.
+  bool Commit(const std::string& key, const base::FilePath& temp_dir);
+
+  // Marks |key| as the most recently used entry. Returns false if there is
+  // no such entry.
+  bool Touch(const std::string& key);
+
+  // Removes the entries beyond |max_size_|, must be called with |lock_|
+  // held. The directories are renamed away, the caller deletes |victims|
+  // once |lock_| is released.
+  void EvictLocked(std::vector<base::FilePath>* victims);
+
+  // Removes |key| from the index and renames its directory away, must be
+  // called with |lock_| held.
+  void RemoveLocked(const std::string& key,
+                    std::vector<base::FilePath>* victims);
+
+  const base::FilePath cache_dir_;
+  const int64 max_size_;
+
+  base::Lock lock_;
+
+  // The most recently used entry first.
+  typedef std::list<std::string> LRUList;
+  LRUList lru_;
+
+  struct Entry {
+    int64 size;
+    LRUList::iterator position;
+  };
+  typedef std::map<std::string, Entry> EntryMap;
+  EntryMap entries_;
+  int64 size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ActionCache);
+};
+
+}  // namespace common
+
+#endif  // COMMON_ACTION_CACHE_H_
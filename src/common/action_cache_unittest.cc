@@ -0,0 +1,156 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include <string>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/memory/ref_counted.h"
+#include "common/action_cache.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace common {
+
+class ActionCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    cache_dir_ = temp_dir_.path().AppendASCII("cache");
+  }
+
+  std::string GetPath(const char* name) {
+    return temp_dir_.path().AppendASCII(name).AsUTF8Unsafe();
+  }
+
+  void WriteFile(const char* name, const std::string& content) {
+    ASSERT_EQ(static_cast<int>(content.size()),
+              base::WriteFile(base::FilePath::FromUTF8Unsafe(GetPath(name)),
+                              content.data(), content.size()));
+  }
+
+  std::string ReadFile(const char* name) {
+    std::string content;
+    base::ReadFileToString(base::FilePath::FromUTF8Unsafe(GetPath(name)),
+                           &content);
+    return content;
+  }
+
+  scoped_refptr<ActionCache> CreateCache(int64 max_size) {
+    scoped_refptr<ActionCache> cache(new ActionCache(cache_dir_, max_size));
+    EXPECT_TRUE(cache->Init());
+    return cache;
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath cache_dir_;
+};
+
+TEST_F(ActionCacheTest, StoreAndLookup) {
+  WriteFile("a.c", "int a;");
+  WriteFile("a.h", "extern int a;");
+  WriteFile("a.o", "object");
+
+  ActionCache::PathVector inputs(1, GetPath("a.c"));
+  ActionCache::PathVector outputs(1, GetPath("a.o"));
+  ActionCache::PathVector deps(1, GetPath("a.h"));
+
+  scoped_refptr<ActionCache> cache = CreateCache(1024 * 1024);
+  std::string key;
+  ActionCache::PathVector cached_deps;
+  std::string output;
+  EXPECT_FALSE(cache->Lookup("cc a.c", inputs, outputs, std::string(), &key,
+                             &cached_deps, &output));
+  ASSERT_FALSE(key.empty());
+  EXPECT_TRUE(cache->Store(key, deps, outputs, "warning"));
+
+  WriteFile("a.o", "garbage");
+  std::string hit_key;
+  EXPECT_TRUE(cache->Lookup("cc a.c", inputs, outputs, std::string(),
+                            &hit_key, &cached_deps, &output));
+  EXPECT_EQ(key, hit_key);
+  EXPECT_EQ(deps, cached_deps);
+  EXPECT_EQ("warning", output);
+  EXPECT_EQ("object", ReadFile("a.o"));
+
+  // Another command.
+  EXPECT_FALSE(cache->Lookup("cc -O2 a.c", inputs, outputs, std::string(),
+                             &key, &cached_deps, &output));
+
+  // A discovered dependency changed.
+  WriteFile("a.h", "extern int b;");
+  EXPECT_FALSE(cache->Lookup("cc a.c", inputs, outputs, std::string(), &key,
+                             &cached_deps, &output));
+
+  // The entries are kept across runs.
+  WriteFile("a.h", "extern int a;");
+  cache = CreateCache(1024 * 1024);
+  EXPECT_TRUE(cache->Lookup("cc a.c", inputs, outputs, std::string(), &key,
+                            &cached_deps, &output));
+}
+
+TEST_F(ActionCacheTest, WriteDepfileOnHit) {
+  WriteFile("a.c", "int a;");
+  WriteFile("a b.h", "extern int a;");
+  WriteFile("a$b#c\\d.h", "extern int b;");
+  WriteFile("a.o", "object");
+
+  ActionCache::PathVector inputs(1, GetPath("a.c"));
+  ActionCache::PathVector outputs(1, GetPath("a.o"));
+  ActionCache::PathVector deps;
+  deps.push_back(GetPath("a.c"));
+  deps.push_back(GetPath("a b.h"));
+  deps.push_back(GetPath("a$b#c\\d.h"));
+
+  scoped_refptr<ActionCache> cache = CreateCache(1024 * 1024);
+  std::string key;
+  ActionCache::PathVector cached_deps;
+  std::string output;
+  cache->Lookup("cc a.c", inputs, outputs, std::string(), &key, &cached_deps,
+                &output);
+  EXPECT_TRUE(cache->Store(key, deps, outputs, std::string()));
+
+  EXPECT_TRUE(cache->Lookup("cc a.c", inputs, outputs, GetPath("a.o.d"), &key,
+                            &cached_deps, &output));
+  ActionCache::PathVector depfile_deps;
+  EXPECT_TRUE(ActionCache::ReadDepfile(GetPath("a.o.d"), &depfile_deps));
+  EXPECT_EQ(deps, depfile_deps);
+}
+
+TEST_F(ActionCacheTest, EvictLeastRecentlyUsed) {
+  WriteFile("a.c", "int a;");
+  WriteFile("b.c", "int b;");
+  WriteFile("a.o", std::string(100, 'a'));
+  WriteFile("b.o", std::string(100, 'b'));
+
+  ActionCache::PathVector deps;
+  ActionCache::PathVector a_inputs(1, GetPath("a.c"));
+  ActionCache::PathVector a_outputs(1, GetPath("a.o"));
+  ActionCache::PathVector b_inputs(1, GetPath("b.c"));
+  ActionCache::PathVector b_outputs(1, GetPath("b.o"));
+
+  // Room for the outputs of one action only.
+  scoped_refptr<ActionCache> cache = CreateCache(150);
+  std::string key;
+  std::string output;
+  cache->Lookup("cc a.c", a_inputs, a_outputs, std::string(), &key, &deps,
+                &output);
+  EXPECT_TRUE(cache->Store(key, deps, a_outputs, std::string()));
+  cache->Lookup("cc b.c", b_inputs, b_outputs, std::string(), &key, &deps,
+                &output);
+  EXPECT_TRUE(cache->Store(key, deps, b_outputs, std::string()));
+  EXPECT_LE(cache->GetSize(), 150);
+
+  EXPECT_FALSE(cache->Lookup("cc a.c", a_inputs, a_outputs, std::string(),
+                             &key, &deps, &output));
+  EXPECT_TRUE(cache->Lookup("cc b.c", b_inputs, b_outputs, std::string(),
+                            &key, &deps, &output));
+}
+
+TEST(ActionCacheKeyTest, GetKeyCommand) {
+  EXPECT_EQ("cc a.c", ActionCache::GetKeyCommand("cc a.c", std::string()));
+  EXPECT_EQ("link @app.rsp;rspfile=a.o b.o",
+            ActionCache::GetKeyCommand("link @app.rsp", "a.o b.o"));
+}
+
+}  // namespace common
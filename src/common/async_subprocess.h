@@ -33,6 +33,11 @@ class AsyncSubprocess
   /// the process was interrupted, ExitFailure if it otherwise failed.
   ExitStatus Finish();
 
+  // Asks the subprocess to exit, or kills it if |force| is true. The whole
+  // process group is signaled on POSIX, so that the tools spawned by the shell
+  // exit too. The exit callback still runs once the subprocess has gone.
+  void Terminate(bool force);
+
   bool Done() const;
   const std::string& GetOutput() const;
 
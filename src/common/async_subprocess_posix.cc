@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/wait.h>
 
 #include "common/util.h"
@@ -123,6 +124,16 @@ ExitStatus AsyncSubprocess::Finish() {
   return ExitFailure;
 }
 
+void AsyncSubprocess::Terminate(bool force) {
+  if (pid_ == -1)
+    return;
+
+  // Outside the console case the child leads its own process group.
+  pid_t pid = use_console_ ? pid_ : -pid_;
+  if (kill(pid, force ? SIGKILL : SIGTERM) < 0 && errno != ESRCH)
+    LOG(ERROR) << "kill " << pid << ": " << strerror(errno);
+}
+
 bool AsyncSubprocess::Done() const {
   return fd_ == -1;
 }
@@ -15,8 +15,10 @@ namespace {
 
 #if defined(OS_WIN)
 const char* kSimpleCommand = "cmd /c dir \\";
+const char* kLongCommand = "cmd /c ping -n 100 127.0.0.1";
 #else
 const char* kSimpleCommand = "ls /";
+const char* kLongCommand = "sleep 100";
 #endif
 
 }  // namespace
@@ -58,4 +60,13 @@ TEST(AsyncSubprocessTest, RunCommandParallelly) {
     EXPECT_EQ(aysnc_subprocess[i]->Finish(), ExitSuccess);
 }
 
+TEST(AsyncSubprocessTest, Terminate) {
+  base::MessageLoopForIO message_loop;
+  AsyncSubprocess aysnc_subprocess;
+  aysnc_subprocess.Start(kLongCommand, base::Bind(ExitCallback));
+  aysnc_subprocess.Terminate(false);
+  message_loop.Run();
+  EXPECT_EQ(aysnc_subprocess.Finish(), ExitFailure);
+}
+
 }  // namespace common
@@ -123,6 +123,12 @@ ExitStatus AsyncSubprocess::Finish() {
                                        ExitFailure;
 }
 
+void AsyncSubprocess::Terminate(bool force) {
+  // There is no graceful way to stop a console-less process on Windows.
+  if (child_ && !TerminateProcess(child_, 1))
+    LOG(ERROR) << "TerminateProcess: " << GetLastError();
+}
+
 bool AsyncSubprocess::Done() const {
   return pipe_ == NULL;
 }
@@ -9,11 +9,19 @@
 #include "base/message_loop/message_loop.h"
 #include "common/util.h"
 
+namespace {
+
+// How long a canceled subprocess may take to exit before it is killed.
+const int kTerminateGracePeriodInSeconds = 5;
+
+}  // namespace
+
 namespace common {
 
 CommandExecutor::CommandExecutor()
   : parallelism_(common::GuessParallelism()),
-    running_commands_(0) {
+    running_commands_(0),
+    is_start_scheduled_(false) {
 }
 
 CommandExecutor::~CommandExecutor() {
@@ -27,42 +35,124 @@ void CommandExecutor::RemoveObserver(Observer* obs) {
   observer_list_.RemoveObserver(obs);
 }
 
-void CommandExecutor::RunCommand(const std::string& command) {
+void CommandExecutor::RunCommand(Edge* edge, const std::string& command) {
   if (running_commands_ <= parallelism_) {
     // |proc| will be delete when subprocess exists.
     common::AsyncSubprocess* proc = new common::AsyncSubprocess;
     CHECK(proc->Start(command,
                       base::Bind(&CommandExecutor::SubprocessExitCallback,
                                  base::Unretained(this))));
-    FOR_EACH_OBSERVER(Observer, observer_list_, OnCommandStarted(command));
-    subprocss_to_command_.insert(std::make_pair(proc, command));
+    FOR_EACH_OBSERVER(Observer, observer_list_, OnCommandStarted(edge));
+    subprocess_to_edge_.insert(std::make_pair(proc, edge));
     ++running_commands_;
   } else {
-    pending_command_queue_.push(command);
+    pending_command_queue_.push_back(std::make_pair(edge, command));
   }
 }
 
 void CommandExecutor::SubprocessExitCallback(common::AsyncSubprocess* subproc) {
   CommandRunner::Result result;
-  SubprocessToCommand::iterator it = subprocss_to_command_.find(subproc);
-  DCHECK(it != subprocss_to_command_.end());
+  SubprocessToEdge::iterator it = subprocess_to_edge_.find(subproc);
+  DCHECK(it != subprocess_to_edge_.end());
+  result.edge = it->second;
   result.status = subproc->Finish();
   result.output = subproc->GetOutput();
-  FOR_EACH_OBSERVER(
-      Observer, observer_list_, OnCommandFinished(it->second, &result));
+  if (canceled_subprocesses_.erase(subproc) > 0)
+    result.status = ExitInterrupted;
+  FOR_EACH_OBSERVER(Observer, observer_list_, OnCommandFinished(&result));
 
-  subprocss_to_command_.erase(it);
+  subprocess_to_edge_.erase(it);
   delete subproc;
   --running_commands_;
 
-  if (!pending_command_queue_.empty()) {
+  if (!pending_command_queue_.empty() && !is_start_scheduled_) {
     // Don't call RunCommand directlly since we are in the callback of libevent.
+    // The queue is only read when the task runs, so that commands canceled
+    // in the meantime are not started.
+    is_start_scheduled_ = true;
+    base::MessageLoop::current()->PostTask(FROM_HERE,
+        base::Bind(&CommandExecutor::StartPendingCommands,
+                   base::Unretained(this)));
+  }
+}
+
+void CommandExecutor::CancelCommand(Edge* edge) {
+  for (PendingCommandQueue::iterator it = pending_command_queue_.begin();
+       it != pending_command_queue_.end();
+       ++it) {
+    if (it->first != edge)
+      continue;
+
+    pending_command_queue_.erase(it);
     base::MessageLoop::current()->PostTask(FROM_HERE,
-        base::Bind(&CommandExecutor::RunCommand,
+        base::Bind(&CommandExecutor::NotifyCommandCanceled,
                    base::Unretained(this),
-                   pending_command_queue_.front()));
-    pending_command_queue_.pop();
+                   edge));
+    return;
   }
+
+  for (SubprocessToEdge::iterator it = subprocess_to_edge_.begin();
+       it != subprocess_to_edge_.end();
+       ++it) {
+    if (it->second != edge ||
+        !canceled_subprocesses_.insert(it->first).second) {
+      continue;
+    }
+
+    it->first->Terminate(false);
+    base::MessageLoop::current()->PostDelayedTask(FROM_HERE,
+        base::Bind(&CommandExecutor::KillCanceledSubprocess,
+                   base::Unretained(this),
+                   it->first),
+        base::TimeDelta::FromSeconds(kTerminateGracePeriodInSeconds));
+  }
+}
+
+bool CommandExecutor::HasCommand(Edge* edge) const {
+  for (PendingCommandQueue::const_iterator it = pending_command_queue_.begin();
+       it != pending_command_queue_.end();
+       ++it) {
+    if (it->first == edge)
+      return true;
+  }
+  for (SubprocessToEdge::const_iterator it = subprocess_to_edge_.begin();
+       it != subprocess_to_edge_.end();
+       ++it) {
+    if (it->second == edge)
+      return true;
+  }
+  return false;
+}
+
+void CommandExecutor::GetPendingEdges(std::vector<Edge*>* edges) const {
+  for (PendingCommandQueue::const_iterator it = pending_command_queue_.begin();
+       it != pending_command_queue_.end();
+       ++it) {
+    edges->push_back(it->first);
+  }
+}
+
+void CommandExecutor::StartPendingCommands() {
+  is_start_scheduled_ = false;
+  while (CanRunMore() && !pending_command_queue_.empty()) {
+    std::pair<Edge*, std::string> pending = pending_command_queue_.front();
+    pending_command_queue_.pop_front();
+    RunCommand(pending.first, pending.second);
+  }
+}
+
+void CommandExecutor::NotifyCommandCanceled(Edge* edge) {
+  CommandRunner::Result result;
+  result.edge = edge;
+  result.status = ExitInterrupted;
+  FOR_EACH_OBSERVER(Observer, observer_list_, OnCommandFinished(&result));
+}
+
+void CommandExecutor::KillCanceledSubprocess(
+    common::AsyncSubprocess* subproc) {
+  // |subproc| has been deleted if it exited in time.
+  if (canceled_subprocesses_.find(subproc) != canceled_subprocesses_.end())
+    subproc->Terminate(true);
 }
 
 }  // namespace common
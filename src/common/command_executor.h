@@ -5,9 +5,12 @@
 #ifndef  COMMON_COMMAND_EXECUTOR_H_
 #define  COMMON_COMMAND_EXECUTOR_H_
 
+#include <deque>
 #include <map>
-#include <queue>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "base/memory/weak_ptr.h"
@@ -18,15 +21,19 @@
 
 namespace common {
 
+// CommandExecutor runs the commands of edges. Edges are opaque handles here,
+// they are never dereferenced, and every command is passed in already
+// evaluated, so that it is evaluated once per execution.
 class CommandExecutor {
  public:
   // Observer interface for notifying command started/finished event.
   class Observer {
    public:
     virtual ~Observer() {}
-    virtual void OnCommandStarted(const std::string& command) = 0;
-    virtual void OnCommandFinished(const std::string& command,
-                                   const CommandRunner::Result* result) = 0;
+    virtual void OnCommandStarted(Edge* edge) = 0;
+
+    // |result->edge| is the edge passed to RunCommand().
+    virtual void OnCommandFinished(const CommandRunner::Result* result) = 0;
   };
 
   CommandExecutor();
@@ -35,24 +42,46 @@ class CommandExecutor {
   void AddObserver(Observer* obs);
   void RemoveObserver(Observer* obs);
 
-  void RunCommand(const std::string& command);
+  void RunCommand(Edge* edge, const std::string& command);
   void SubprocessExitCallback(common::AsyncSubprocess* subproc);
 
+  // Cancels the command of |edge| whether it is queued or running. Running
+  // subprocesses are terminated, then killed if they are still alive after a
+  // grace period. Observers are notified with ExitInterrupted as usual, so
+  // every command passed to RunCommand() finishes exactly once.
+  void CancelCommand(Edge* edge);
+
+  // Returns true if the command of |edge| is queued or running, i.e. its
+  // OnCommandFinished() is still to come.
+  bool HasCommand(Edge* edge) const;
+
+  // Fills |edges| with the edges whose commands are queued, the oldest one
+  // first.
+  void GetPendingEdges(std::vector<Edge*>* edges) const;
+
   bool CanRunMore() const {
     return running_commands_ <= parallelism_;
   }
 
  private:
+  void StartPendingCommands();
+  void NotifyCommandCanceled(Edge* edge);
+  void KillCanceledSubprocess(common::AsyncSubprocess* subproc);
+
   int parallelism_;
   int running_commands_;
 
-  typedef std::map<common::AsyncSubprocess*, std::string> SubprocessToCommand;
-  SubprocessToCommand subprocss_to_command_;
+  typedef std::map<common::AsyncSubprocess*, Edge*> SubprocessToEdge;
+  SubprocessToEdge subprocess_to_edge_;
 
   ObserverList<Observer> observer_list_;
 
-  typedef std::queue<std::string> PendingCommandQueue;
+  // Subprocesses which have been asked to terminate, but have not exited yet.
+  std::set<common::AsyncSubprocess*> canceled_subprocesses_;
+
+  typedef std::deque<std::pair<Edge*, std::string> > PendingCommandQueue;
   PendingCommandQueue pending_command_queue_;
+  bool is_start_scheduled_;
 
   DISALLOW_COPY_AND_ASSIGN(CommandExecutor);
 };
@@ -2,11 +2,14 @@
 // Use of this source code is governed by the BSD license that can be
 // found in the LICENSE file.
 
+#include <vector>
+
 #include "base/message_loop/message_loop.h"
 #include "base/run_loop.h"
 #include "common/command_executor.h"
 #include "testing/gmock/include/gmock/gmock.h"
 #include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/ninja/src/graph.h"
 
 using ::testing::_;
 using ::testing::Eq;
@@ -25,9 +28,8 @@ namespace common {
 
 class MockObserver : public CommandExecutor::Observer {
  public:
-  MOCK_METHOD1(OnCommandStarted, void(const std::string&));
-  MOCK_METHOD2(OnCommandFinished, void(const std::string&,
-                                       const CommandRunner::Result*));
+  MOCK_METHOD1(OnCommandStarted, void(Edge*));
+  MOCK_METHOD1(OnCommandFinished, void(const CommandRunner::Result*));
 };
 
 TEST(CommandExecutorTest, RumCommands) {
@@ -35,13 +37,16 @@ TEST(CommandExecutorTest, RumCommands) {
   base::RunLoop run_loop;
   int times = 20;
   MockObserver observer;
-  EXPECT_CALL(observer, OnCommandStarted(Eq(kSimpleCommand))).Times(times);
-  EXPECT_CALL(observer, OnCommandFinished(Eq(kSimpleCommand), _)).Times(times);
+  // The executor never looks into the edges.
+  std::vector<Edge> edges(times);
+  for (int i = 0; i < times; ++i)
+    EXPECT_CALL(observer, OnCommandStarted(Eq(&edges[i]))).Times(1);
+  EXPECT_CALL(observer, OnCommandFinished(_)).Times(times);
 
   CommandExecutor command_executor;
   command_executor.AddObserver(&observer);
   for (int i = 0; i < times; ++i)
-    command_executor.RunCommand(kSimpleCommand);
+    command_executor.RunCommand(&edges[i], kSimpleCommand);
   base::MessageLoop::current()->PostDelayedTask(FROM_HERE,
       base::MessageLoop::QuitClosure(),
       base::TimeDelta::FromMilliseconds(500));
@@ -0,0 +1,199 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/compression.h"
+
+#if !defined(OS_WIN)
+#include <string.h>
+#include <zlib.h>
+#endif
+
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/memory/scoped_ptr.h"
+
+namespace {
+
+const char kCompressedDir[] = ".dn_compressed";
+const char kCompressedExtension[] = ".gz";
+
+#if !defined(OS_WIN)
+// Asks zlib for the gzip format instead of the zlib one.
+const int kGzipWindowBits = 15 + 16;
+const int kMemLevel = 8;
+
+const int kChunkSize = 64 * 1024;
+
+// Files smaller than this fit in a few packets anyway.
+const int64 kMinSizeToCompress = 4 * 1024;
+
+// Data which doesn't shrink below this ratio is sent as is, the master would
+// spend more time to inflate it than it saves on the link.
+const double kMaxCompressionRatio = 0.9;
+
+// Compresses the first chunk of a file to guess how well the file
+// compresses, so that incompressible files are not compressed in full.
+bool IsCompressible(const char* data, int size) {
+  uLongf compressed_size = compressBound(size);
+  scoped_ptr<Bytef[]> compressed(new Bytef[compressed_size]);
+  if (compress2(compressed.get(), &compressed_size,
+                reinterpret_cast<const Bytef*>(data), size,
+                Z_BEST_SPEED) != Z_OK) {
+    return false;
+  }
+  return compressed_size <= size * kMaxCompressionRatio;
+}
+#endif
+
+}  // namespace
+
+namespace common {
+
+std::string GetCompressedPath(const std::string& path) {
+  return std::string(kCompressedDir) + "/" + path + kCompressedExtension;
+}
+
+std::string GetCompressedDir() {
+  return kCompressedDir;
+}
+
+#if defined(OS_WIN)
+
+bool CompressionSupported() {
+  return false;
+}
+
+bool CompressFile(const base::FilePath& source,
+                  const base::FilePath& dest,
+                  int level) {
+  return false;
+}
+
+Inflater::Inflater() : stream_(NULL), finished_(false) {
+}
+
+Inflater::~Inflater() {
+}
+
+bool Inflater::Inflate(const base::StringPiece& data, std::string* output) {
+  return false;
+}
+
+#else  // !defined(OS_WIN)
+
+bool CompressionSupported() {
+  return true;
+}
+
+bool CompressFile(const base::FilePath& source,
+                  const base::FilePath& dest,
+                  int level) {
+  base::File source_file(source, base::File::FLAG_OPEN | base::File::FLAG_READ);
+  if (!source_file.IsValid() || source_file.GetLength() < kMinSizeToCompress)
+    return false;
+
+  scoped_ptr<char[]> input(new char[kChunkSize]);
+  int read = source_file.Read(0, input.get(), kChunkSize);
+  if (read <= 0 || !IsCompressible(input.get(), read))
+    return false;
+
+  if (!base::CreateDirectory(dest.DirName()))
+    return false;
+  base::FilePath temp_path(dest.value() + FILE_PATH_LITERAL(".tmp"));
+  base::File dest_file(temp_path,
+                       base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+  if (!dest_file.IsValid())
+    return false;
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, level, Z_DEFLATED, kGzipWindowBits, kMemLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    dest_file.Close();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  scoped_ptr<char[]> output(new char[kChunkSize]);
+  int64 offset = read;
+  int flush = Z_NO_FLUSH;
+  bool success = true;
+  while (success) {
+    stream.next_in = reinterpret_cast<Bytef*>(input.get());
+    stream.avail_in = read;
+    flush = read == 0 ? Z_FINISH : Z_NO_FLUSH;
+    do {
+      stream.next_out = reinterpret_cast<Bytef*>(output.get());
+      stream.avail_out = kChunkSize;
+      deflate(&stream, flush);
+      int size = kChunkSize - stream.avail_out;
+      if (size > 0 && dest_file.WriteAtCurrentPos(output.get(), size) != size)
+        success = false;
+    } while (success && stream.avail_out == 0);
+
+    if (flush == Z_FINISH)
+      break;
+
+    read = source_file.Read(offset, input.get(), kChunkSize);
+    if (read < 0)
+      success = false;
+    else
+      offset += read;
+  }
+
+  success = success &&
+            stream.total_out <= stream.total_in * kMaxCompressionRatio;
+  deflateEnd(&stream);
+  dest_file.Close();
+  if (success)
+    success = base::ReplaceFile(temp_path, dest, NULL);
+  if (!success)
+    base::DeleteFile(temp_path, false);
+  return success;
+}
+
+Inflater::Inflater() : stream_(new z_stream), finished_(false) {
+  memset(stream_, 0, sizeof(*stream_));
+  if (inflateInit2(stream_, kGzipWindowBits) != Z_OK) {
+    delete stream_;
+    stream_ = NULL;
+  }
+}
+
+Inflater::~Inflater() {
+  if (stream_ != NULL) {
+    inflateEnd(stream_);
+    delete stream_;
+  }
+}
+
+bool Inflater::Inflate(const base::StringPiece& data, std::string* output) {
+  if (stream_ == NULL)
+    return false;
+  if (finished_)
+    return data.empty();
+
+  char buffer[kChunkSize / 2];
+  stream_->next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream_->avail_in = data.size();
+  do {
+    stream_->next_out = reinterpret_cast<Bytef*>(buffer);
+    stream_->avail_out = sizeof(buffer);
+    int result = inflate(stream_, Z_NO_FLUSH);
+    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+      return false;
+    output->append(buffer, sizeof(buffer) - stream_->avail_out);
+    if (result == Z_STREAM_END) {
+      finished_ = true;
+      return stream_->avail_in == 0;
+    }
+  } while (stream_->avail_out == 0);
+  return true;
+}
+
+#endif  // defined(OS_WIN)
+
+}  // namespace common
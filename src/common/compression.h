@@ -0,0 +1,64 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_COMPRESSION_H_
+#define  COMMON_COMPRESSION_H_
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/strings/string_piece.h"
+
+namespace base {
+class FilePath;
+}  // namespace base
+
+struct z_stream_s;
+
+namespace common {
+
+// Compression of the outputs sent from slaves to the master, in gzip format.
+// It needs zlib, which is not available on Windows.
+bool CompressionSupported();
+
+// Returns the path of the compressed copy of |path| kept by a slave, relative
+// to the build directory, e.g. ".dn_compressed/obj/foo.o.gz".
+std::string GetCompressedPath(const std::string& path);
+
+// Returns the directory of the compressed copies, relative to the build
+// directory.
+std::string GetCompressedDir();
+
+// Compresses |source| into |dest| at |level|, from 1 (fastest) to 9. Returns
+// false, leaving |dest| alone, if it fails, or if |source| is too small or
+// doesn't compress well, e.g. an archive of compressed files.
+bool CompressFile(const base::FilePath& source,
+                  const base::FilePath& dest,
+                  int level);
+
+// Inflater decompresses gzip data given in pieces, e.g. while it is
+// downloaded.
+class Inflater {
+ public:
+  Inflater();
+  ~Inflater();
+
+  // Appends the decompressed |data| to |output|. Returns false if |data| is
+  // corrupt.
+  bool Inflate(const base::StringPiece& data, std::string* output);
+
+  // Whether the end of the stream has been seen, a stream cut short is
+  // corrupt.
+  bool finished() const { return finished_; }
+
+ private:
+  z_stream_s* stream_;
+  bool finished_;
+
+  DISALLOW_COPY_AND_ASSIGN(Inflater);
+};
+
+}  // namespace common
+
+#endif  // COMMON_COMPRESSION_H_
@@ -0,0 +1,83 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/compression.h"
+
+#include <string>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/rand_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace common {
+
+class CompressionTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    if (!CompressionSupported())
+      return;
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    source_ = temp_dir_.path().AppendASCII("source");
+    dest_ = temp_dir_.path().AppendASCII("dir").AppendASCII("source.gz");
+  }
+
+  void WriteSource(const std::string& content) {
+    ASSERT_EQ(static_cast<int>(content.size()),
+              base::WriteFile(source_, content.data(), content.size()));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath source_;
+  base::FilePath dest_;
+};
+
+TEST_F(CompressionTest, CompressAndInflate) {
+  if (!CompressionSupported())
+    return;
+
+  std::string content;
+  for (int i = 0; i < 20000; ++i)
+    content += "int main() { return 0; }\n";
+  WriteSource(content);
+  ASSERT_TRUE(CompressFile(source_, dest_, 1));
+
+  std::string compressed;
+  ASSERT_TRUE(base::ReadFileToString(dest_, &compressed));
+  EXPECT_LT(compressed.size(), content.size() / 2);
+
+  // Inflate in pieces, as they come from the network.
+  Inflater inflater;
+  std::string inflated;
+  const size_t kPieceSize = 1000;
+  for (size_t i = 0; i < compressed.size(); i += kPieceSize) {
+    ASSERT_TRUE(inflater.Inflate(
+        base::StringPiece(compressed).substr(i, kPieceSize), &inflated));
+  }
+  EXPECT_TRUE(inflater.finished());
+  EXPECT_EQ(content, inflated);
+}
+
+TEST_F(CompressionTest, SkipIncompressibleFiles) {
+  if (!CompressionSupported())
+    return;
+
+  WriteSource(base::RandBytesAsString(256 * 1024));
+  EXPECT_FALSE(CompressFile(source_, dest_, 1));
+  EXPECT_FALSE(base::PathExists(dest_));
+
+  WriteSource("tiny");
+  EXPECT_FALSE(CompressFile(source_, dest_, 1));
+}
+
+TEST_F(CompressionTest, InflateCorruptData) {
+  if (!CompressionSupported())
+    return;
+
+  Inflater inflater;
+  std::string inflated;
+  EXPECT_FALSE(inflater.Inflate("not gzip data", &inflated));
+}
+
+}  // namespace common
@@ -0,0 +1,74 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/curl_helper.h"
+
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "common/digest_cache.h"
+
+namespace {
+
+const base::FilePath::CharType kTempExtension[] =
+    FILE_PATH_LITERAL(".fetching");
+
+}  // namespace
+
+namespace common {
+
+// static
+size_t CurlHelper::CurlOptWriteFunction(void* ptr, size_t size, size_t count,
+                                        CurlHelper* curl_helper) {
+  return curl_helper->WriteData(ptr, size, count);
+}
+
+CurlHelper::CurlHelper() : curl_(curl_easy_init()) {
+}
+
+CurlHelper::~CurlHelper() {
+  curl_easy_cleanup(curl_);
+}
+
+bool CurlHelper::Get(const std::string& url,
+                     const base::FilePath& filename,
+                     DigestType type,
+                     const std::string& digest) {
+  digester_.reset(new Digester(type));
+  CHECK(base::CreateDirectory(filename.DirName()));
+  base::FilePath temp_path(filename.value() + kTempExtension);
+  file_.Initialize(temp_path,
+                   base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+  if (!file_.IsValid()) {
+    LOG(ERROR) << temp_path.value();
+    return false;
+  }
+
+  curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION,
+                   CurlHelper::CurlOptWriteFunction);
+  curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this);
+  bool success = curl_easy_perform(curl_) == CURLE_OK;
+  file_.Close();
+  std::string fetched_digest = digester_->Finish();
+  digester_.reset();
+
+  success = success && fetched_digest == digest &&
+            base::ReplaceFile(temp_path, filename, NULL);
+  if (!success) {
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  // The digest of the content is known, don't read the file again.
+  DigestCache::GetInstance()->Record(filename, type, digest);
+  return true;
+}
+
+size_t CurlHelper::WriteData(void* ptr, size_t size, size_t count) {
+  base::StringPiece data(reinterpret_cast<char*>(ptr), size * count);
+  digester_->Update(data);
+  return file_.WriteAtCurrentPos(data.data(), data.size());
+}
+
+}  // namespace common
@@ -0,0 +1,51 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_CURL_HELPER_H_
+#define  COMMON_CURL_HELPER_H_
+
+#include <string>
+
+#include "base/files/file.h"
+#include "base/memory/scoped_ptr.h"
+#include "common/digest.h"
+#include "curl/curl.h"
+
+namespace base {
+class FilePath;
+}  // namespace base
+
+namespace common {
+
+// Curl helper, with check sum.
+class CurlHelper {
+ public:
+  static size_t CurlOptWriteFunction(void* ptr, size_t size, size_t count,
+                                     CurlHelper* curl_helper);
+
+  CurlHelper();
+  ~CurlHelper();
+
+  // Performs HTTP get to download the |url| to |filename|. The content goes
+  // to a temporary file next to |filename|, which replaces |filename| only if
+  // its |type| digest, computed while it is written, is |digest|. Readers of
+  // |filename| never see a partial or wrong file. Returns true on success.
+  bool Get(const std::string& url,
+           const base::FilePath& filename,
+           DigestType type,
+           const std::string& digest);
+
+ private:
+  size_t WriteData(void* ptr, size_t size, size_t count);
+
+  CURL* curl_;
+  scoped_ptr<Digester> digester_;
+  base::File file_;
+
+  DISALLOW_COPY_AND_ASSIGN(CurlHelper);
+};
+
+}  // namespace common
+
+#endif  // COMMON_CURL_HELPER_H_
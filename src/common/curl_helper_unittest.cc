@@ -2,13 +2,14 @@
 // Use of this source code is governed by the BSD license that can be
 // found in the LICENSE file.
 
+#include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/path_service.h"
+#include "common/curl_helper.h"
 #include "common/util.h"
-#include "master/curl_helper.h"
 #include "testing/gtest/include/gtest/gtest.h"
 
-namespace master {
+namespace common {
 
 #if defined(OS_LINUX)
 // Our precompiled libcurl.lib does not support SSL yet.
@@ -28,8 +29,17 @@ TEST(CurlHelperTest, MAYBE_GetWithMD5) {
   CurlHelper curl_helper;
   const std::string klicenseURL =
       "https://raw.githubusercontent.com/zhchbin/DN/master/LICENSE";
+  base::FilePath file_path = temp_dir.path().AppendASCII("file");
+  EXPECT_TRUE(curl_helper.Get(klicenseURL, file_path, DIGEST_MD5,
+                              common::GetMd5Digest(license_file_path)));
   EXPECT_EQ(common::GetMd5Digest(license_file_path),
-            curl_helper.Get(klicenseURL, temp_dir.path().AppendASCII("file")));
+            common::GetMd5Digest(file_path));
+
+  // A download which does not match the digest is not kept.
+  base::FilePath other_path = temp_dir.path().AppendASCII("other");
+  EXPECT_FALSE(curl_helper.Get(klicenseURL, other_path, DIGEST_MD5,
+                               "0123456789abcdef0123456789abcdef"));
+  EXPECT_FALSE(base::PathExists(other_path));
 }
 
-}  // namespace master
+}  // namespace common
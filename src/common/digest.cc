@@ -0,0 +1,279 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/digest.h"
+
+#if defined(OS_POSIX)
+#include <sys/mman.h>
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/logging.h"
+#include "base/sys_byteorder.h"
+
+namespace {
+
+const char kMd5Name[] = "md5";
+const char kXXH64Name[] = "xxh64";
+
+// See https://github.com/Cyan4973/xxHash for the specification of XXH64.
+const uint64 kPrime1 = 11400714785074694791ULL;
+const uint64 kPrime2 = 14029467366897019727ULL;
+const uint64 kPrime3 = 1609587929392839161ULL;
+const uint64 kPrime4 = 9650029242287828579ULL;
+const uint64 kPrime5 = 2870177450012600261ULL;
+
+inline uint64 RotateLeft(uint64 value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64 Read64(const char* data) {
+  uint64 value;
+  memcpy(&value, data, sizeof(value));
+  return base::ByteSwapToLE64(value);
+}
+
+inline uint32 Read32(const char* data) {
+  uint32 value;
+  memcpy(&value, data, sizeof(value));
+  return base::ByteSwapToLE32(value);
+}
+
+inline uint64 Round(uint64 acc, uint64 input) {
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64 MergeRound(uint64 acc, uint64 value) {
+  acc ^= Round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+
+std::string ToHex(uint64 value) {
+  static const char kHexChars[] = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    hex[i] = kHexChars[value & 0xf];
+    value >>= 4;
+  }
+  return hex;
+}
+
+}  // namespace
+
+namespace common {
+
+bool ParseDigestType(const std::string& name, DigestType* type) {
+  if (name == kMd5Name) {
+    *type = DIGEST_MD5;
+    return true;
+  }
+  if (name == kXXH64Name) {
+    *type = DIGEST_XXH64;
+    return true;
+  }
+  return false;
+}
+
+const char* DigestTypeToString(DigestType type) {
+  switch (type) {
+    case DIGEST_MD5:
+      return kMd5Name;
+    case DIGEST_XXH64:
+      return kXXH64Name;
+    default:
+      NOTREACHED();
+      return "";
+  }
+}
+
+Digester::Digester(DigestType type) : type_(type) {
+  if (type_ == DIGEST_XXH64)
+    XXH64Init();
+  else
+    base::MD5Init(&md5_context_);
+}
+
+Digester::~Digester() {
+}
+
+void Digester::Update(const base::StringPiece& data) {
+  if (type_ == DIGEST_XXH64)
+    XXH64Update(data.data(), data.size());
+  else
+    base::MD5Update(&md5_context_, data);
+}
+
+std::string Digester::Finish() {
+  if (type_ == DIGEST_XXH64)
+    return ToHex(XXH64Final());
+
+  base::MD5Digest digest;
+  base::MD5Final(&digest, &md5_context_);
+  return base::MD5DigestToBase16(digest);
+}
+
+void Digester::XXH64Init() {
+  xxh64_state_.total_length = 0;
+  xxh64_state_.v1 = kPrime1 + kPrime2;
+  xxh64_state_.v2 = kPrime2;
+  xxh64_state_.v3 = 0;
+  xxh64_state_.v4 = 0 - kPrime1;
+  xxh64_state_.buffer_size = 0;
+}
+
+void Digester::XXH64Update(const char* data, size_t length) {
+  XXH64State& state = xxh64_state_;
+  state.total_length += length;
+
+  // Fill up the stripe left over by the last update first.
+  if (state.buffer_size > 0) {
+    size_t size = std::min(length, sizeof(state.buffer) - state.buffer_size);
+    memcpy(state.buffer + state.buffer_size, data, size);
+    state.buffer_size += size;
+    data += size;
+    length -= size;
+    if (state.buffer_size < sizeof(state.buffer))
+      return;
+
+    state.v1 = Round(state.v1, Read64(state.buffer));
+    state.v2 = Round(state.v2, Read64(state.buffer + 8));
+    state.v3 = Round(state.v3, Read64(state.buffer + 16));
+    state.v4 = Round(state.v4, Read64(state.buffer + 24));
+    state.buffer_size = 0;
+  }
+
+  // The four lanes are independent, which keeps the pipeline of the CPU
+  // busy.
+  uint64 v1 = state.v1;
+  uint64 v2 = state.v2;
+  uint64 v3 = state.v3;
+  uint64 v4 = state.v4;
+  while (length >= 32) {
+    v1 = Round(v1, Read64(data));
+    v2 = Round(v2, Read64(data + 8));
+    v3 = Round(v3, Read64(data + 16));
+    v4 = Round(v4, Read64(data + 24));
+    data += 32;
+    length -= 32;
+  }
+  state.v1 = v1;
+  state.v2 = v2;
+  state.v3 = v3;
+  state.v4 = v4;
+
+  memcpy(state.buffer, data, length);
+  state.buffer_size = length;
+}
+
+uint64 Digester::XXH64Final() {
+  const XXH64State& state = xxh64_state_;
+  uint64 hash;
+  if (state.total_length >= 32) {
+    hash = RotateLeft(state.v1, 1) + RotateLeft(state.v2, 7) +
+           RotateLeft(state.v3, 12) + RotateLeft(state.v4, 18);
+    hash = MergeRound(hash, state.v1);
+    hash = MergeRound(hash, state.v2);
+    hash = MergeRound(hash, state.v3);
+    hash = MergeRound(hash, state.v4);
+  } else {
+    hash = kPrime5;
+  }
+  hash += state.total_length;
+
+  const char* data = state.buffer;
+  const char* end = state.buffer + state.buffer_size;
+  for (; data + 8 <= end; data += 8) {
+    hash ^= Round(0, Read64(data));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (data + 4 <= end) {
+    hash ^= static_cast<uint64>(Read32(data)) * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    data += 4;
+  }
+  for (; data < end; ++data) {
+    hash ^= static_cast<uint8>(*data) * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+std::string ComputeFileDigest(const base::FilePath& file_path,
+                              DigestType type) {
+  base::File file(file_path, base::File::FLAG_OPEN | base::File::FLAG_READ);
+  if (!file.IsValid())
+    return std::string();
+
+  Digester digester(type);
+  int64 length = file.GetLength();
+  if (length < 0)
+    return std::string();
+  if (length == 0)
+    return digester.Finish();  // Empty files can not be mapped.
+
+  base::MemoryMappedFile mapped_file;
+  if (!mapped_file.Initialize(file.Pass()))
+    return std::string();
+
+#if defined(OS_POSIX)
+  // The file is read once from start to end, ask for aggressive readahead.
+  madvise(const_cast<uint8*>(mapped_file.data()), mapped_file.length(),
+          MADV_SEQUENTIAL);
+#endif
+  digester.Update(
+      base::StringPiece(reinterpret_cast<const char*>(mapped_file.data()),
+                        mapped_file.length()));
+  return digester.Finish();
+}
+
+bool ComputeChunkDigests(const base::FilePath& file_path,
+                         DigestType type,
+                         int64 chunk_size,
+                         std::vector<std::string>* digests) {
+  DCHECK_GT(chunk_size, 0);
+  digests->clear();
+  base::File file(file_path, base::File::FLAG_OPEN | base::File::FLAG_READ);
+  if (!file.IsValid())
+    return false;
+
+  int64 length = file.GetLength();
+  if (length < 0)
+    return false;
+  if (length == 0)
+    return true;
+
+  base::MemoryMappedFile mapped_file;
+  if (!mapped_file.Initialize(file.Pass()))
+    return false;
+
+#if defined(OS_POSIX)
+  madvise(const_cast<uint8*>(mapped_file.data()), mapped_file.length(),
+          MADV_SEQUENTIAL);
+#endif
+  const char* data = reinterpret_cast<const char*>(mapped_file.data());
+  for (int64 offset = 0; offset < length; offset += chunk_size) {
+    Digester digester(type);
+    digester.Update(base::StringPiece(
+        data + offset,
+        static_cast<size_t>(std::min(chunk_size, length - offset))));
+    digests->push_back(digester.Finish());
+  }
+  return true;
+}
+
+}  // namespace common
@@ -0,0 +1,88 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_DIGEST_H_
+#define  COMMON_DIGEST_H_
+
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/md5.h"
+#include "base/strings/string_piece.h"
+
+namespace base {
+class FilePath;
+}  // namespace base
+
+namespace common {
+
+// The digests of files exchanged by the master and slaves. The values match
+// slave::DigestType in slave_services.proto.
+enum DigestType {
+  DIGEST_MD5 = 0,
+
+  // XXH64, much faster than md5, which makes it a better fit for large
+  // outputs, e.g. of links. It is not a cryptographic hash.
+  DIGEST_XXH64 = 1,
+
+  DIGEST_TYPE_COUNT,
+};
+
+// Returns false if |name|, e.g. "md5" or "xxh64", is unknown.
+bool ParseDigestType(const std::string& name, DigestType* type);
+const char* DigestTypeToString(DigestType type);
+
+// Digester computes a digest over data given in pieces, e.g. while a file is
+// downloaded.
+class Digester {
+ public:
+  explicit Digester(DigestType type);
+  ~Digester();
+
+  void Update(const base::StringPiece& data);
+
+  // Returns the digest in lower case hex. The digester must not be used
+  // afterwards.
+  std::string Finish();
+
+ private:
+  // The state of XXH64.
+  struct XXH64State {
+    uint64 total_length;
+    uint64 v1;
+    uint64 v2;
+    uint64 v3;
+    uint64 v4;
+    char buffer[32];
+    size_t buffer_size;
+  };
+
+  void XXH64Init();
+  void XXH64Update(const char* data, size_t length);
+  uint64 XXH64Final();
+
+  DigestType type_;
+  base::MD5Context md5_context_;
+  XXH64State xxh64_state_;
+
+  DISALLOW_COPY_AND_ASSIGN(Digester);
+};
+
+// Returns the digest of |file_path| in lower case hex, or an empty string if
+// it can not be read. The file is memory mapped and read sequentially.
+std::string ComputeFileDigest(const base::FilePath& file_path,
+                              DigestType type);
+
+// Computes the digests of the consecutive chunks of |chunk_size| bytes of
+// |file_path|, the last one may be shorter. Returns false if it can not be
+// read.
+bool ComputeChunkDigests(const base::FilePath& file_path,
+                         DigestType type,
+                         int64 chunk_size,
+                         std::vector<std::string>* digests);
+
+}  // namespace common
+
+#endif  // COMMON_DIGEST_H_
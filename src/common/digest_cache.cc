@@ -0,0 +1,278 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/digest_cache.h"
+
+#if defined(OS_POSIX)
+#include <sys/stat.h>
+#endif
+
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/time/time.h"
+#include "common/util.h"
+
+namespace {
+
+const int64 kNanosecondsPerMicrosecond = 1000;
+const int64 kNanosecondsPerSecond = 1000 * 1000 * 1000;
+
+// Files modified less than this before they are hashed are not recorded.
+const int64 kRacyIntervalInNanoseconds = kNanosecondsPerSecond;
+
+// The log is compacted when it has at least this many lines, and twice as
+// many lines as digests.
+const size_t kMinLinesToCompact = 1000;
+
+int64 NowInNanoseconds() {
+  return (base::Time::Now() - base::Time::UnixEpoch()).InMicroseconds() *
+         kNanosecondsPerMicrosecond;
+}
+
+}  // namespace
+
+namespace common {
+
+DigestCache::Entry::Entry() : mtime(0), size(0), inode(0) {
+  for (int type = 0; type < DIGEST_TYPE_COUNT; ++type)
+    racy[type] = false;
+}
+
+bool DigestCache::Entry::SameIdentity(const Entry& other) const {
+  return mtime == other.mtime && size == other.size && inode == other.inode;
+}
+
+// static
+DigestCache* DigestCache::GetInstance() {
+  return Singleton<DigestCache>::get();
+}
+
+DigestCache::DigestCache() : initialized_(false) {
+}
+
+DigestCache::~DigestCache() {
+}
+
+bool DigestCache::Init(const base::FilePath& log_path) {
+  base::AutoLock lock(lock_);
+  DCHECK(!initialized_);
+
+  size_t lines = 0;
+  std::string content;
+  if (base::ReadFileToString(log_path, &content)) {
+    std::vector<std::string> log_lines;
+    base::SplitString(content, '\n', &log_lines);
+    for (size_t i = 0; i < log_lines.size(); ++i) {
+      std::string path;
+      Entry entry;
+      DigestType type;
+      if (log_lines[i].empty() || !Parse(log_lines[i], &path, &entry, &type))
+        continue;
+      MergeLocked(path, entry, type);
+      lines++;
+    }
+  }
+
+  size_t digests = 0;
+  for (EntryMap::const_iterator it = entries_.begin();
+       it != entries_.end();
+       ++it) {
+    for (int type = 0; type < DIGEST_TYPE_COUNT; ++type) {
+      if (!it->second.digests[type].empty())
+        digests++;
+    }
+  }
+
+  if (lines >= kMinLinesToCompact && lines > 2 * digests) {
+    std::string compacted;
+    for (EntryMap::const_iterator it = entries_.begin();
+         it != entries_.end();
+         ++it) {
+      for (int type = 0; type < DIGEST_TYPE_COUNT; ++type) {
+        if (!it->second.digests[type].empty()) {
+          compacted += Serialize(it->first, it->second,
+                                 static_cast<DigestType>(type));
+        }
+      }
+    }
+    base::FilePath temp_path = log_path.AddExtension(FILE_PATH_LITERAL("tmp"));
+    if (base::WriteFile(temp_path, compacted.data(), compacted.size()) ==
+        static_cast<int>(compacted.size())) {
+      base::ReplaceFile(temp_path, log_path, NULL);
+    }
+  }
+
+  log_file_.Initialize(log_path,
+                       base::File::FLAG_OPEN_ALWAYS | base::File::FLAG_APPEND);
+  if (!log_file_.IsValid()) {
+    LOG(ERROR) << "Failed to open " << log_path.value();
+    entries_.clear();
+    return false;
+  }
+
+  initialized_ = true;
+  return true;
+}
+
+std::string DigestCache::GetDigest(const base::FilePath& file_path,
+                                   DigestType type) {
+  if (!initialized_)
+    return ComputeFileDigest(file_path, type);
+
+  Entry entry;
+  if (!Stat(file_path, &entry))
+    return std::string();
+
+  std::string path = file_path.AsUTF8Unsafe();
+  {
+    base::AutoLock lock(lock_);
+    EntryMap::const_iterator it = entries_.find(path);
+    if (it != entries_.end() && it->second.SameIdentity(entry) &&
+        !it->second.digests[type].empty()) {
+      entry = it->second;
+    }
+  }
+  if (!entry.digests[type].empty()) {
+    // A digest given by Record() goes to the log once the file is out of the
+    // racy interval.
+    if (entry.racy[type] &&
+        entry.mtime < NowInNanoseconds() - kRacyIntervalInNanoseconds) {
+      entry.racy[type] = false;
+      RecordEntry(path, entry, type);
+    }
+    return entry.digests[type];
+  }
+
+  int64 start_time = NowInNanoseconds();
+  std::string digest = ComputeFileDigest(file_path, type);
+  entry.digests[type] = digest;
+
+  // Don't record a file which is being written, or which may be written
+  // again without a visible change of its identity.
+  Entry current;
+  if (!digest.empty() &&
+      Stat(file_path, &current) && current.SameIdentity(entry) &&
+      entry.mtime < start_time - kRacyIntervalInNanoseconds) {
+    RecordEntry(path, entry, type);
+  }
+  return digest;
+}
+
+void DigestCache::Record(const base::FilePath& file_path,
+                         DigestType type,
+                         const std::string& digest) {
+  if (!initialized_ || digest.empty())
+    return;
+
+  // The file has usually just been written. Its entry is only kept in memory
+  // until it leaves the racy interval, see GetDigest().
+  Entry entry;
+  if (!Stat(file_path, &entry))
+    return;
+  entry.digests[type] = digest;
+  if (entry.mtime >= NowInNanoseconds() - kRacyIntervalInNanoseconds) {
+    entry.racy[type] = true;
+    base::AutoLock lock(lock_);
+    MergeLocked(file_path.AsUTF8Unsafe(), entry, type);
+    return;
+  }
+  RecordEntry(file_path.AsUTF8Unsafe(), entry, type);
+}
+
+// static
+bool DigestCache::Stat(const base::FilePath& file_path, Entry* entry) {
+#if defined(OS_POSIX)
+  struct stat st;
+  if (stat(file_path.value().c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+
+#if defined(OS_MACOSX)
+  entry->mtime = st.st_mtimespec.tv_sec * kNanosecondsPerSecond +
+                 st.st_mtimespec.tv_nsec;
+#else
+  entry->mtime = st.st_mtim.tv_sec * kNanosecondsPerSecond +
+                 st.st_mtim.tv_nsec;
+#endif
+  entry->size = st.st_size;
+  entry->inode = st.st_ino;
+#else
+  // There is no inode, the modification time and size have to do.
+  base::File::Info info;
+  if (!base::GetFileInfo(file_path, &info) || info.is_directory)
+    return false;
+
+  entry->mtime = (info.last_modified - base::Time::UnixEpoch())
+                     .InMicroseconds() * kNanosecondsPerMicrosecond;
+  entry->size = info.size;
+  entry->inode = 0;
+#endif
+  return true;
+}
+
+// static
+std::string DigestCache::Serialize(const std::string& path,
+                                   const Entry& entry,
+                                   DigestType type) {
+  // The path goes last since it may contain spaces.
+  return base::Int64ToString(entry.mtime) + " " +
+         base::Int64ToString(entry.size) + " " +
+         base::Uint64ToString(entry.inode) + " " +
+         DigestTypeToString(type) + " " +
+         entry.digests[type] + " " + path + "\n";
+}
+
+// static
+bool DigestCache::Parse(const std::string& line,
+                        std::string* path,
+                        Entry* entry,
+                        DigestType* type) {
+  std::vector<std::string> fields;
+  size_t begin = 0;
+  for (int i = 0; i < 5; ++i) {
+    size_t end = line.find(' ', begin);
+    if (end == std::string::npos)
+      return false;
+    fields.push_back(line.substr(begin, end - begin));
+    begin = end + 1;
+  }
+
+  *path = line.substr(begin);
+  if (path->empty() || fields[4].empty() || !ParseDigestType(fields[3], type))
+    return false;
+  entry->digests[*type] = fields[4];
+  return base::StringToInt64(fields[0], &entry->mtime) &&
+         base::StringToInt64(fields[1], &entry->size) &&
+         base::StringToUint64(fields[2], &entry->inode);
+}
+
+void DigestCache::MergeLocked(const std::string& path,
+                              const Entry& entry,
+                              DigestType type) {
+  lock_.AssertAcquired();
+  EntryMap::iterator it = entries_.find(path);
+  if (it == entries_.end() || !it->second.SameIdentity(entry)) {
+    entries_[path] = entry;
+  } else {
+    it->second.digests[type] = entry.digests[type];
+    it->second.racy[type] = entry.racy[type];
+  }
+}
+
+void DigestCache::RecordEntry(const std::string& path,
+                              const Entry& entry,
+                              DigestType type) {
+  std::string line = Serialize(path, entry, type);
+  base::AutoLock lock(lock_);
+  MergeLocked(path, entry, type);
+  if (log_file_.WriteAtCurrentPos(line.data(), line.size()) !=
+      static_cast<int>(line.size())) {
+    LOG(ERROR) << "Failed to append " << path << " to digest cache.";
+  }
+}
+
+}  // namespace common
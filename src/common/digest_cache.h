@@ -0,0 +1,115 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_DIGEST_CACHE_H_
+#define  COMMON_DIGEST_CACHE_H_
+
+#include <map>
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/memory/singleton.h"
+#include "base/synchronization/lock.h"
+#include "common/digest.h"
+
+namespace common {
+
+// DigestCache maps the stat identity of a file, i.e. its modification time,
+// size and inode, to its digests, see DigestType, so that a file which has
+// not changed is never read again. The entries are kept in an append-only log
+// in the build directory, later lines override earlier ones. The log is
+// compacted when it is loaded.
+//
+// Files modified in the second before they are hashed are not recorded,
+// since they may change again without a visible change of the modification
+// time. The digests given by Record() for files which have just been written
+// are kept in memory, and go to the log once they are older than that.
+//
+// All the methods are thread-safe.
+class DigestCache {
+ public:
+  // Returns the cache of the process, see common::GetFileDigest().
+  static DigestCache* GetInstance();
+
+  DigestCache();
+  ~DigestCache();
+
+  // Loads the entries from |log_path| and opens it for appending. Until it is
+  // called, every digest is computed and nothing is recorded.
+  bool Init(const base::FilePath& log_path);
+  bool initialized() const { return initialized_; }
+
+  // Returns the digest of |file_path|, or an empty string if it can not be
+  // read.
+  std::string GetDigest(const base::FilePath& file_path, DigestType type);
+
+  // Records |digest| as the digest of |file_path|, e.g. of a file written
+  // by the caller, which computed the digest of the content on the way and
+  // has not modified it since. If |file_path| has been modified in the last
+  // second, the entry is only logged by a lookup which finds it older.
+  void Record(const base::FilePath& file_path,
+              DigestType type,
+              const std::string& digest);
+
+ private:
+  friend struct DefaultSingletonTraits<DigestCache>;
+
+  struct Entry {
+    Entry();
+
+    bool SameIdentity(const Entry& other) const;
+
+    int64 mtime;  // In nanoseconds.
+    int64 size;
+    uint64 inode;
+
+    // Indexed by DigestType, empty if unknown.
+    std::string digests[DIGEST_TYPE_COUNT];
+
+    // Whether the digest has been recorded in the racy interval and is not in
+    // the log yet, see Record(). Not serialized.
+    bool racy[DIGEST_TYPE_COUNT];
+  };
+
+  // Fills the identity of |entry| from the stat of |file_path|.
+  static bool Stat(const base::FilePath& file_path, Entry* entry);
+
+  // Each line of the log holds one digest of a file.
+  static std::string Serialize(const std::string& path,
+                               const Entry& entry,
+                               DigestType type);
+
+  // Parses a line of the log, returns false if it is malformed, e.g. the
+  // last line written before a crash.
+  static bool Parse(const std::string& line,
+                    std::string* path,
+                    Entry* entry,
+                    DigestType* type);
+
+  // Sets the |type| digest of |path| to the one of |entry|. Digests of other
+  // types are kept if the identity is the same. Must be called with |lock_|
+  // held.
+  void MergeLocked(const std::string& path,
+                   const Entry& entry,
+                   DigestType type);
+
+  void RecordEntry(const std::string& path,
+                   const Entry& entry,
+                   DigestType type);
+
+  bool initialized_;
+
+  base::Lock lock_;
+  typedef std::map<std::string, Entry> EntryMap;
+  EntryMap entries_;
+  base::File log_file_;
+
+  DISALLOW_COPY_AND_ASSIGN(DigestCache);
+};
+
+}  // namespace common
+
+#endif  // COMMON_DIGEST_CACHE_H_
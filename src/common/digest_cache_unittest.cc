@@ -0,0 +1,121 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include <string>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/time/time.h"
+#include "common/digest_cache.h"
+#include "common/util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace common {
+
+class DigestCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    log_path_ = temp_dir_.path().AppendASCII("digests");
+    file_path_ = temp_dir_.path().AppendASCII("file");
+  }
+
+  // Writes |content| to |file_path_| with an old modification time, so that
+  // its digest can be recorded.
+  void WriteFile(const std::string& content) {
+    ASSERT_EQ(static_cast<int>(content.size()),
+              base::WriteFile(file_path_, content.data(), content.size()));
+    base::Time old_time = base::Time::FromDoubleT(1000000000);
+    ASSERT_TRUE(base::TouchFile(file_path_, old_time, old_time));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath log_path_;
+  base::FilePath file_path_;
+};
+
+TEST_F(DigestCacheTest, SkipUnchangedFiles) {
+  WriteFile("aaaa");
+  std::string digest = ComputeMd5Digest(file_path_);
+
+  DigestCache digest_cache;
+  ASSERT_TRUE(digest_cache.Init(log_path_));
+  EXPECT_EQ(digest, digest_cache.GetDigest(file_path_, DIGEST_MD5));
+
+  // Same size and modification time, the file is not read again.
+  WriteFile("bbbb");
+  EXPECT_EQ(digest, digest_cache.GetDigest(file_path_, DIGEST_MD5));
+
+  // The entry is kept across runs.
+  DigestCache reloaded_digest_cache;
+  ASSERT_TRUE(reloaded_digest_cache.Init(log_path_));
+  EXPECT_EQ(digest, reloaded_digest_cache.GetDigest(file_path_, DIGEST_MD5));
+
+  WriteFile("ccccc");
+  EXPECT_EQ(ComputeMd5Digest(file_path_),
+            reloaded_digest_cache.GetDigest(file_path_, DIGEST_MD5));
+}
+
+TEST_F(DigestCacheTest, SkipRecentlyModifiedFiles) {
+  ASSERT_EQ(4, base::WriteFile(file_path_, "aaaa", 4));
+
+  DigestCache digest_cache;
+  ASSERT_TRUE(digest_cache.Init(log_path_));
+  digest_cache.GetDigest(file_path_, DIGEST_MD5);
+
+  ASSERT_EQ(4, base::WriteFile(file_path_, "bbbb", 4));
+  EXPECT_EQ(ComputeMd5Digest(file_path_),
+            digest_cache.GetDigest(file_path_, DIGEST_MD5));
+}
+
+TEST_F(DigestCacheTest, Record) {
+  WriteFile("aaaa");
+
+  DigestCache digest_cache;
+  ASSERT_TRUE(digest_cache.Init(log_path_));
+  const std::string kDigest = "0123456789abcdef0123456789abcdef";
+  digest_cache.Record(file_path_, DIGEST_MD5, kDigest);
+  EXPECT_EQ(kDigest, digest_cache.GetDigest(file_path_, DIGEST_MD5));
+}
+
+TEST_F(DigestCacheTest, DeferRecordOfRecentlyModifiedFiles) {
+  ASSERT_EQ(4, base::WriteFile(file_path_, "aaaa", 4));
+
+  DigestCache digest_cache;
+  ASSERT_TRUE(digest_cache.Init(log_path_));
+  const std::string kDigest = "0123456789abcdef0123456789abcdef";
+  digest_cache.Record(file_path_, DIGEST_MD5, kDigest);
+  EXPECT_EQ(kDigest, digest_cache.GetDigest(file_path_, DIGEST_MD5));
+
+  // The file has just been written, the entry is not logged yet.
+  DigestCache reloaded_digest_cache;
+  ASSERT_TRUE(reloaded_digest_cache.Init(log_path_));
+  EXPECT_EQ(ComputeMd5Digest(file_path_),
+            reloaded_digest_cache.GetDigest(file_path_, DIGEST_MD5));
+
+  // A later change of the file is seen.
+  WriteFile("bbbbb");
+  EXPECT_EQ(ComputeMd5Digest(file_path_),
+            digest_cache.GetDigest(file_path_, DIGEST_MD5));
+}
+
+TEST_F(DigestCacheTest, KeepDigestsOfEachType) {
+  WriteFile("aaaa");
+
+  DigestCache digest_cache;
+  ASSERT_TRUE(digest_cache.Init(log_path_));
+  const std::string kMd5Digest = "0123456789abcdef0123456789abcdef";
+  const std::string kXXH64Digest = "0123456789abcdef";
+  digest_cache.Record(file_path_, DIGEST_MD5, kMd5Digest);
+  digest_cache.Record(file_path_, DIGEST_XXH64, kXXH64Digest);
+
+  DigestCache reloaded_digest_cache;
+  ASSERT_TRUE(reloaded_digest_cache.Init(log_path_));
+  EXPECT_EQ(kMd5Digest,
+            reloaded_digest_cache.GetDigest(file_path_, DIGEST_MD5));
+  EXPECT_EQ(kXXH64Digest,
+            reloaded_digest_cache.GetDigest(file_path_, DIGEST_XXH64));
+}
+
+}  // namespace common
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/digest.h"
+
+#include <string>
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace common {
+
+namespace {
+
+std::string Digest(DigestType type, const std::string& data) {
+  Digester digester(type);
+  digester.Update(data);
+  return digester.Finish();
+}
+
+}  // namespace
+
+TEST(DigestTest, XXH64) {
+  EXPECT_EQ("ef46db3751d8e999", Digest(DIGEST_XXH64, ""));
+  EXPECT_EQ("d24ec4f1a98c6e5b", Digest(DIGEST_XXH64, "a"));
+  EXPECT_EQ("44bc2cf5ad770999", Digest(DIGEST_XXH64, "abc"));
+  EXPECT_EQ("fbcea83c8a378bf1",
+            Digest(DIGEST_XXH64, "Nobody inspects the spammish repetition"));
+}
+
+TEST(DigestTest, MD5) {
+  EXPECT_EQ("d41d8cd98f00b204e9800998ecf8427e", Digest(DIGEST_MD5, ""));
+  EXPECT_EQ("900150983cd24fb0d6963f7d28e17f72", Digest(DIGEST_MD5, "abc"));
+}
+
+TEST(DigestTest, UpdateInPieces) {
+  std::string data;
+  for (int i = 0; i < 100; ++i)
+    data.push_back(static_cast<char>(i));
+  EXPECT_EQ("6ac1e58032166597", Digest(DIGEST_XXH64, data));
+
+  // Pieces which don't line up with the stripes of XXH64.
+  Digester digester(DIGEST_XXH64);
+  digester.Update(base::StringPiece(data.data(), 7));
+  digester.Update(base::StringPiece(data.data() + 7, 40));
+  digester.Update(base::StringPiece(data.data() + 47, 53));
+  EXPECT_EQ("6ac1e58032166597", digester.Finish());
+}
+
+TEST(DigestTest, ComputeFileDigest) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path = temp_dir.path().AppendASCII("file");
+  EXPECT_EQ("", ComputeFileDigest(file_path, DIGEST_XXH64));
+
+  ASSERT_EQ(0, base::WriteFile(file_path, "", 0));
+  EXPECT_EQ("ef46db3751d8e999", ComputeFileDigest(file_path, DIGEST_XXH64));
+
+  ASSERT_EQ(3, base::WriteFile(file_path, "abc", 3));
+  EXPECT_EQ("44bc2cf5ad770999", ComputeFileDigest(file_path, DIGEST_XXH64));
+  EXPECT_EQ("900150983cd24fb0d6963f7d28e17f72",
+            ComputeFileDigest(file_path, DIGEST_MD5));
+}
+
+TEST(DigestTest, ComputeChunkDigests) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path = temp_dir.path().AppendASCII("file");
+  std::vector<std::string> digests;
+  EXPECT_FALSE(ComputeChunkDigests(file_path, DIGEST_MD5, 2, &digests));
+
+  ASSERT_EQ(5, base::WriteFile(file_path, "ababa", 5));
+  ASSERT_TRUE(ComputeChunkDigests(file_path, DIGEST_MD5, 2, &digests));
+  ASSERT_EQ(3u, digests.size());
+  EXPECT_EQ("187ef4436122d1cc2f40dc2b92f0eba0", digests[0]);  // md5("ab")
+  EXPECT_EQ(digests[0], digests[1]);
+  EXPECT_EQ("0cc175b9c0f1b6a831c399e269772661", digests[2]);  // md5("a")
+
+  ASSERT_TRUE(ComputeChunkDigests(file_path, DIGEST_MD5, 8, &digests));
+  ASSERT_EQ(1u, digests.size());
+  EXPECT_EQ(ComputeFileDigest(file_path, DIGEST_MD5), digests[0]);
+}
+
+TEST(DigestTest, ParseDigestType) {
+  DigestType type;
+  ASSERT_TRUE(ParseDigestType("xxh64", &type));
+  EXPECT_EQ(DIGEST_XXH64, type);
+  ASSERT_TRUE(ParseDigestType("md5", &type));
+  EXPECT_EQ(DIGEST_MD5, type);
+  EXPECT_FALSE(ParseDigestType("sha1", &type));
+}
+
+}  // namespace common
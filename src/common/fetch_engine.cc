@@ -0,0 +1,736 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "common/fetch_engine.h"
+
+#if defined(OS_LINUX)
+#include <fcntl.h>
+#include <linux/falloc.h>
+#endif
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/stl_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "common/compression.h"
+#include "common/digest_cache.h"
+#include "common/util.h"
+#include "thread/ninja_thread.h"
+
+namespace {
+
+const char kHttp[] = "http://";
+const base::FilePath::CharType kTempExtension[] =
+    FILE_PATH_LITERAL(".fetching");
+
+// How long Perform() waits for the sockets before new fetches are picked up.
+const int kWaitTimeoutMs = 20;
+
+// A transfer is tried this many times, waiting twice as long before each
+// attempt as before the last one.
+const int kMaxAttempts = 5;
+const int kInitialRetryDelayMs = 200;
+
+const long kHttpPartialContent = 206;  // NOLINT
+
+// The budget of received bytes doesn't build up beyond this much time, so
+// that an idle engine doesn't burst over the limit.
+const int64 kMaxBudgetMs = 100;
+
+void Preallocate(base::File* file, int64 size) {
+#if defined(OS_LINUX)
+  // Keep the size, so that a short transfer doesn't leave a tail of zeros.
+  fallocate(file->GetPlatformFile(), FALLOC_FL_KEEP_SIZE, 0, size);
+#endif
+}
+
+}  // namespace
+
+namespace common {
+
+FetchEngine::File::File(const std::string& path,
+                        const std::string& digest,
+                        bool compressed)
+    : path(path),
+      digest(digest),
+      compressed(compressed),
+      preserve_mtime(false),
+      size(-1) {
+}
+
+FetchEngine::File::~File() {
+}
+
+struct FetchEngine::Job {
+  Job(FetchEngine* engine,
+      const std::string& host,
+      int64 priority,
+      const FetchCallback& callback,
+      int pending)
+      : engine(engine),
+        host(host),
+        priority(priority),
+        callback(callback),
+        pending(pending),
+        success(true),
+        bytes(0) {
+  }
+
+  FetchEngine* engine;
+  std::string host;
+  int64 priority;
+  FetchCallback callback;
+  int pending;  // The number of downloads which have not finished.
+  bool success;
+
+  // Received from the host, since |start_time|.
+  int64 bytes;
+  base::TimeTicks start_time;
+};
+
+// The download of a file, in one transfer or in ranges.
+struct FetchEngine::Download {
+  Download(Job* job, const File& file)
+      : job(job),
+        path(base::FilePath::FromUTF8Unsafe(file.path)),
+        temp_path(path.value() + kTempExtension),
+        digest(file.digest),
+        url(kHttp + job->host + "/" +
+            (file.compressed ? GetCompressedPath(file.path) : file.path)),
+        compressed(file.compressed),
+        size(file.size),
+        pending(0),
+        success(true),
+        verified(false) {
+  }
+
+  Job* job;
+  base::FilePath path;
+  base::FilePath temp_path;
+  std::string digest;  // Expected.
+  std::string url;
+  bool compressed;
+  int64 size;  // -1 if unknown.
+
+  // Opened by the first write, shared by the ranges.
+  base::File file;
+  int pending;  // The number of transfers which have not finished.
+  bool success;
+
+  // Whether the content written matched |digest| as a whole. The digester of
+  // a transfer is kept when it resumes, so this holds for resumed transfers,
+  // but not for a file fetched in ranges.
+  bool verified;
+};
+
+struct FetchEngine::Transfer {
+  Transfer(Download* download,
+           int64 offset,
+           int64 length,
+           const std::string& digest,
+           DigestType type)
+      : download(download),
+        offset(offset),
+        length(length),
+        digest(digest),
+        type(type),
+        sequence(-1),
+        attempts(0),
+        response_checked(false),
+        handle(NULL) {
+    Restart();
+  }
+
+  // Drops what has been received, the next attempt starts from scratch.
+  void Restart() {
+    received = 0;
+    written = 0;
+    digester.reset(new Digester(type));
+    inflater.reset(download->compressed ? new Inflater() : NULL);
+  }
+
+  Download* download;
+
+  // The range of the file, |length| is -1 up to the end of the file.
+  int64 offset;
+  int64 length;
+  std::string digest;  // Expected, of the range.
+  DigestType type;
+
+  // Kept across attempts. |received| counts the bytes from the host and
+  // |written| the bytes of the file, they differ if the file is compressed.
+  int64 received;
+  int64 written;
+  scoped_ptr<Digester> digester;
+  scoped_ptr<Inflater> inflater;  // NULL unless the file is compressed.
+
+  int64 sequence;  // The order it was first queued in.
+  int attempts;
+  bool response_checked;  // In the current attempt.
+  CURL* handle;
+};
+
+// static
+size_t FetchEngine::OnWrite(void* ptr,
+                            size_t size,
+                            size_t count,
+                            Transfer* transfer) {
+  Download* download = transfer->download;
+  if (!download->job->engine->ConsumeBudget(transfer, size * count))
+    return CURL_WRITEFUNC_PAUSE;  // The same data comes again once resumed.
+
+  if (!transfer->response_checked) {
+    transfer->response_checked = true;
+    long response_code = 0;  // NOLINT
+    curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE,
+                      &response_code);
+    bool asked_for_range = transfer->length >= 0 || transfer->received > 0;
+    if (asked_for_range && response_code != kHttpPartialContent) {
+      // The host ignored the range and sends the whole file. That will do
+      // for a file fetched in one transfer, not for a range of it.
+      if (transfer->length >= 0)
+        return 0;
+      transfer->Restart();
+    }
+  }
+
+  if (!download->file.IsValid()) {
+    download->file.Initialize(
+        download->temp_path,
+        base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+    if (!download->file.IsValid())
+      return 0;  // Aborts the transfer.
+
+    // The length of a compressed file says little about its size.
+    double length = -1;
+    if (download->size > 0) {
+      Preallocate(&download->file, download->size);
+    } else if (!download->compressed &&
+               curl_easy_getinfo(transfer->handle,
+                                 CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                                 &length) == CURLE_OK && length > 0) {
+      Preallocate(&download->file,
+                  transfer->received + static_cast<int64>(length));
+    }
+  }
+
+  base::StringPiece data(static_cast<char*>(ptr), size * count);
+  transfer->received += data.size();
+  download->job->bytes += data.size();
+  std::string inflated;
+  base::StringPiece content = data;
+  if (transfer->inflater) {
+    if (!transfer->inflater->Inflate(data, &inflated))
+      return 0;
+    content = inflated;
+  }
+
+  // The ranges of a file are written in parallel, each at its own offset.
+  if (transfer->length >= 0 &&
+      transfer->written + static_cast<int64>(content.size()) >
+          transfer->length) {
+    return 0;
+  }
+  transfer->digester->Update(content);
+  if (download->file.Write(transfer->offset + transfer->written,
+                           content.data(),
+                           content.size()) !=
+      static_cast<int>(content.size())) {
+    return 0;
+  }
+  transfer->written += content.size();
+  return data.size();
+}
+
+bool FetchEngine::TransferOrder::operator()(const Transfer* a,
+                                           const Transfer* b) const {
+  int64 a_priority = a->download->job->priority;
+  int64 b_priority = b->download->job->priority;
+  if (a_priority != b_priority)
+    return a_priority > b_priority;
+  if (a->sequence != b->sequence)
+    return a->sequence < b->sequence;
+  return a < b;
+}
+
+FetchEngine::FetchEngine(int max_transfers,
+                         int max_transfers_per_host,
+                         DigestType type,
+                         int64 range_size,
+                         int64 max_bytes_per_second)
+    : max_transfers_(max_transfers),
+      max_transfers_per_host_(max_transfers_per_host),
+      type_(type),
+      range_size_(range_size),
+      max_bytes_per_second_(max_bytes_per_second),
+      thread_("FetchEngine"),
+      queued_count_(0),
+      active_count_(0),
+      multi_(NULL),
+      next_sequence_(0),
+      budget_(max_bytes_per_second * kMaxBudgetMs /
+              base::Time::kMillisecondsPerSecond),
+      is_performing_(false) {
+  DCHECK_GT(max_transfers_, 0);
+  DCHECK_GT(max_transfers_per_host_, 0);
+  DCHECK_GT(range_size_, 0);
+}
+
+FetchEngine::~FetchEngine() {
+  if (thread_.IsRunning()) {
+    thread_.message_loop()->PostTask(
+        FROM_HERE,
+        base::Bind(&FetchEngine::CleanUp, base::Unretained(this)));
+    thread_.Stop();
+  }
+}
+
+bool FetchEngine::Start(const StatusCallback& status_callback) {
+  status_callback_ = status_callback;
+  multi_ = curl_multi_init();
+  if (multi_ == NULL)
+    return false;
+
+  curl_multi_setopt(multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    static_cast<long>(max_transfers_));  // NOLINT
+  curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    static_cast<long>(max_transfers_per_host_));  // NOLINT
+  curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS,
+                    static_cast<long>(max_transfers_));  // NOLINT
+  last_refill_time_ = base::TimeTicks::Now();
+  if (!thread_.Start()) {
+    curl_multi_cleanup(multi_);
+    multi_ = NULL;
+    return false;
+  }
+  return true;
+}
+
+void FetchEngine::Fetch(const std::string& host,
+                        const FileVector& files,
+                        int64 priority,
+                        const FetchCallback& callback) {
+  if (files.empty()) {
+    NinjaThread::PostTask(NinjaThread::MAIN,
+                          FROM_HERE,
+                          base::Bind(callback, true, 0, base::TimeDelta()));
+    return;
+  }
+
+  Job* job = new Job(this, host, priority, callback, files.size());
+  NinjaThread::PostBlockingPoolTask(
+      FROM_HERE,
+      base::Bind(&FetchEngine::SkipUnchangedFilesOnBlockingPool,
+                 base::Unretained(this),
+                 job,
+                 files));
+}
+
+int FetchEngine::queued_transfers() const {
+  return base::subtle::NoBarrier_Load(&queued_count_);
+}
+
+int FetchEngine::active_transfers() const {
+  return base::subtle::NoBarrier_Load(&active_count_);
+}
+
+void FetchEngine::SkipUnchangedFilesOnBlockingPool(Job* job,
+                                                   const FileVector& files) {
+  FileVector changed_files;
+  base::Time now = base::Time::Now();
+  for (size_t i = 0; i < files.size(); ++i) {
+    base::FilePath path = base::FilePath::FromUTF8Unsafe(files[i].path);
+    if (!base::PathExists(path) ||
+        GetFileDigest(path, type_) != files[i].digest) {
+      changed_files.push_back(files[i]);
+      continue;
+    }
+    if (files[i].preserve_mtime)
+      continue;
+    if (!base::TouchFile(path, now, now)) {
+      changed_files.push_back(files[i]);
+      continue;
+    }
+
+    // The identity of the file has changed with its modification time.
+    DigestCache::GetInstance()->Record(path, type_, files[i].digest);
+  }
+
+  if (changed_files.empty()) {
+    NinjaThread::PostTask(NinjaThread::MAIN,
+                          FROM_HERE,
+                          base::Bind(job->callback, true, 0,
+                                     base::TimeDelta()));
+    delete job;
+    return;
+  }
+
+  job->pending = changed_files.size();
+  thread_.message_loop()->PostTask(
+      FROM_HERE,
+      base::Bind(&FetchEngine::StartJob,
+                 base::Unretained(this),
+                 job,
+                 changed_files));
+}
+
+void FetchEngine::StartJob(Job* job, const FileVector& files) {
+  job->start_time = base::TimeTicks::Now();
+  for (size_t i = 0; i < files.size(); ++i) {
+    const File& file = files[i];
+    Download* download = new Download(job, file);
+    if (!base::CreateDirectory(download->path.DirName())) {
+      LOG(ERROR) << "Failed to create " << download->path.DirName().value();
+      download->success = false;
+      FinishDownload(download);
+      continue;
+    }
+
+    // A compressed file has no chunks, its ranges on the wire don't match
+    // ranges of the file.
+    int64 ranges = file.size > 0 ? (file.size - 1) / range_size_ + 1 : 0;
+    if (file.compressed || ranges < 2 ||
+        static_cast<int64>(file.chunk_digests.size()) != ranges) {
+      download->pending = 1;
+      QueueTransfer(new Transfer(download, 0, -1, file.digest, type_));
+      continue;
+    }
+
+    download->pending = ranges;
+    for (int64 range = 0; range < ranges; ++range) {
+      int64 offset = range * range_size_;
+      QueueTransfer(new Transfer(download,
+                                 offset,
+                                 std::min(range_size_, file.size - offset),
+                                 file.chunk_digests[range],
+                                 type_));
+    }
+  }
+}
+
+void FetchEngine::QueueTransfer(Transfer* transfer) {
+  // A retry keeps its place.
+  if (transfer->sequence < 0)
+    transfer->sequence = next_sequence_++;
+  queued_transfers_.insert(transfer);
+  StartTransfers();
+}
+
+void FetchEngine::StartTransfers() {
+  TransferQueue::iterator it = queued_transfers_.begin();
+  while (it != queued_transfers_.end() &&
+         static_cast<int>(transfers_.size()) < max_transfers_) {
+    Transfer* transfer = *it;
+    if (host_transfers_[transfer->download->job->host] >=
+        max_transfers_per_host_) {
+      ++it;
+      continue;
+    }
+    queued_transfers_.erase(it++);
+    AddTransfer(transfer);
+  }
+  UpdateStatus();
+}
+
+void FetchEngine::UpdateStatus() {
+  int queued = static_cast<int>(queued_transfers_.size());
+  int active = static_cast<int>(transfers_.size());
+  if (queued == base::subtle::NoBarrier_Load(&queued_count_) &&
+      active == base::subtle::NoBarrier_Load(&active_count_)) {
+    return;
+  }
+
+  base::subtle::NoBarrier_Store(&queued_count_, queued);
+  base::subtle::NoBarrier_Store(&active_count_, active);
+  if (!status_callback_.is_null())
+    status_callback_.Run(queued, active);
+}
+
+void FetchEngine::AddTransfer(Transfer* transfer) {
+  CURL* handle = AcquireHandle();
+  transfer->handle = handle;
+  transfer->response_checked = false;
+  transfer->attempts++;
+  curl_easy_setopt(handle, CURLOPT_URL, transfer->download->url.c_str());
+  curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, 1L);
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &FetchEngine::OnWrite);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, transfer);
+
+  // Resume from where the last attempt stopped.
+  int64 start = transfer->offset + transfer->received;
+  if (transfer->length >= 0) {
+    std::string range = base::Int64ToString(start) + "-" +
+        base::Int64ToString(transfer->offset + transfer->length - 1);
+    curl_easy_setopt(handle, CURLOPT_RANGE, range.c_str());
+  } else if (start > 0) {
+    curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+                     static_cast<curl_off_t>(start));
+  }
+
+  transfers_[handle] = transfer;
+  host_transfers_[transfer->download->job->host]++;
+  curl_multi_add_handle(multi_, handle);
+  if (!is_performing_) {
+    is_performing_ = true;
+    thread_.message_loop()->PostTask(
+        FROM_HERE,
+        base::Bind(&FetchEngine::Perform, base::Unretained(this)));
+  }
+}
+
+void FetchEngine::Perform() {
+  if (multi_ == NULL)
+    return;  // Cleaned up.
+
+  RefillBudget();
+  int running = 0;
+  curl_multi_perform(multi_, &running);
+
+  int queued = 0;
+  while (CURLMsg* message = curl_multi_info_read(multi_, &queued)) {
+    if (message->msg == CURLMSG_DONE)
+      OnTransferDone(message->easy_handle, message->data.result);
+  }
+  StartTransfers();
+
+  if (transfers_.empty()) {
+    is_performing_ = false;
+    return;
+  }
+
+  // Wait for the sockets, then yield to the tasks posted in the meantime,
+  // e.g. new fetches.
+  int fds = 0;
+  curl_multi_wait(multi_, NULL, 0, kWaitTimeoutMs, &fds);
+  thread_.message_loop()->PostTask(
+      FROM_HERE,
+      base::Bind(&FetchEngine::Perform, base::Unretained(this)));
+}
+
+void FetchEngine::OnTransferDone(CURL* handle, CURLcode code) {
+  TransferMap::iterator it = transfers_.find(handle);
+  DCHECK(it != transfers_.end());
+  Transfer* transfer = it->second;
+  transfers_.erase(it);
+  paused_transfers_.erase(transfer);
+  const std::string& host = transfer->download->job->host;
+  if (--host_transfers_[host] == 0)
+    host_transfers_.erase(host);
+  curl_multi_remove_handle(multi_, handle);
+  ReleaseHandle(handle);
+  transfer->handle = NULL;
+
+  const std::string& url = transfer->download->url;
+  if (code != CURLE_OK) {
+    LOG(WARNING) << "Fetch " << url << "@" << transfer->offset << ": "
+                 << curl_easy_strerror(code);
+    // Data which could not be written, e.g. corrupt, is not resumed from.
+    if (code == CURLE_WRITE_ERROR)
+      transfer->Restart();
+    if (!RetryTransfer(transfer))
+      FinishTransfer(transfer, false);
+    return;
+  }
+
+  bool complete =
+      (!transfer->inflater || transfer->inflater->finished()) &&
+      (transfer->length < 0 || transfer->written == transfer->length);
+  std::string digest = transfer->digester->Finish();
+  if (!complete || digest != transfer->digest) {
+    LOG(WARNING) << "Fetch " << url << "@" << transfer->offset << "|"
+                 << digest << "|" << transfer->digest;
+    transfer->Restart();
+    if (!RetryTransfer(transfer))
+      FinishTransfer(transfer, false);
+    return;
+  }
+  if (transfer->offset == 0 && transfer->length < 0)
+    transfer->download->verified = true;
+  FinishTransfer(transfer, true);
+}
+
+bool FetchEngine::RetryTransfer(Transfer* transfer) {
+  if (transfer->attempts >= kMaxAttempts) {
+    LOG(ERROR) << "Fetch " << transfer->download->url << "@"
+               << transfer->offset << " failed " << transfer->attempts
+               << " times";
+    return false;
+  }
+
+  // Nothing is left to resume, e.g. the connection broke after the last byte.
+  if (transfer->length >= 0 && transfer->received >= transfer->length)
+    transfer->Restart();
+
+  retrying_transfers_.insert(transfer);
+  thread_.message_loop()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&FetchEngine::ResumeTransfer,
+                 base::Unretained(this),
+                 transfer),
+      base::TimeDelta::FromMilliseconds(
+          kInitialRetryDelayMs << (transfer->attempts - 1)));
+  return true;
+}
+
+void FetchEngine::ResumeTransfer(Transfer* transfer) {
+  // Dropped by CleanUp() in the meantime.
+  if (retrying_transfers_.erase(transfer) == 0)
+    return;
+  QueueTransfer(transfer);
+}
+
+bool FetchEngine::ConsumeBudget(Transfer* transfer, int64 bytes) {
+  if (max_bytes_per_second_ <= 0)
+    return true;
+
+  // The last write may overdraw the budget, the next refill makes up for it.
+  if (budget_ <= 0) {
+    paused_transfers_.insert(transfer);
+    return false;
+  }
+  budget_ -= bytes;
+  return true;
+}
+
+void FetchEngine::RefillBudget() {
+  if (max_bytes_per_second_ <= 0)
+    return;
+
+  base::TimeTicks now = base::TimeTicks::Now();
+  int64 elapsed_ms = std::min((now - last_refill_time_).InMilliseconds(),
+                              kMaxBudgetMs);
+  if (elapsed_ms <= 0)
+    return;
+  last_refill_time_ = now;
+  int64 max_budget =
+      max_bytes_per_second_ * kMaxBudgetMs / base::Time::kMillisecondsPerSecond;
+  budget_ = std::min(budget_ + max_bytes_per_second_ * elapsed_ms /
+                                   base::Time::kMillisecondsPerSecond,
+                     max_budget);
+
+  // Resuming a transfer may deliver its data at once, which may pause it
+  // again.
+  while (budget_ > 0 && !paused_transfers_.empty()) {
+    Transfer* transfer = *paused_transfers_.begin();
+    paused_transfers_.erase(paused_transfers_.begin());
+    curl_easy_pause(transfer->handle, CURLPAUSE_CONT);
+  }
+}
+
+void FetchEngine::FinishTransfer(Transfer* transfer, bool success) {
+  Download* download = transfer->download;
+  delete transfer;
+  download->success = download->success && success;
+  if (--download->pending > 0)
+    return;
+  FinishDownload(download);
+}
+
+void FetchEngine::FinishDownload(Download* download) {
+  bool success = download->success;
+  if (success && !download->file.IsValid()) {
+    // Empty files have no writes.
+    download->file.Initialize(
+        download->temp_path,
+        base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+    success = download->file.IsValid();
+  }
+  download->file.Close();
+
+  // A file fetched in ranges is not hashed as a whole, each range has matched
+  // the digest of its chunk on the host.
+  if (success)
+    success = base::ReplaceFile(download->temp_path, download->path, NULL);
+  if (success) {
+    // The digest of the content is known, don't read the file again. The
+    // digest of a file fetched in ranges is left to be computed when needed,
+    // since only its chunks have been checked.
+    if (download->verified) {
+      DigestCache::GetInstance()->Record(download->path, type_,
+                                         download->digest);
+    }
+  } else {
+    base::DeleteFile(download->temp_path, false);
+  }
+
+  Job* job = download->job;
+  delete download;
+  job->success = job->success && success;
+  if (--job->pending > 0)
+    return;
+
+  NinjaThread::PostTask(NinjaThread::MAIN,
+                        FROM_HERE,
+                        base::Bind(job->callback,
+                                   job->success,
+                                   job->bytes,
+                                   base::TimeTicks::Now() - job->start_time));
+  delete job;
+}
+
+void FetchEngine::CleanUp() {
+  // The callbacks of unfinished jobs are dropped.
+  std::set<Transfer*> transfers;
+  transfers.swap(retrying_transfers_);
+  transfers.insert(queued_transfers_.begin(), queued_transfers_.end());
+  queued_transfers_.clear();
+  paused_transfers_.clear();
+  host_transfers_.clear();
+  for (TransferMap::iterator it = transfers_.begin();
+       it != transfers_.end();
+       ++it) {
+    curl_multi_remove_handle(multi_, it->first);
+    curl_easy_cleanup(it->first);
+    transfers.insert(it->second);
+  }
+  transfers_.clear();
+
+  std::set<Download*> downloads;
+  std::set<Job*> jobs;
+  for (std::set<Transfer*>::iterator it = transfers.begin();
+       it != transfers.end();
+       ++it) {
+    downloads.insert((*it)->download);
+    jobs.insert((*it)->download->job);
+  }
+  for (std::set<Download*>::iterator it = downloads.begin();
+       it != downloads.end();
+       ++it) {
+    (*it)->file.Close();
+    base::DeleteFile((*it)->temp_path, false);
+  }
+  STLDeleteElements(&transfers);
+  STLDeleteElements(&downloads);
+  STLDeleteElements(&jobs);
+
+  for (size_t i = 0; i < idle_handles_.size(); ++i)
+    curl_easy_cleanup(idle_handles_[i]);
+  idle_handles_.clear();
+  curl_multi_cleanup(multi_);
+  multi_ = NULL;
+}
+
+CURL* FetchEngine::AcquireHandle() {
+  if (idle_handles_.empty())
+    return curl_easy_init();
+
+  CURL* handle = idle_handles_.back();
+  idle_handles_.pop_back();
+  return handle;
+}
+
+void FetchEngine::ReleaseHandle(CURL* handle) {
+  curl_easy_reset(handle);
+  idle_handles_.push_back(handle);
+}
+
+}  // namespace common
@@ -0,0 +1,201 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  COMMON_FETCH_ENGINE_H_
+#define  COMMON_FETCH_ENGINE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/callback.h"
+#include "base/threading/thread.h"
+#include "base/time/time.h"
+#include "common/digest.h"
+#include "curl/curl.h"
+
+namespace common {
+
+// FetchEngine downloads files over HTTP on its own thread, with a curl multi
+// handle. Connections are kept alive and reused across fetches, and many
+// transfers run at once: up to |max_transfers| in total, and up to
+// |max_transfers_per_host| to each host. The others wait in a queue, by
+// descending priority of their fetch, then in the order they were queued, so
+// that the outputs which unblock the most work arrive first.
+//
+// If |max_bytes_per_second| is positive, it caps the data received from all
+// the hosts together, which keeps the link usable for RPCs and interactive
+// use. Transfers over the budget are paused, the ones of the highest
+// priority are resumed first.
+//
+// A file is written to a temporary file next to it, which is preallocated
+// once the size of the file is known. It is renamed over the file only if its
+// digest matches, so a file is never seen half written.
+//
+// A file whose local digest matches already, e.g. an object file rebuilt
+// after a header was touched, is not downloaded. Its modification time is set
+// to now instead, as if it had been written, so that ninja doesn't see it as
+// older than its inputs, unless the file has |preserve_mtime|.
+//
+// A file may be fetched compressed, from its copy at GetCompressedPath() on
+// the host. It is inflated while it is written.
+//
+// A failed transfer is retried a few times with backoff. It resumes with an
+// HTTP range from the last byte received. A large file with the digests of
+// its chunks of |range_size| is fetched in ranges of one chunk each, in
+// parallel, and each range is checked against its chunk digest as it
+// completes. A range which doesn't match is fetched again on its own.
+class FetchEngine {
+ public:
+  struct File {
+    File(const std::string& path, const std::string& digest, bool compressed);
+    ~File();
+
+    // The path of the file, both on the host and locally.
+    std::string path;
+    std::string digest;  // Expected.
+    bool compressed;
+
+    // Whether an unchanged local file keeps its modification time, e.g. an
+    // output of a restat edge, so that ninja sees it did not change.
+    bool preserve_mtime;
+
+    // The size of the file, -1 if unknown, and the digests of its chunks of
+    // range_size(), if any.
+    int64 size;
+    std::vector<std::string> chunk_digests;
+  };
+  typedef std::vector<File> FileVector;
+
+  // Runs on the MAIN thread. |success| is true if all the files were fetched
+  // and matched their digests. |bytes| were received from the host in
+  // |elapsed|, they measure the throughput of the link.
+  typedef base::Callback<void(bool success,
+                              int64 bytes,
+                              base::TimeDelta elapsed)> FetchCallback;
+
+  // Runs on the thread of the engine when the number of queued or active
+  // transfers changes.
+  typedef base::Callback<void(int queued, int active)> StatusCallback;
+
+  FetchEngine(int max_transfers,
+              int max_transfers_per_host,
+              DigestType type,
+              int64 range_size,
+              int64 max_bytes_per_second);
+  ~FetchEngine();
+
+  // |status_callback| may be null. It must outlive the engine.
+  bool Start(const StatusCallback& status_callback);
+
+  // Fetches |files| from |host|, e.g. "10.0.0.2:18080". Fetches of a higher
+  // |priority| go first.
+  void Fetch(const std::string& host,
+             const FileVector& files,
+             int64 priority,
+             const FetchCallback& callback);
+
+  int64 range_size() const { return range_size_; }
+
+  // The number of transfers waiting for a slot, and running. They may be
+  // called on any thread.
+  int queued_transfers() const;
+  int active_transfers() const;
+
+ private:
+  struct Job;
+  struct Download;
+  struct Transfer;
+
+  // Orders transfers by descending priority, then by age.
+  struct TransferOrder {
+    bool operator()(const Transfer* a, const Transfer* b) const;
+  };
+  typedef std::set<Transfer*, TransferOrder> TransferQueue;
+
+  static size_t OnWrite(void* ptr,
+                        size_t size,
+                        size_t count,
+                        Transfer* transfer);
+
+  // Drops the files of |files| which are up to date, then starts the job on
+  // |thread_|.
+  void SkipUnchangedFilesOnBlockingPool(Job* job, const FileVector& files);
+
+  // The methods below run on |thread_|.
+  void StartJob(Job* job, const FileVector& files);
+
+  // Queues |transfer|, then starts the queued transfers there are slots for.
+  void QueueTransfer(Transfer* transfer);
+  void StartTransfers();
+
+  // Publishes the number of queued and active transfers.
+  void UpdateStatus();
+
+  // Hands |transfer| to curl, from where the last attempt stopped.
+  void AddTransfer(Transfer* transfer);
+  void Perform();
+
+  // Takes |bytes| from the budget, returns false if |transfer| has to be
+  // paused. Paused transfers are resumed by RefillBudget().
+  bool ConsumeBudget(Transfer* transfer, int64 bytes);
+  void RefillBudget();
+
+  void OnTransferDone(CURL* handle, CURLcode code);
+
+  // Tries |transfer| again after a backoff, returns false if it has been
+  // tried too many times.
+  bool RetryTransfer(Transfer* transfer);
+  void ResumeTransfer(Transfer* transfer);
+  void FinishTransfer(Transfer* transfer, bool success);
+  void FinishDownload(Download* download);
+  void CleanUp();
+
+  // Easy handles are reused, they keep the DNS cache and TLS sessions.
+  CURL* AcquireHandle();
+  void ReleaseHandle(CURL* handle);
+
+  int max_transfers_;
+  int max_transfers_per_host_;
+  DigestType type_;
+  int64 range_size_;
+  int64 max_bytes_per_second_;
+
+  base::Thread thread_;
+
+  base::subtle::Atomic32 queued_count_;
+  base::subtle::Atomic32 active_count_;
+  StatusCallback status_callback_;
+
+  // Accessed on |thread_| only.
+  CURLM* multi_;
+  typedef std::map<CURL*, Transfer*> TransferMap;
+  TransferMap transfers_;
+
+  // Transfers which wait for a slot, and the active transfers of each host.
+  TransferQueue queued_transfers_;
+  std::map<std::string, int> host_transfers_;
+  int64 next_sequence_;
+
+  // Transfers which wait to be retried.
+  std::set<Transfer*> retrying_transfers_;
+
+  // The bytes which may be received before the next refill, negative if
+  // overdrawn, and the transfers paused until there is budget again.
+  int64 budget_;
+  base::TimeTicks last_refill_time_;
+  TransferQueue paused_transfers_;
+
+  std::vector<CURL*> idle_handles_;
+  bool is_performing_;
+
+  DISALLOW_COPY_AND_ASSIGN(FetchEngine);
+};
+
+}  // namespace common
+
+#endif  // COMMON_FETCH_ENGINE_H_
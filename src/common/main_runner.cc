@@ -7,8 +7,10 @@
 #include <string>
 
 #include "base/command_line.h"
+#include "base/files/file_path.h"
 #include "base/run_loop.h"
 #include "base/strings/string_number_conversions.h"
+#include "common/digest_cache.h"
 #include "common/options.h"
 #include "master/master_main_runner.h"
 #include "ninja/dn_builder.h"
@@ -19,6 +21,9 @@
 namespace {
 const int kMinPort = 1024;
 const int kMaxPort = 65535;
+
+// The log of common::DigestCache, in the build directory.
+const char kDigestLogFileName[] = ".dn_digests";
 }  // namespace
 
 namespace common {
@@ -33,7 +38,17 @@ bool MainRunner::InitFromManifest(const std::string& input_file,
                                   std::string* error) {
   BuildConfig config;
   ninja_main_.reset(new ninja::NinjaMain(config));
-  return ninja_main_->InitFromManifest(input_file, error, true);
+  if (!ninja_main_->InitFromManifest(input_file, error, true))
+    return false;
+
+  // Threads are not created yet.
+  base::FilePath build_dir = base::FilePath::FromUTF8Unsafe(
+      ninja_main_->build_dir().empty() ? "." : ninja_main_->build_dir());
+  if (!DigestCache::GetInstance()->Init(
+          build_dir.AppendASCII(kDigestLogFileName))) {
+    LOG(WARNING) << "Digests of files are not cached.";
+  }
+  return true;
 }
 
 void MainRunner::CreateThreads() {
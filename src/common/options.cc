@@ -18,6 +18,21 @@ const char kPort[] = "port";
 const char kMaster[] = "master";
 const char kTargets[] = "targets";
 const char kMaxSlaveAmount[] = "max_slave_amount";
+const char kDisableCriticalPath[] = "disable_critical_path";
+const char kPrefetchDepth[] = "prefetch_depth";
+const char kShipInputs[] = "ship_inputs";
+const char kActionCacheDir[] = "action_cache_dir";
+const char kActionCacheSize[] = "action_cache_size";
+const char kDigest[] = "digest";
+const char kFetchConcurrency[] = "fetch_concurrency";
+const char kFetchConcurrencyPerSlave[] = "fetch_concurrency_per_slave";
+const char kCompressOutputs[] = "compress_outputs";
+const char kFetchBandwidth[] = "fetch_bandwidth";
+const char kLazyOutputs[] = "lazy_outputs";
+const char kMaterializeOutputs[] = "materialize_outputs";
+const char kDisablePeerTransfer[] = "disable_peer_transfer";
+const char kDisablePartitioning[] = "disable_partitioning";
+const char kDisablePlacement[] = "disable_placement";
 
 }  // namespace switches
 
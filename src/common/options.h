@@ -18,6 +18,21 @@ extern const char kBindIP[];
 extern const char kPort[];
 extern const char kTargets[];
 extern const char kMaxSlaveAmount[];
+extern const char kDisableCriticalPath[];
+extern const char kPrefetchDepth[];
+extern const char kShipInputs[];
+extern const char kActionCacheDir[];
+extern const char kActionCacheSize[];
+extern const char kDigest[];
+extern const char kFetchConcurrency[];
+extern const char kFetchConcurrencyPerSlave[];
+extern const char kCompressOutputs[];
+extern const char kFetchBandwidth[];
+extern const char kLazyOutputs[];
+extern const char kMaterializeOutputs[];
+extern const char kDisablePeerTransfer[];
+extern const char kDisablePartitioning[];
+extern const char kDisablePlacement[];
 
 extern const char kMaster[];
 
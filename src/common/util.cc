@@ -6,17 +6,12 @@
 
 #include <fcntl.h>
 
-#include "base/files/file.h"
 #include "base/hash.h"
-#include "base/md5.h"
 #include "base/strings/string_util.h"
 #include "base/sys_info.h"
+#include "common/digest_cache.h"
 #include "third_party/ninja/src/graph.h"
 
-namespace {
-const int kMd5DigestBufferSize = 512 * 1024;  // 512 kB.
-}  // namespace
-
 namespace common {
 
 int GuessParallelism() {
@@ -31,35 +26,16 @@ int GuessParallelism() {
   }
 }
 
-std::string GetMd5Digest(const base::FilePath& file_path) {
-  base::File file(file_path, base::File::FLAG_OPEN | base::File::FLAG_READ);
-  if (!file.IsValid())
-    return std::string();
-
-  base::MD5Context context;
-  base::MD5Init(&context);
-
-  int64 offset = 0;
-  scoped_ptr<char[]> buffer(new char[kMd5DigestBufferSize]);
-  while (true) {
-    int result = file.Read(offset, buffer.get(), kMd5DigestBufferSize);
-    if (result < 0) {
-      // Found an error.
-      return std::string();
-    }
-
-    if (result == 0) {
-      // End of file.
-      break;
-    }
+std::string GetFileDigest(const base::FilePath& file_path, DigestType type) {
+  return DigestCache::GetInstance()->GetDigest(file_path, type);
+}
 
-    offset += result;
-    base::MD5Update(&context, base::StringPiece(buffer.get(), result));
-  }
+std::string GetMd5Digest(const base::FilePath& file_path) {
+  return GetFileDigest(file_path, DIGEST_MD5);
+}
 
-  base::MD5Digest digest;
-  base::MD5Final(&digest, &context);
-  return MD5DigestToBase16(digest);
+std::string ComputeMd5Digest(const base::FilePath& file_path) {
+  return ComputeFileDigest(file_path, DIGEST_MD5);
 }
 
 uint32 HashEdge(const Edge* edge) {
@@ -8,6 +8,7 @@
 #include <string>
 
 #include "base/basictypes.h"
+#include "common/digest.h"
 
 namespace base {
 class FilePath;
@@ -20,8 +21,15 @@ namespace common {
 /// Choose a default value how many jobs can run in parallel.
 int GuessParallelism();
 
+// Returns the digest of |file_path| in hex, or an empty string if it can not
+// be read. Files whose stat identity is unchanged are not read again once the
+// DigestCache of the process is initialized.
+std::string GetFileDigest(const base::FilePath& file_path, DigestType type);
 std::string GetMd5Digest(const base::FilePath& file_path);
 
+// Always reads |file_path|, see GetMd5Digest().
+std::string ComputeMd5Digest(const base::FilePath& file_path);
+
 uint32 HashEdge(const Edge* edge);
 
 int SetNonBlocking(int fd);
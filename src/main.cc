@@ -65,6 +65,98 @@ void ReadSwitchesFromConfig() {
     command_line->AppendSwitchASCII(switches::kMaxSlaveAmount,
                                     base::IntToString(max_slave_amount));
   }
+
+  bool disable_critical_path;
+  if (values->GetBoolean(switches::kDisableCriticalPath,
+                         &disable_critical_path) &&
+      disable_critical_path) {
+    command_line->AppendSwitch(switches::kDisableCriticalPath);
+  }
+
+  int prefetch_depth;
+  if (values->GetInteger(switches::kPrefetchDepth, &prefetch_depth)) {
+    command_line->AppendSwitchASCII(switches::kPrefetchDepth,
+                                    base::IntToString(prefetch_depth));
+  }
+
+  bool ship_inputs;
+  if (values->GetBoolean(switches::kShipInputs, &ship_inputs) && ship_inputs)
+    command_line->AppendSwitch(switches::kShipInputs);
+
+  std::string action_cache_dir;
+  if (values->GetString(switches::kActionCacheDir, &action_cache_dir)) {
+    command_line->AppendSwitchASCII(switches::kActionCacheDir,
+                                    action_cache_dir);
+  }
+
+  int action_cache_size;
+  if (values->GetInteger(switches::kActionCacheSize, &action_cache_size)) {
+    command_line->AppendSwitchASCII(switches::kActionCacheSize,
+                                    base::IntToString(action_cache_size));
+  }
+
+  std::string digest;
+  if (values->GetString(switches::kDigest, &digest))
+    command_line->AppendSwitchASCII(switches::kDigest, digest);
+
+  int fetch_concurrency;
+  if (values->GetInteger(switches::kFetchConcurrency, &fetch_concurrency)) {
+    command_line->AppendSwitchASCII(switches::kFetchConcurrency,
+                                    base::IntToString(fetch_concurrency));
+  }
+
+  int fetch_concurrency_per_slave;
+  if (values->GetInteger(switches::kFetchConcurrencyPerSlave,
+                         &fetch_concurrency_per_slave)) {
+    command_line->AppendSwitchASCII(
+        switches::kFetchConcurrencyPerSlave,
+        base::IntToString(fetch_concurrency_per_slave));
+  }
+
+  bool compress_outputs;
+  if (values->GetBoolean(switches::kCompressOutputs, &compress_outputs) &&
+      compress_outputs) {
+    command_line->AppendSwitch(switches::kCompressOutputs);
+  }
+
+  int fetch_bandwidth;
+  if (values->GetInteger(switches::kFetchBandwidth, &fetch_bandwidth)) {
+    command_line->AppendSwitchASCII(switches::kFetchBandwidth,
+                                    base::IntToString(fetch_bandwidth));
+  }
+
+  bool lazy_outputs;
+  if (values->GetBoolean(switches::kLazyOutputs, &lazy_outputs) &&
+      lazy_outputs) {
+    command_line->AppendSwitch(switches::kLazyOutputs);
+  }
+
+  bool materialize_outputs;
+  if (values->GetBoolean(switches::kMaterializeOutputs,
+                         &materialize_outputs) &&
+      materialize_outputs) {
+    command_line->AppendSwitch(switches::kMaterializeOutputs);
+  }
+
+  bool disable_peer_transfer;
+  if (values->GetBoolean(switches::kDisablePeerTransfer,
+                         &disable_peer_transfer) &&
+      disable_peer_transfer) {
+    command_line->AppendSwitch(switches::kDisablePeerTransfer);
+  }
+
+  bool disable_partitioning;
+  if (values->GetBoolean(switches::kDisablePartitioning,
+                         &disable_partitioning) &&
+      disable_partitioning) {
+    command_line->AppendSwitch(switches::kDisablePartitioning);
+  }
+
+  bool disable_placement;
+  if (values->GetBoolean(switches::kDisablePlacement, &disable_placement) &&
+      disable_placement) {
+    command_line->AppendSwitch(switches::kDisablePlacement);
+  }
 }
 
 int main(int argc, char* argv[]) {
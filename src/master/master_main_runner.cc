@@ -5,20 +5,23 @@
 #include "master/master_main_runner.h"
 
 #include <algorithm>
+#include <set>
 
 #include "base/bind.h"
 #include "base/command_line.h"
 #include "base/files/file_util.h"
 #include "base/hash.h"
 #include "base/json/json_writer.h"
+#include "base/stl_util.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/string_split.h"
 #include "base/sys_info.h"
 #include "base/threading/thread_restrictions.h"
 #include "base/values.h"
+#include "common/compression.h"
+#include "common/fetch_engine.h"
 #include "common/options.h"
 #include "common/util.h"
-#include "master/curl_helper.h"
 #include "master/master_rpc.h"
 #include "master/webui_thread.h"
 #include "ninja/dn_builder.h"
@@ -27,15 +30,89 @@
 
 namespace {
 
-const char kHttp[] = "http://";
+const int kDefaultFetchConcurrency = 64;
+const int kDefaultFetchConcurrencyPerSlave = 8;
+
+// Outputs larger than this are fetched in ranges of this size, in parallel.
+const int64 kFetchRangeSize = 32 * 1024 * 1024;
+
+// Compression of outputs by the throughput of the link to the slave. Level 1
+// deflates at about 50 MB/s per core, beyond which it no longer pays off.
+const double kSlowLinkBytesPerSecond = 10 * 1024 * 1024;
+const double kFastLinkBytesPerSecond = 50 * 1024 * 1024;
+const int kFastCompressionLevel = 1;
+const int kStrongCompressionLevel = 6;
+
+// Fetches smaller than this are dominated by latency, they don't measure the
+// throughput of the link.
+const int64 kMinBytesToMeasureThroughput = 256 * 1024;
+
+// The weight of the latest fetch in the smoothed throughput.
+const double kThroughputSmoothingFactor = 0.25;
+
+// Outputs left on the slaves are fetched before anything else once an edge
+// waits for them, and after everything else when the build ends.
+const int64 kWaitedForOutputPriority = kint64max;
+const int64 kFinalOutputPriority = 0;
+
+// Collects the inputs of |edge| which are built by other edges, looking
+// through phony edges, e.g. an order-only dependency on a group of generated
+// headers.
+void CollectGeneratedInputs(Edge* edge,
+                            std::set<Edge*>* seen,
+                            std::set<Node*>* inputs) {
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end();
+       ++i) {
+    Edge* in_edge = (*i)->in_edge();
+    if (in_edge == NULL)
+      continue;
+
+    if (!in_edge->is_phony())
+      inputs->insert(*i);
+    else if (seen->insert(in_edge).second)
+      CollectGeneratedInputs(in_edge, seen, inputs);
+  }
+}
+
+// Collects |node| and, if it is built by a phony edge, the nodes it stands
+// for.
+void CollectFinalTargets(Node* node, std::set<Node*>* targets) {
+  if (!targets->insert(node).second)
+    return;
+
+  Edge* in_edge = node->in_edge();
+  if (in_edge == NULL || !in_edge->is_phony())
+    return;
+  for (vector<Node*>::iterator i = in_edge->inputs_.begin();
+       i != in_edge->inputs_.end();
+       ++i) {
+    CollectFinalTargets(*i, targets);
+  }
+}
 
 }  // namespace
 
 namespace master {
 
+MasterMainRunner::RemoteOutput::RemoteOutput(
+    int connection_id,
+    const std::string& host,
+    const common::FetchEngine::File& file)
+    : connection_id(connection_id), host(host), file(file) {
+}
+
 MasterMainRunner::MasterMainRunner(const std::string& bind_ip, uint16 port)
     : bind_ip_(bind_ip),
       port_(port),
+      is_start_scheduled_(false),
+      ship_inputs_(false),
+      digest_type_(common::DIGEST_MD5),
+      compress_outputs_(false),
+      peer_transfer_(true),
+      lazy_outputs_(false),
+      materialize_outputs_(false),
+      steal_connection_id_(-1),
       max_slave_amount_(UINT_MAX),
       is_building_(false) {
   // |curl_global_init| is not thread-safe, following advice in docs of
@@ -44,7 +121,17 @@ MasterMainRunner::MasterMainRunner(const std::string& bind_ip, uint16 port)
 }
 
 MasterMainRunner::~MasterMainRunner() {
+  fetch_engine_.reset();
   curl_global_cleanup();
+
+  // The callbacks of unfinished fetches are dropped with the engine.
+  std::set<Materialization*> materializations;
+  for (MaterializationMap::iterator it = materializations_.begin();
+       it != materializations_.end();
+       ++it) {
+    materializations.insert(it->second.begin(), it->second.end());
+  }
+  STLDeleteElements(&materializations);
 }
 
 bool MasterMainRunner::PostCreateThreads() {
@@ -58,6 +145,54 @@ bool MasterMainRunner::PostCreateThreads() {
         command_line->GetSwitchValueASCII(switches::kMaxSlaveAmount);
     base::StringToUint(amount, &max_slave_amount_);
   }
+  ship_inputs_ = command_line->HasSwitch(switches::kShipInputs);
+  if (command_line->HasSwitch(switches::kDigest)) {
+    std::string digest = command_line->GetSwitchValueASCII(switches::kDigest);
+    if (!common::ParseDigestType(digest, &digest_type_)) {
+      LOG(ERROR) << "Unknown digest " << digest;
+      return false;
+    }
+  }
+
+  compress_outputs_ = command_line->HasSwitch(switches::kCompressOutputs) &&
+                      common::CompressionSupported();
+  lazy_outputs_ = command_line->HasSwitch(switches::kLazyOutputs);
+  peer_transfer_ = !command_line->HasSwitch(switches::kDisablePeerTransfer);
+  materialize_outputs_ = command_line->HasSwitch(switches::kMaterializeOutputs);
+
+  int fetch_concurrency = kDefaultFetchConcurrency;
+  if (command_line->HasSwitch(switches::kFetchConcurrency)) {
+    base::StringToInt(
+        command_line->GetSwitchValueASCII(switches::kFetchConcurrency),
+        &fetch_concurrency);
+  }
+  int fetch_concurrency_per_slave = kDefaultFetchConcurrencyPerSlave;
+  if (command_line->HasSwitch(switches::kFetchConcurrencyPerSlave)) {
+    base::StringToInt(
+        command_line->GetSwitchValueASCII(
+            switches::kFetchConcurrencyPerSlave),
+        &fetch_concurrency_per_slave);
+  }
+  // In kilobytes per second, zero for no limit.
+  int fetch_bandwidth = 0;
+  if (command_line->HasSwitch(switches::kFetchBandwidth)) {
+    base::StringToInt(
+        command_line->GetSwitchValueASCII(switches::kFetchBandwidth),
+        &fetch_bandwidth);
+  }
+  fetch_engine_.reset(new common::FetchEngine(
+      std::max(fetch_concurrency, 1),
+      std::max(fetch_concurrency_per_slave, 1),
+      digest_type_,
+      kFetchRangeSize,
+      std::max(fetch_bandwidth, 0) * static_cast<int64>(1024)));
+  // The engine is gone before |this|.
+  if (!fetch_engine_->Start(
+          base::Bind(&MasterMainRunner::UpdateWebUIFetchStatus,
+                     base::Unretained(this)))) {
+    LOG(ERROR) << "Failed to start fetch engine.";
+    return false;
+  }
 
   return true;
 }
@@ -94,36 +229,382 @@ void MasterMainRunner::StartBuild() {
     CHECK(error.empty()) << error;
   }
 
+  for (size_t i = 0; i < targets.size(); ++i)
+    CollectFinalTargets(targets[i], &final_targets_);
   ninja_main()->RunBuild(targets, this);
 }
 
-bool MasterMainRunner::StartEdgeRemotelly(Edge* edge, int connection_id) {
+bool MasterMainRunner::StartEdgeRemotelly(Edge* edge,
+                                          int connection_id,
+                                          uint32 attempt) {
   if (slave_info_id_map_.find(connection_id) == slave_info_id_map_.end())
     return false;
 
-  MasterRPC::OutputPaths output_paths;
+  uint32 edge_id = common::HashEdge(edge);
+  outstanding_edges_[edge_id] = edge;
+  attempts_[std::make_pair(connection_id, edge_id)] = attempt;
+  slave_info_id_map_[connection_id].amount_of_outstanding_edges++;
+  queued_edges_[connection_id].push_back(edge);
+  if (!is_start_scheduled_) {
+    is_start_scheduled_ = true;
+    NinjaThread::PostTask(
+        NinjaThread::MAIN,
+        FROM_HERE,
+        base::Bind(&MasterMainRunner::StartQueuedEdgesRemotely, this));
+  }
+  return true;
+}
+
+void MasterMainRunner::StartQueuedEdgesRemotely() {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  is_start_scheduled_ = false;
+  for (QueuedEdgeMap::iterator it = queued_edges_.begin();
+       it != queued_edges_.end();
+       ++it) {
+    if (it->second.empty() ||
+        slave_info_id_map_.find(it->first) == slave_info_id_map_.end()) {
+      continue;
+    }
+
+    MasterRPC::CommandVector commands(it->second.size());
+    bool has_unknown_digests = false;
+    std::vector<std::string> lazy_inputs;
+    int compression_level =
+        SelectCompressionLevel(slave_info_id_map_[it->first]);
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      Edge* edge = it->second[i];
+      for (vector<Node*>::iterator o = edge->outputs_.begin();
+           o != edge->outputs_.end();
+           ++o) {
+        commands[i].output_paths.push_back((*o)->path());
+      }
+      commands[i].edge_id = common::HashEdge(edge);
+      commands[i].attempt_id =
+          attempts_[std::make_pair(it->first, commands[i].edge_id)];
+      commands[i].rspfile_name = edge->GetUnescapedRspfile();
+      commands[i].rspfile_content = edge->GetBinding("rspfile_content");
+      commands[i].ship_inputs = ship_inputs_;
+      commands[i].digest_type = digest_type_;
+      commands[i].compression_level = compression_level;
+      commands[i].range_size = fetch_engine_->range_size();
+      if (!ship_inputs_)
+        continue;
+
+      std::set<Edge*> seen;
+      std::set<Node*> inputs;
+      CollectGeneratedInputs(edge, &seen, &inputs);
+      for (std::set<Node*>::iterator input = inputs.begin();
+           input != inputs.end();
+           ++input) {
+        // An empty digest is filled in on the blocking pool.
+        DigestMap::iterator digest = input_digests_.find((*input)->path());
+        std::string digest_value;
+        if (digest != input_digests_.end())
+          digest_value = digest->second;
+        else
+          has_unknown_digests = true;
+        commands[i].inputs.push_back(
+            std::make_pair((*input)->path(), digest_value));
+
+        // The slave which built an input has it already. Another slave
+        // fetches it from there, if it is still around.
+        OutputSlaveMap::iterator peer = output_slaves_.find((*input)->path());
+        if (peer != output_slaves_.end() && peer->second == it->first)
+          continue;
+        SlaveInfoIdMap::iterator peer_info =
+            peer != output_slaves_.end() ?
+                slave_info_id_map_.find(peer->second) :
+                slave_info_id_map_.end();
+        if (peer_transfer_ && peer_info != slave_info_id_map_.end()) {
+          commands[i].input_hosts[(*input)->path()] =
+              peer_info->second.ip + ":" + options::kMongooseServerPort;
+          continue;
+        }
+
+        // Otherwise an input left on a slave goes through the master.
+        if (remote_outputs_.find((*input)->path()) != remote_outputs_.end())
+          lazy_inputs.push_back((*input)->path());
+      }
+    }
+
+    // The slave fetches its inputs from here. If the fetch fails, so does
+    // the edge on the slave.
+    MaterializeCallback send_commands =
+        base::Bind(&MasterMainRunner::SendCommandsRemotely,
+                   this,
+                   it->first,
+                   commands,
+                   has_unknown_digests);
+    if (!MaterializeOutputs(lazy_inputs, kWaitedForOutputPriority,
+                            send_commands)) {
+      send_commands.Run(true);
+    }
+  }
+  queued_edges_.clear();
+}
+
+void MasterMainRunner::SendCommandsRemotely(
+    int connection_id,
+    const MasterRPC::CommandVector& commands,
+    bool has_unknown_digests,
+    bool success) {
+  if (has_unknown_digests) {
+    NinjaThread::PostBlockingPoolTask(
+        FROM_HERE,
+        base::Bind(&MasterMainRunner::DigestInputsOnBlockingPool,
+                   this,
+                   connection_id,
+                   commands));
+    return;
+  }
+
+  NinjaThread::PostTask(
+      NinjaThread::RPC,
+      FROM_HERE,
+      base::Bind(&MasterRPC::StartCommandsRemotely,
+                 base::Unretained(master_rpc_.get()),
+                 connection_id,
+                 commands));
+}
+
+bool MasterMainRunner::CanFetchLazily(Edge* edge,
+                                      const RemoteResult& result) const {
+  if (!lazy_outputs_ || edge->GetBindingBool("restat"))
+    return false;
+  if (edge->GetBinding("deps") == "gcc" && result.depfile.empty())
+    return false;
+
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end();
        ++o) {
-    output_paths.push_back((*o)->path());
+    if ((*o)->out_edges().empty() ||
+        final_targets_.find(*o) != final_targets_.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MasterMainRunner::MaterializeInputs(Edge* edge,
+                                         const MaterializeCallback& callback) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  if (remote_outputs_.empty())
+    return false;
+
+  std::set<Edge*> seen;
+  std::set<Node*> inputs;
+  CollectGeneratedInputs(edge, &seen, &inputs);
+  std::vector<std::string> paths;
+  for (std::set<Node*>::iterator i = inputs.begin(); i != inputs.end(); ++i)
+    paths.push_back((*i)->path());
+  return MaterializeOutputs(paths, kWaitedForOutputPriority, callback);
+}
+
+bool MasterMainRunner::MaterializeOutputs(
+    const std::vector<std::string>& paths,
+    int64 priority,
+    const MaterializeCallback& callback) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  Materialization* materialization = new Materialization;
+  materialization->pending = 0;
+  materialization->success = true;
+  materialization->callback = callback;
+
+  // A file is fetched once, however many edges wait for it.
+  typedef std::map<std::string, common::FetchEngine::FileVector> HostFileMap;
+  HostFileMap files;
+  typedef std::map<std::string, std::vector<std::string> > HostPathMap;
+  HostPathMap host_paths;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    RemoteOutputMap::iterator it = remote_outputs_.find(paths[i]);
+    if (it == remote_outputs_.end())
+      continue;
+
+    std::vector<Materialization*>& waiting = materializations_[paths[i]];
+    if (std::find(waiting.begin(), waiting.end(), materialization) !=
+        waiting.end()) {
+      continue;
+    }
+    if (waiting.empty()) {
+      files[it->second.host].push_back(it->second.file);
+      host_paths[it->second.host].push_back(paths[i]);
+    }
+    waiting.push_back(materialization);
+    materialization->pending++;
+  }
+
+  if (materialization->pending == 0) {
+    delete materialization;
+    return false;
   }
 
+  for (HostFileMap::iterator it = files.begin(); it != files.end(); ++it) {
+    fetch_engine_->Fetch(it->first,
+                         it->second,
+                         priority,
+                         base::Bind(&MasterMainRunner::OnOutputsMaterialized,
+                                    this,
+                                    host_paths[it->first]));
+  }
+  return true;
+}
+
+void MasterMainRunner::OnOutputsMaterialized(
+    const std::vector<std::string>& paths,
+    bool success,
+    int64 bytes,
+    base::TimeDelta elapsed) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  if (!success)
+    LOG(ERROR) << "Failed to fetch outputs left on the slaves.";
+
+  ninja::DNBuilder* builder = ninja_main()->builder();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    // A file which failed is tried again by the next edge which needs it.
+    if (success) {
+      remote_outputs_.erase(paths[i]);
+      if (builder != NULL)
+        builder->OutputMaterialized(paths[i]);
+    }
+
+    MaterializationMap::iterator it = materializations_.find(paths[i]);
+    DCHECK(it != materializations_.end());
+    std::vector<Materialization*> waiting;
+    waiting.swap(it->second);
+    materializations_.erase(it);
+    for (size_t j = 0; j < waiting.size(); ++j) {
+      Materialization* materialization = waiting[j];
+      materialization->success = materialization->success && success;
+      if (--materialization->pending > 0)
+        continue;
+      materialization->callback.Run(materialization->success);
+      delete materialization;
+    }
+  }
+}
+
+int MasterMainRunner::SelectCompressionLevel(const SlaveInfo& info) const {
+  if (!compress_outputs_)
+    return 0;
+
+  if (info.number_of_processors > 0 &&
+      info.status.load_average >= info.number_of_processors) {
+    return 0;
+  }
+
+  // The throughput is measured on the data sent, compressed or not.
+  double bytes_per_second = info.fetch_bytes_per_second;
+  if (bytes_per_second <= 0)
+    return kFastCompressionLevel;
+  if (bytes_per_second >= kFastLinkBytesPerSecond)
+    return 0;
+  if (bytes_per_second < kSlowLinkBytesPerSecond)
+    return kStrongCompressionLevel;
+  return kFastCompressionLevel;
+}
+
+void MasterMainRunner::DigestInputsOnBlockingPool(
+    int connection_id,
+    const MasterRPC::CommandVector& commands) {
+  MasterRPC::CommandVector digested_commands(commands);
+  TargetVector digests;
+  for (size_t i = 0; i < digested_commands.size(); ++i) {
+    MasterRPC::InputFiles& inputs = digested_commands[i].inputs;
+    for (size_t j = 0; j < inputs.size(); ++j) {
+      if (!inputs[j].second.empty())
+        continue;
+
+      // A missing input is left to the slave, the command fails there as it
+      // would here.
+      base::FilePath filename = base::FilePath::FromUTF8Unsafe(inputs[j].first);
+      if (!base::PathExists(filename))
+        continue;
+      inputs[j].second = common::GetFileDigest(filename, digest_type_);
+      if (inputs[j].second.empty())
+        LOG(ERROR) << "GetFileDigest of " << filename.value();
+      else
+        digests.push_back(inputs[j]);
+    }
+  }
+
+  NinjaThread::PostTask(
+      NinjaThread::RPC,
+      FROM_HERE,
+      base::Bind(&MasterRPC::StartCommandsRemotely,
+                 base::Unretained(master_rpc_.get()),
+                 connection_id,
+                 digested_commands));
+  NinjaThread::PostTask(
+      NinjaThread::MAIN,
+      FROM_HERE,
+      base::Bind(&MasterMainRunner::OnInputDigestsComputed, this, digests));
+}
+
+void MasterMainRunner::OnInputDigestsComputed(const TargetVector& digests) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  for (size_t i = 0; i < digests.size(); ++i)
+    input_digests_[digests[i].first] = digests[i].second;
+}
+
+void MasterMainRunner::CancelEdgeRemotely(Edge* edge, int connection_id) {
+  SlaveInfoIdMap::iterator slave = slave_info_id_map_.find(connection_id);
+  if (slave == slave_info_id_map_.end())
+    return;
+
   uint32 edge_id = common::HashEdge(edge);
-  outstanding_edges_[edge_id] = edge;
+  AttemptMap::iterator attempt =
+      attempts_.find(std::make_pair(connection_id, edge_id));
+  if (attempt == attempts_.end())
+    return;  // Its result is back already.
+
+  // Not sent yet, just drop it.
+  std::vector<Edge*>& queued = queued_edges_[connection_id];
+  std::vector<Edge*>::iterator it =
+      std::find(queued.begin(), queued.end(), edge);
+  if (it != queued.end()) {
+    queued.erase(it);
+    attempts_.erase(attempt);
+    slave->second.amount_of_outstanding_edges--;
+    return;
+  }
+
   NinjaThread::PostTask(
       NinjaThread::RPC,
       FROM_HERE,
-      base::Bind(&MasterRPC::StartCommandRemotely,
+      base::Bind(&MasterRPC::CancelCommandRemotely,
                  base::Unretained(master_rpc_.get()),
                  connection_id,
-                 output_paths,
-                 edge->GetUnescapedRspfile(),
-                 edge->GetBinding("rspfile_content"),
-                 edge_id));
-  return true;
+                 edge_id,
+                 attempt->second));
 }
 
 void MasterMainRunner::BuildFinished() {
+  if (materialize_outputs_) {
+    std::vector<std::string> paths;
+    for (RemoteOutputMap::iterator it = remote_outputs_.begin();
+         it != remote_outputs_.end();
+         ++it) {
+      paths.push_back(it->first);
+    }
+    if (MaterializeOutputs(
+            paths,
+            kFinalOutputPriority,
+            base::Bind(&MasterMainRunner::OnAllOutputsMaterialized, this))) {
+      return;
+    }
+  }
+  Quit();
+}
+
+void MasterMainRunner::OnAllOutputsMaterialized(bool success) {
+  if (!success) {
+    LOG(ERROR) << "Some outputs are left on the slaves, they are built again "
+                  "by the next build.";
+  }
+  Quit();
+}
+
+void MasterMainRunner::Quit() {
   NinjaThread::PostTask(
       NinjaThread::FILE,
       FROM_HERE,
@@ -135,50 +616,219 @@ void MasterMainRunner::BuildFinished() {
       base::MessageLoop::current()->QuitClosure());
 }
 
-void MasterMainRunner::OnFetchTargetsDone(CommandRunner::Result result) {
+void MasterMainRunner::StealWork() {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
-  std::string error;
-  if (!ninja_main()->builder()->HasRemoteCommandRunLocally(result.edge))
-    ninja_main()->builder()->FinishCommand(&result, &error);
+  if (steal_connection_id_ >= 0)
+    return;
+
+  // Only steal for another slave which has room, otherwise the edges would
+  // come back to the same one.
+  int max_commands;
+  int connection_id =
+      slave_selector_.SelectBacklogged(slave_info_id_map_, &max_commands);
+  if (connection_id < 0)
+    return;
+
+  steal_connection_id_ = connection_id;
+  NinjaThread::PostTask(
+      NinjaThread::RPC,
+      FROM_HERE,
+      base::Bind(&MasterRPC::StealCommandsRemotely,
+                 base::Unretained(master_rpc_.get()),
+                 connection_id,
+                 max_commands));
 }
 
-void MasterMainRunner::OnRemoteCommandDone(
+void MasterMainRunner::OnCommandsStolen(
     int connection_id,
-    uint32 edge_id,
-    ExitStatus status,
-    const std::string& output,
-    const std::vector<std::string>& md5s) {
-  ninja_main()->builder()->RequestEdge(connection_id);
+    const std::vector<uint32>& edge_ids,
+    const std::vector<uint32>& attempt_ids) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  if (steal_connection_id_ == connection_id)
+    steal_connection_id_ = -1;
+
+  // The outstanding edge count of the slave drops when the interrupted
+  // results of the stolen edges arrive.
+  ninja::DNBuilder* builder = ninja_main()->builder();
+  for (size_t i = 0; i < edge_ids.size(); ++i) {
+    OutstandingEdgeMap::iterator it = outstanding_edges_.find(edge_ids[i]);
+    DCHECK(it != outstanding_edges_.end());
+    builder->RemoteEdgeStolen(
+        it->second, connection_id, i < attempt_ids.size() ? attempt_ids[i] : 0);
+  }
+  builder->ScheduleRemoteWork();
+}
+
+void MasterMainRunner::OnRemoteCommandsStarted(
+    int connection_id,
+    const RemoteStartVector& starts) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  if (!is_building_ || ninja_main()->builder() == NULL)
+    return;
+
+  // The result of a command may have arrived before its start is reported.
+  for (size_t i = 0; i < starts.size(); ++i) {
+    OutstandingEdgeMap::iterator it =
+        outstanding_edges_.find(starts[i].edge_id);
+    if (it == outstanding_edges_.end())
+      continue;
+    ninja_main()->builder()->RemoteEdgeRunning(
+        it->second, connection_id, starts[i].attempt_id, starts[i].wait_time);
+  }
+}
+
+void MasterMainRunner::OnFetchTargetsDone(int connection_id,
+                                          const TargetVector& targets,
+                                          CommandRunner::Result result) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  ninja_main()->builder()->RemoteEdgeFinished(&result, connection_id);
+
+  // The digests are verified by the fetch, so slaves can get them for free.
+  // Edges started by RemoteEdgeFinished() are sent in a later task, they see
+  // these digests and where the files are too.
+  if (ship_inputs_) {
+    for (size_t i = 0; i < targets.size(); ++i) {
+      input_digests_[targets[i].first] = targets[i].second;
+      output_slaves_[targets[i].first] = connection_id;
+    }
+  }
+}
+
+void MasterMainRunner::OnFetchTargetsFailed(int connection_id,
+                                            uint32 attempt,
+                                            Edge* edge) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  ninja_main()->builder()->RemoteEdgeFailed(edge, connection_id, attempt);
+}
+
+void MasterMainRunner::OnRemoteCommandsDone(
+    int connection_id,
+    const RemoteResultVector& results) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  for (size_t i = 0; i < results.size(); ++i)
+    OnRemoteCommandDone(connection_id, results[i]);
+}
+
+void MasterMainRunner::OnRemoteCommandDone(int connection_id,
+                                           const RemoteResult& remote_result) {
+  SlaveInfoIdMap::iterator slave = slave_info_id_map_.find(connection_id);
+  if (slave != slave_info_id_map_.end())
+    slave->second.amount_of_outstanding_edges--;
+  AttemptMap::iterator attempt = attempts_.find(
+      std::make_pair(connection_id, remote_result.edge_id));
+  if (attempt != attempts_.end() &&
+      attempt->second == remote_result.attempt_id) {
+    attempts_.erase(attempt);
+  }
+
+  // Entries are kept since several copies of an edge may run remotely.
+  OutstandingEdgeMap::iterator it =
+      outstanding_edges_.find(remote_result.edge_id);
+  DCHECK(it != outstanding_edges_.end());
+  ninja::DNBuilder* builder = ninja_main()->builder();
 
   // If remote command failed, don't abort the build process since it may
   // pass locally. We can give it an chance to run.
-  if (status != ExitSuccess)
+  if (remote_result.status != ExitSuccess) {
+    builder->RemoteEdgeFailed(it->second, connection_id,
+                              remote_result.attempt_id);
     return;
+  }
+
+  int64 output_bytes = 0;
+  for (size_t i = 0; i < remote_result.sizes.size(); ++i)
+    output_bytes += remote_result.sizes[i];
+
+  // Another copy of the edge has won, don't fetch the outputs.
+  if (!builder->ClaimRemoteResult(it->second, connection_id,
+                                  remote_result.attempt_id,
+                                  remote_result.wait_time, output_bytes)) {
+    builder->ScheduleRemoteWork();
+    return;
+  }
 
-  OutstandingEdgeMap::iterator it = outstanding_edges_.find(edge_id);
-  DCHECK(it != outstanding_edges_.end());
   CommandRunner::Result result;
   result.edge = it->second;
-  result.status = status;
-  result.output = output;  // The output stream of the command.
-  outstanding_edges_.erase(it);
-  std::string error;
+  result.status = remote_result.status;
+  result.output = remote_result.output;  // The output stream of the command.
 
-  DCHECK(result.edge->outputs_.size() == md5s.size());
+  const std::vector<std::string>& digests = remote_result.digests;
+  DCHECK(result.edge->outputs_.size() == digests.size());
+  bool restat = result.edge->GetBindingBool("restat");
   TargetVector targets;
+  common::FetchEngine::FileVector files;
   for (size_t i = 0; i < result.edge->outputs_.size(); ++i) {
-    targets.push_back(
-        std::make_pair(result.edge->outputs_[i]->path(), md5s[i]));
+    const std::string& path = result.edge->outputs_[i]->path();
+    targets.push_back(std::make_pair(path, digests[i]));
+    files.push_back(common::FetchEngine::File(
+        path,
+        digests[i],
+        i < remote_result.compressed.size() && remote_result.compressed[i]));
+    files.back().preserve_mtime = restat;
+    if (i < remote_result.sizes.size())
+      files.back().size = remote_result.sizes[i];
+    if (i < remote_result.chunk_digests.size())
+      files.back().chunk_digests = remote_result.chunk_digests[i];
   }
 
   DCHECK(slave_info_id_map_.find(connection_id) != slave_info_id_map_.end());
   std::string host =
       slave_info_id_map_[connection_id].ip + ":" + options::kMongooseServerPort;
-  NinjaThread::PostBlockingPoolTask(
-      FROM_HERE,
-      base::Bind(&MasterMainRunner::FetchTargetsOnBlockingPool,
+
+  // The outputs stay on the slave until an edge here needs them. They are
+  // recorded first, since the edges which are started when |edge| finishes
+  // look for them.
+  if (CanFetchLazily(result.edge, remote_result)) {
+    // The deps are read from the depfile when the edge finishes.
+    std::string depfile = result.edge->GetUnescapedDepfile();
+    if (!remote_result.depfile.empty() &&
+        (!base::CreateDirectory(
+             base::FilePath::FromUTF8Unsafe(depfile).DirName()) ||
+         !ninja_main()->disk_interface()->WriteFile(depfile,
+                                                    remote_result.depfile))) {
+      OnFetchTargetsFailed(connection_id, remote_result.attempt_id,
+                           result.edge);
+      return;
+    }
+    for (size_t i = 0; i < files.size(); ++i) {
+      remote_outputs_.erase(files[i].path);
+      remote_outputs_.insert(std::make_pair(
+          files[i].path, RemoteOutput(connection_id, host, files[i])));
+    }
+    OnFetchTargetsDone(connection_id, targets, result);
+    return;
+  }
+  builder->FetchAfterLocalCopy(
+      result.edge,
+      base::Bind(&MasterMainRunner::FetchTargets,
                  this,
+                 connection_id,
+                 remote_result.attempt_id,
                  host,
+                 files,
+                 targets,
+                 result));
+
+  // The slot of the slave is free now, don't wait for the outputs.
+  builder->ScheduleRemoteWork();
+}
+
+void MasterMainRunner::FetchTargets(
+    int connection_id,
+    uint32 attempt,
+    const std::string& host,
+    const common::FetchEngine::FileVector& files,
+    const TargetVector& targets,
+    CommandRunner::Result result) {
+  // The outputs which the longest chains of edges wait for go first.
+  fetch_engine_->Fetch(
+      host,
+      files,
+      ninja_main()->builder()->GetDownstreamPriority(result.edge),
+      base::Bind(&MasterMainRunner::OnTargetsFetched,
+                 this,
+                 connection_id,
+                 attempt,
                  targets,
                  result));
 }
@@ -207,60 +857,95 @@ void MasterMainRunner::OnSlaveSystemInfoAvailable(int connection_id,
 
   slave_info_id_map_[connection_id] = info;
 
+  // A slave which joins or reconnects during the build gets ready edges up to
+  // its capacity right away, or takes over edges queued on other slaves.
+  if (is_building_) {
+    if (ninja_main()->builder() != NULL)
+      ninja_main()->builder()->ScheduleRemoteWork();
+    return;
+  }
+
   if (slave_info_id_map_.size() >= max_slave_amount_)
     StartBuild();
 }
 
-void MasterMainRunner::OnSlaveStatusUpdate(
-    int connection_id,
-    double load_average,
-    int amount_of_running_commands,
-    int64 amount_of_available_physical_memory) {
+void MasterMainRunner::OnSlaveStatusUpdate(int connection_id,
+                                           const SlaveStatus& status) {
   // Don't update the status until |OnSlaveSystemInfoAvailable| is called.
   SlaveInfoIdMap::iterator it = slave_info_id_map_.find(connection_id);
   if (it == slave_info_id_map_.end())
     return;
 
-  it->second.load_average = load_average;
-  it->second.amount_of_running_commands = amount_of_running_commands;
-  it->second.amount_of_available_physical_memory =
-      amount_of_available_physical_memory;
+  it->second.status = status;
+
+  // A slave which was saturated may be able to take more edges now.
+  if (is_building_ && ninja_main()->builder() != NULL)
+    ninja_main()->builder()->ScheduleRemoteWork();
 }
 
-void MasterMainRunner::OnSlaveClose(int connection_id) {
-  DCHECK(slave_info_id_map_.find(connection_id) != slave_info_id_map_.end());
-  slave_info_id_map_.erase(connection_id);
+int MasterMainRunner::SelectSlave() const {
+  return slave_selector_.SelectSlave(slave_info_id_map_);
 }
 
-void MasterMainRunner::FetchTargetsOnBlockingPool(
-    const std::string& host,
-    const TargetVector& targets,
-    CommandRunner::Result result) {
-  bool success = false;
-  if (result.success()) {
-    CurlHelper curl_helper;
-    for (size_t i = 0; i < targets.size(); ++i) {
-      base::FilePath filename =
-          base::FilePath::FromUTF8Unsafe(targets[i].first);
-      std::string url = kHttp + host + "/" + targets[i].first;
-      std::string md5 = curl_helper.Get(url, filename);
-      success = (md5 == targets[i].second);
-      if (!success) {
-        LOG(ERROR) << "Curl " << url << "|" << md5 << "|" << targets[i].second;
-        break;
-      }
+void MasterMainRunner::OnSlaveClose(int connection_id) {
+  // Rejected slaves are not in the map.
+  if (slave_info_id_map_.erase(connection_id) == 0)
+    return;
+
+  queued_edges_.erase(connection_id);
+  for (AttemptMap::iterator it = attempts_.begin(); it != attempts_.end();) {
+    if (it->first.first == connection_id)
+      attempts_.erase(it++);
+    else
+      ++it;
+  }
+  if (steal_connection_id_ == connection_id)
+    steal_connection_id_ = -1;
+
+  // The outputs left on the slave are gone with it.
+  std::vector<Node*> lost_outputs;
+  for (RemoteOutputMap::iterator it = remote_outputs_.begin();
+       it != remote_outputs_.end();) {
+    if (it->second.connection_id != connection_id) {
+      ++it;
+      continue;
     }
+    Node* node = ninja_main()->state().LookupNode(it->first);
+    if (node != NULL)
+      lost_outputs.push_back(node);
+    remote_outputs_.erase(it++);
   }
 
-  if (success) {
-    NinjaThread::PostTask(
-        NinjaThread::MAIN,
-        FROM_HERE,
-        base::Bind(&MasterMainRunner::OnFetchTargetsDone, this, result));
+  if (is_building_ && ninja_main()->builder() != NULL) {
+    ninja_main()->builder()->SlaveLost(connection_id);
+    if (!lost_outputs.empty())
+      ninja_main()->builder()->OutputsLost(lost_outputs);
   }
+}
 
-  // DO NOT call |MasterMainRunner::OnFetchTargetsDone| if curl is failed,
-  // since we will try to start unfinished outstanding edges locally.
+void MasterMainRunner::OnTargetsFetched(int connection_id,
+                                        uint32 attempt,
+                                        const TargetVector& targets,
+                                        CommandRunner::Result result,
+                                        bool success,
+                                        int64 bytes,
+                                        base::TimeDelta elapsed) {
+  SlaveInfoIdMap::iterator slave = slave_info_id_map_.find(connection_id);
+  if (slave != slave_info_id_map_.end() &&
+      bytes >= kMinBytesToMeasureThroughput && elapsed > base::TimeDelta()) {
+    double bytes_per_second = bytes / elapsed.InSecondsF();
+    double& smoothed = slave->second.fetch_bytes_per_second;
+    if (smoothed <= 0) {
+      smoothed = bytes_per_second;
+    } else {
+      smoothed += kThroughputSmoothingFactor * (bytes_per_second - smoothed);
+    }
+  }
+
+  if (success)
+    OnFetchTargetsDone(connection_id, targets, result);
+  else
+    OnFetchTargetsFailed(connection_id, attempt, result.edge);
 }
 
 void MasterMainRunner::SetWebUIInitialStatus(const std::string& json) {
@@ -272,10 +957,33 @@ void MasterMainRunner::SetWebUIInitialStatus(const std::string& json) {
                  json));
 }
 
+void MasterMainRunner::UpdateWebUIFetchStatus(int queued, int active) {
+  base::DictionaryValue fetch_status;
+  fetch_status.SetInteger("queued", queued);
+  fetch_status.SetInteger("active", active);
+  std::string json;
+  base::JSONWriter::Write(&fetch_status, &json);
+
+  NinjaThread::PostTask(
+      NinjaThread::FILE,
+      FROM_HERE,
+      base::Bind(&WebUIThread::SetFetchStatus,
+                 base::Unretained(webui_thread_.get()),
+                 json));
+}
+
 void MasterMainRunner::BuildEdgeStarted(Edge* edge) {
 }
 
 void MasterMainRunner::BuildEdgeFinished(CommandRunner::Result* result) {
+  // The outputs have been written again, forget their old digests.
+  for (vector<Node*>::iterator o = result->edge->outputs_.begin();
+       o != result->edge->outputs_.end();
+       ++o) {
+    input_digests_.erase((*o)->path());
+    output_slaves_.erase((*o)->path());
+  }
+
   scoped_ptr<base::DictionaryValue> command_result(new base::DictionaryValue());
   command_result->SetInteger("id", result->edge->id_);
   command_result->SetInteger("result", result->status);
@@ -7,42 +7,57 @@
 
 #include <map>
 #include <queue>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "base/callback.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/time/time.h"
+#include "common/fetch_engine.h"
 #include "common/main_runner.h"
+#include "master/master_rpc.h"
+#include "master/slave_info.h"
+#include "master/slave_selector.h"
 #include "third_party/ninja/src/build.h"
 #include "third_party/ninja/src/subprocess.h"
 
 namespace master {
 
-class MasterRPC;
 class WebUIThread;
 
-struct SlaveInfo {
-  int32 number_of_processors;
-  int64 amount_of_physical_memory;
-  int64 amount_of_virtual_memory;
-  std::string operating_system_name;
-  std::string operating_system_version;
-  std::string operating_system_architecture;
-  std::string ip;
-
-  // The following fields will change dynamically.
-  double load_average;
-  int amount_of_running_commands;
-  int64 amount_of_available_physical_memory;
-};
-
 class MasterMainRunner : public common::MainRunner {
  public:
-  // The first one is the file path, the second one is its md5 digest.
+  // The first one is the file path, the second one is its digest.
   typedef std::pair<std::string, std::string> Target;
   typedef std::vector<Target> TargetVector;
 
-  // Map the connection id to slave info.
-  typedef std::map<int, SlaveInfo> SlaveInfoIdMap;
+  // The result of an edge run by a slave.
+  struct RemoteResult {
+    uint32 edge_id;
+    uint32 attempt_id;
+    ExitStatus status;
+    std::string output;  // The output stream of the command.
+    std::string depfile;  // See slave::RunCommandResponse.depfile.
+    base::TimeDelta wait_time;  // See slave::RunCommandResponse.wait_ms.
+    std::vector<std::string> digests;
+    std::vector<bool> compressed;
+
+    // The size of each output, and the digests of its chunks, see
+    // common::FetchEngine::File.
+    std::vector<int64> sizes;
+    std::vector<std::vector<std::string> > chunk_digests;
+  };
+  typedef std::vector<RemoteResult> RemoteResultVector;
+
+  // A command which started to run on a slave, see slave::StartedCommand.
+  struct RemoteStart {
+    uint32 edge_id;
+    uint32 attempt_id;
+    base::TimeDelta wait_time;
+  };
+  typedef std::vector<RemoteStart> RemoteStartVector;
 
   MasterMainRunner(const std::string& bind_ip, uint16 port);
 
@@ -51,26 +66,59 @@ class MasterMainRunner : public common::MainRunner {
 
   void StartBuild();
 
-  bool StartEdgeRemotelly(Edge* edge, int connection_id);
+  // Queues the copy |attempt| of |edge| for slave |connection_id|, see
+  // ninja::Speculator::EdgeStarted(). The edges queued in the same tick of
+  // the MAIN thread are sent to each slave in one batch.
+  bool StartEdgeRemotelly(Edge* edge, int connection_id, uint32 attempt);
+
+  // Kills the copy of |edge| run by slave |connection_id|. Its RunCommand
+  // still completes, with ExitInterrupted.
+  void CancelEdgeRemotely(Edge* edge, int connection_id);
   void BuildFinished();
 
-  void OnRemoteCommandDone(int connection_id,
-                           uint32 edge_id,
-                           ExitStatus status,
-                           const std::string& output,
-                           const std::vector<std::string>& md5s);
+  // Moves queued edges of the most backlogged slave back to the master, so
+  // that idle slaves can run them. At most one steal is in flight.
+  void StealWork();
+  void OnCommandsStolen(int connection_id,
+                        const std::vector<uint32>& edge_ids,
+                        const std::vector<uint32>& attempt_ids);
+
+  void OnRemoteCommandsStarted(int connection_id,
+                               const RemoteStartVector& starts);
+  void OnRemoteCommandsDone(int connection_id,
+                            const RemoteResultVector& results);
+  void OnRemoteCommandDone(int connection_id, const RemoteResult& result);
 
-  void FetchTargetsOnBlockingPool(const std::string& host,
-                                  const TargetVector& targets,
-                                  CommandRunner::Result result);
-  void OnFetchTargetsDone(CommandRunner::Result result);
+  // Fetches |files|, the outputs of the edge of |result|, from slave
+  // |connection_id| at |host|, which ran the copy |attempt| of the edge.
+  void FetchTargets(int connection_id,
+                    uint32 attempt,
+                    const std::string& host,
+                    const common::FetchEngine::FileVector& files,
+                    const TargetVector& targets,
+                    CommandRunner::Result result);
+  void OnTargetsFetched(int connection_id,
+                        uint32 attempt,
+                        const TargetVector& targets,
+                        CommandRunner::Result result,
+                        bool success,
+                        int64 bytes,
+                        base::TimeDelta elapsed);
+  void OnFetchTargetsDone(int connection_id,
+                          const TargetVector& targets,
+                          CommandRunner::Result result);
+  void OnFetchTargetsFailed(int connection_id, uint32 attempt, Edge* edge);
+
+  // Fetches the outputs of remote edges among the generated inputs of |edge|
+  // which have been left on the slaves, see CanFetchLazily(), then runs
+  // |callback| with whether they were all fetched. Returns false, without
+  // running |callback|, if all of them are here already.
+  typedef base::Callback<void(bool success)> MaterializeCallback;
+  bool MaterializeInputs(Edge* edge, const MaterializeCallback& callback);
 
   void OnSlaveSystemInfoAvailable(int connection_id, const SlaveInfo& info);
 
-  void OnSlaveStatusUpdate(int connection_id,
-                           double load_average,
-                           int amount_of_running_commands,
-                           int64 amount_of_available_physical_memory);
+  void OnSlaveStatusUpdate(int connection_id, const SlaveStatus& status);
   void OnSlaveClose(int connection_id);
 
   void SetWebUIInitialStatus(const std::string& json);
@@ -81,12 +129,57 @@ class MasterMainRunner : public common::MainRunner {
     return slave_info_id_map_;
   }
 
+  // Returns the connection id of the slave which should run the next remote
+  // edge, or -1 if all slaves are saturated.
+  int SelectSlave() const;
+
  private:
   SlaveInfoIdMap slave_info_id_map_;
+  SlaveSelector slave_selector_;
 
   friend class base::RefCountedThreadSafe<MasterMainRunner>;
   ~MasterMainRunner() override;
 
+  void StartQueuedEdgesRemotely();
+
+  // Returns the zlib level at which the outputs of slave |info| should be
+  // compressed, zero for none. It is high when the link to the slave is slow,
+  // and zero when the link is fast or the slave has no CPU to spare.
+  int SelectCompressionLevel(const SlaveInfo& info) const;
+
+  // Fills in the digests of the inputs of |commands| which are not known yet,
+  // then sends |commands| to slave |connection_id|.
+  void DigestInputsOnBlockingPool(int connection_id,
+                                  const MasterRPC::CommandVector& commands);
+  void OnInputDigestsComputed(const TargetVector& digests);
+  void SendCommandsRemotely(int connection_id,
+                            const MasterRPC::CommandVector& commands,
+                            bool has_unknown_digests,
+                            bool success);
+
+  // Whether the outputs of |edge| may stay on the slave which built them
+  // until they are needed here. Final targets, and the outputs of edges
+  // whose outputs are read when they finish, e.g. to restat them, are
+  // fetched at once. The deps of an edge come with its |result| instead, in
+  // its output stream or its depfile.
+  bool CanFetchLazily(Edge* edge, const RemoteResult& result) const;
+
+  // Fetches the files of |paths| which have been left on the slaves, see
+  // MaterializeInputs(). Fetches of a higher |priority| go first.
+  bool MaterializeOutputs(const std::vector<std::string>& paths,
+                          int64 priority,
+                          const MaterializeCallback& callback);
+  void OnOutputsMaterialized(const std::vector<std::string>& paths,
+                             bool success,
+                             int64 bytes,
+                             base::TimeDelta elapsed);
+  void OnAllOutputsMaterialized(bool success);
+  void Quit();
+
+  // Shows the depth of the fetch queue in the WebUI. Runs on the thread of
+  // |fetch_engine_|, see common::FetchEngine::StatusCallback.
+  void UpdateWebUIFetchStatus(int queued, int active);
+
   std::string bind_ip_;
   uint16 port_;
   scoped_ptr<MasterRPC> master_rpc_;
@@ -96,6 +189,79 @@ class MasterMainRunner : public common::MainRunner {
   typedef std::map<uint32, Edge*> OutstandingEdgeMap;
   OutstandingEdgeMap outstanding_edges_;
 
+  // The attempt of the copy of each edge id sent to each slave, keyed by
+  // connection id and edge id, see StartEdgeRemotelly().
+  typedef std::map<std::pair<int, uint32>, uint32> AttemptMap;
+  AttemptMap attempts_;
+
+  // Edges queued by |StartEdgeRemotelly| which have not been sent yet.
+  typedef std::map<int, std::vector<Edge*> > QueuedEdgeMap;
+  QueuedEdgeMap queued_edges_;
+  bool is_start_scheduled_;
+
+  // Whether slaves get the generated inputs of an edge from the master,
+  // instead of building them again.
+  bool ship_inputs_;
+
+  // The digest of the outputs of remote edges and of shipped inputs.
+  common::DigestType digest_type_;
+
+  // Whether outputs may be fetched compressed, see SelectCompressionLevel().
+  bool compress_outputs_;
+
+  // The digests of generated files which have been built in this run, keyed by
+  // path. An entry is dropped when the file is built again.
+  typedef std::map<std::string, std::string> DigestMap;
+  DigestMap input_digests_;
+
+  // The slaves which built the generated files of |input_digests_|, keyed by
+  // path. Unless |peer_transfer_| is false, a slave fetches such an input
+  // from the slave which built it, which keeps the link of the master free.
+  typedef std::map<std::string, int> OutputSlaveMap;
+  OutputSlaveMap output_slaves_;
+  bool peer_transfer_;
+
+  // Fetches the outputs of remote edges from the slaves.
+  scoped_ptr<common::FetchEngine> fetch_engine_;
+
+  // Whether the outputs of remote edges are fetched only when they are
+  // needed, and whether all of them are fetched when the build ends anyway.
+  bool lazy_outputs_;
+  bool materialize_outputs_;
+
+  // The targets of the build, and the nodes they stand for through phony
+  // edges.
+  std::set<Node*> final_targets_;
+
+  // The outputs of remote edges which have been left on the slaves, keyed by
+  // path.
+  struct RemoteOutput {
+    RemoteOutput(int connection_id,
+                 const std::string& host,
+                 const common::FetchEngine::File& file);
+
+    int connection_id;
+    std::string host;
+    common::FetchEngine::File file;
+  };
+  typedef std::map<std::string, RemoteOutput> RemoteOutputMap;
+  RemoteOutputMap remote_outputs_;
+
+  // A call of MaterializeOutputs(), waiting for |pending| files.
+  struct Materialization {
+    int pending;
+    bool success;
+    MaterializeCallback callback;
+  };
+
+  // The materializations waiting for each file which is being fetched.
+  typedef std::map<std::string, std::vector<Materialization*> >
+      MaterializationMap;
+  MaterializationMap materializations_;
+
+  // The slave which is asked to give up edges, -1 if there is none.
+  int steal_connection_id_;
+
   scoped_ptr<WebUIThread> webui_thread_;
 
   uint32 max_slave_amount_;
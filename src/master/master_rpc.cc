@@ -13,6 +13,11 @@
 
 namespace {
 
+// A slave which does not answer a status request for that many heartbeats,
+// i.e. for ten seconds, is considered dead and its connection is closed. The
+// slave answers from a cached status, a late answer is not due to its load.
+const int kMaxMissedHeartbeats = 5;
+
 ExitStatus TransformExitStatus(slave::RunCommandResponse::ExitStatus status) {
   switch (status) {
   case slave::RunCommandResponse::kExitSuccess:
@@ -87,6 +92,9 @@ void MasterRPC::OnConnect(rpc::RpcConnection* connection) {
 
 void MasterRPC::OnClose(rpc::RpcConnection* connection) {
   connections_.erase(connection->id());
+  running_commands_.erase(connection->id());
+  waiting_connections_.erase(connection->id());
+  missed_heartbeats_.erase(connection->id());
   NinjaThread::PostTask(
       NinjaThread::MAIN,
       FROM_HERE,
@@ -95,35 +103,109 @@ void MasterRPC::OnClose(rpc::RpcConnection* connection) {
                  connection->id()));
 }
 
-void MasterRPC::StartCommandRemotely(int connection_id,
-                                     const OutputPaths& paths,
-                                     const std::string& rspfile_name,
-                                     const std::string& rspfile_content,
-                                     uint32 edge_id) {
-  slave::RunCommandRequest request;
-  request.set_edge_id(edge_id);
-  if (!rspfile_name.empty()) {
-    request.set_rspfile_name(rspfile_name);
-    request.set_rspfile_content(rspfile_content);
-  }
-  for (OutputPaths::const_iterator it = paths.begin();
-       it != paths.end();
+void MasterRPC::StartCommandsRemotely(int connection_id,
+                                      const CommandVector& commands) {
+  // The slave may have gone after the batch was queued on the MAIN thread.
+  // OnSlaveClose() is on its way there, it starts the edges again.
+  ConnectionMap::iterator connection = connections_.find(connection_id);
+  if (connection == connections_.end())
+    return;
+
+  slave::RunCommandsRequest request;
+  for (CommandVector::const_iterator it = commands.begin();
+       it != commands.end();
        ++it) {
-    std::string* path = request.add_output_paths();
-    path->assign(*it);
+    slave::RunCommandRequest* command = request.add_commands();
+    command->set_edge_id(it->edge_id);
+    command->set_attempt_id(it->attempt_id);
+    if (!it->rspfile_name.empty()) {
+      command->set_rspfile_name(it->rspfile_name);
+      command->set_rspfile_content(it->rspfile_content);
+    }
+    for (OutputPaths::const_iterator path = it->output_paths.begin();
+         path != it->output_paths.end();
+         ++path) {
+      command->add_output_paths()->assign(*path);
+    }
+    command->set_digest_type(static_cast<slave::DigestType>(it->digest_type));
+    if (it->compression_level > 0)
+      command->set_compression_level(it->compression_level);
+    command->set_range_size(it->range_size);
+    if (it->ship_inputs) {
+      command->set_ship_inputs(true);
+      for (InputFiles::const_iterator input = it->inputs.begin();
+           input != it->inputs.end();
+           ++input) {
+        slave::InputFile* input_file = command->add_inputs();
+        input_file->set_path(input->first);
+        input_file->set_digest(input->second);
+        InputHosts::const_iterator host = it->input_hosts.find(input->first);
+        if (host != it->input_hosts.end())
+          input_file->set_host(host->second);
+      }
+    }
   }
 
-  // |response| will be deleted when after corresponding |OnRemoteCommandDone|
-  // is called.
-  slave::RunCommandResponse* response = new slave::RunCommandResponse();
-  CHECK(connections_.find(connection_id) != connections_.end());
-  slave::SlaveService::Stub stub(connections_[connection_id]);
-  stub.RunCommand(
+  // |response| will be deleted in |OnRunCommandsDone|.
+  slave::RunCommandsResponse* response = new slave::RunCommandsResponse();
+  slave::SlaveService::Stub stub(connection->second);
+  stub.RunCommands(
       NULL,
       &request,
       response,
       google::protobuf::NewCallback(this,
-                                    &MasterRPC::OnRemoteCommandDone,
+                                    &MasterRPC::OnRunCommandsDone,
+                                    response));
+
+  running_commands_[connection_id] += commands.size();
+  if (waiting_connections_.find(connection_id) == waiting_connections_.end())
+    WaitForResults(connection_id);
+}
+
+void MasterRPC::CancelCommandRemotely(int connection_id,
+                                      uint32 edge_id,
+                                      uint32 attempt_id) {
+  // The slave may have gone in the meantime.
+  ConnectionMap::iterator it = connections_.find(connection_id);
+  if (it == connections_.end())
+    return;
+
+  slave::CancelCommandRequest request;
+  request.set_edge_id(edge_id);
+  request.set_attempt_id(attempt_id);
+
+  // |response| will be deleted in |OnCancelCommandDone|.
+  slave::CancelCommandResponse* response = new slave::CancelCommandResponse();
+  slave::SlaveService::Stub stub(it->second);
+  stub.CancelCommand(
+      NULL,
+      &request,
+      response,
+      google::protobuf::NewCallback(this,
+                                    &MasterRPC::OnCancelCommandDone,
+                                    response));
+}
+
+void MasterRPC::StealCommandsRemotely(int connection_id, int max_commands) {
+  slave::StealCommandsResponse* response = new slave::StealCommandsResponse();
+  ConnectionMap::iterator it = connections_.find(connection_id);
+  if (it == connections_.end()) {
+    // Let MAIN thread know the steal is over.
+    OnCommandsStolen(connection_id, response);
+    return;
+  }
+
+  slave::StealCommandsRequest request;
+  request.set_max_commands(max_commands);
+
+  // |response| will be deleted in |OnCommandsStolen|.
+  slave::SlaveService::Stub stub(it->second);
+  stub.StealCommands(
+      NULL,
+      &request,
+      response,
+      google::protobuf::NewCallback(this,
+                                    &MasterRPC::OnCommandsStolen,
                                     connection_id,
                                     response));
 }
@@ -140,24 +222,97 @@ void MasterRPC::QuitSlave(int connection_id, const std::string& reason) {
   stub.Quit(NULL, &request, &response, NULL);
 }
 
-void MasterRPC::OnRemoteCommandDone(
+void MasterRPC::OnRunCommandsDone(slave::RunCommandsResponse* raw_response) {
+  scoped_ptr<slave::RunCommandsResponse> response(raw_response);
+}
+
+void MasterRPC::WaitForResults(int connection_id) {
+  ConnectionMap::iterator it = connections_.find(connection_id);
+  DCHECK(it != connections_.end());
+  waiting_connections_.insert(connection_id);
+
+  slave::WaitForResultsRequest request;
+  // |response| will be deleted in |OnResultsAvailable|.
+  slave::WaitForResultsResponse* response =
+      new slave::WaitForResultsResponse();
+  slave::SlaveService::Stub stub(it->second);
+  stub.WaitForResults(
+      NULL,
+      &request,
+      response,
+      google::protobuf::NewCallback(this,
+                                    &MasterRPC::OnResultsAvailable,
+                                    connection_id,
+                                    response));
+}
+
+void MasterRPC::OnResultsAvailable(
     int connection_id,
-    slave::RunCommandResponse* raw_response) {
-  scoped_ptr<slave::RunCommandResponse> response(raw_response);
-  std::vector<std::string> md5s;
-  for (int i = 0; i < response->md5_size(); ++i)
-    md5s.push_back(response->md5(i));
+    slave::WaitForResultsResponse* raw_response) {
+  scoped_ptr<slave::WaitForResultsResponse> response(raw_response);
+  waiting_connections_.erase(connection_id);
+
+  MasterMainRunner::RemoteResultVector results(response->results_size());
+  for (int i = 0; i < response->results_size(); ++i) {
+    const slave::RunCommandResponse& result = response->results(i);
+    results[i].edge_id = result.edge_id();
+    results[i].attempt_id = result.attempt_id();
+    results[i].status = TransformExitStatus(result.status());
+    results[i].output = result.output();
+    results[i].depfile = result.depfile();
+    results[i].wait_time = base::TimeDelta::FromMilliseconds(result.wait_ms());
+    for (int j = 0; j < result.digest_size(); ++j)
+      results[i].digests.push_back(result.digest(j));
+    for (int j = 0; j < result.compressed_size(); ++j)
+      results[i].compressed.push_back(result.compressed(j));
+    for (int j = 0; j < result.size_size(); ++j)
+      results[i].sizes.push_back(result.size(j));
+    results[i].chunk_digests.resize(result.chunk_digests_size());
+    for (int j = 0; j < result.chunk_digests_size(); ++j) {
+      const slave::RunCommandResponse::ChunkDigests& chunk_digests =
+          result.chunk_digests(j);
+      results[i].chunk_digests[j].assign(chunk_digests.digest().begin(),
+                                         chunk_digests.digest().end());
+    }
+  }
 
   NinjaThread::PostTask(
       NinjaThread::MAIN,
       FROM_HERE,
-      base::Bind(&MasterMainRunner::OnRemoteCommandDone,
+      base::Bind(&MasterMainRunner::OnRemoteCommandsDone,
                  master_main_runner_,
                  connection_id,
-                 response->edge_id(),
-                 TransformExitStatus(response->status()),
-                 response->output(),
-                 md5s));
+                 results));
+
+  // Keep waiting while the slave still runs commands of ours.
+  RunningCommandsMap::iterator it = running_commands_.find(connection_id);
+  if (it == running_commands_.end())
+    return;
+  it->second -= response->results_size();
+  if (it->second > 0 && connections_.find(connection_id) != connections_.end())
+    WaitForResults(connection_id);
+}
+
+void MasterRPC::OnCancelCommandDone(
+    slave::CancelCommandResponse* raw_response) {
+  scoped_ptr<slave::CancelCommandResponse> response(raw_response);
+}
+
+void MasterRPC::OnCommandsStolen(int connection_id,
+                                 slave::StealCommandsResponse* raw_response) {
+  scoped_ptr<slave::StealCommandsResponse> response(raw_response);
+  std::vector<uint32> edge_ids(response->edge_ids().begin(),
+                               response->edge_ids().end());
+  std::vector<uint32> attempt_ids(response->attempt_ids().begin(),
+                                  response->attempt_ids().end());
+  NinjaThread::PostTask(
+      NinjaThread::MAIN,
+      FROM_HERE,
+      base::Bind(&MasterMainRunner::OnCommandsStolen,
+                 master_main_runner_,
+                 connection_id,
+                 edge_ids,
+                 attempt_ids));
 }
 
 void MasterRPC::OnSlaveSystemInfoAvailable(
@@ -174,6 +329,8 @@ void MasterRPC::OnSlaveSystemInfoAvailable(
   info.operating_system_version = response->operating_system_version();
   info.operating_system_architecture =
       response->operating_system_architecture();
+  info.amount_of_slots = response->amount_of_slots();
+  info.prefetch_depth = response->prefetch_depth();
 
   net::IPEndPoint ip_address;
   connections_[connection_id]->GetPeerAddress(&ip_address);
@@ -189,9 +346,20 @@ void MasterRPC::OnSlaveSystemInfoAvailable(
 }
 
 void MasterRPC::GetSlavesStatus() {
+  std::vector<rpc::RpcConnection*> dead_connections;
   for (ConnectionMap::iterator it = connections_.begin();
        it != connections_.end();
        ++it) {
+    if (++missed_heartbeats_[it->first] > kMaxMissedHeartbeats) {
+      LOG(WARNING) << "Slave " << it->first << " stops responding.";
+      dead_connections.push_back(it->second);
+      continue;
+    }
+
+    // Requests don't pile up on a slave which is slow to answer.
+    if (missed_heartbeats_[it->first] > 1)
+      continue;
+
     slave::StatusRequest request;
     slave::StatusResponse* response = new slave::StatusResponse();
     slave::SlaveService::Stub stub(it->second);
@@ -201,20 +369,53 @@ void MasterRPC::GetSlavesStatus() {
                                       it->first,
                                       response));
   }
+
+  // Closing runs |OnClose|, which modifies |connections_|.
+  for (size_t i = 0; i < dead_connections.size(); ++i)
+    dead_connections[i]->Close();
 }
 
 void MasterRPC::OnSlaveStatusUpdate(int connection_id,
                                     slave::StatusResponse* raw_response) {
   scoped_ptr<slave::StatusResponse> response(raw_response);
+  if (connections_.find(connection_id) != connections_.end())
+    missed_heartbeats_[connection_id] = 0;
+
+  SlaveStatus status;
+  status.load_average = response->load_average();
+  status.amount_of_running_commands = response->amount_of_running_commands();
+  status.amount_of_available_physical_memory =
+      response->amount_of_available_physical_memory();
+  status.cpu_pressure = response->cpu_pressure();
+  status.io_pressure = response->io_pressure();
+  status.amount_of_free_disk_space = response->amount_of_free_disk_space();
+
+  if (response->started_commands_size() > 0) {
+    MasterMainRunner::RemoteStartVector starts(
+        response->started_commands_size());
+    for (int i = 0; i < response->started_commands_size(); ++i) {
+      const slave::StartedCommand& command = response->started_commands(i);
+      starts[i].edge_id = command.edge_id();
+      starts[i].attempt_id = command.attempt_id();
+      starts[i].wait_time =
+          base::TimeDelta::FromMilliseconds(command.wait_ms());
+    }
+    NinjaThread::PostTask(
+        NinjaThread::MAIN,
+        FROM_HERE,
+        base::Bind(&MasterMainRunner::OnRemoteCommandsStarted,
+                   master_main_runner_,
+                   connection_id,
+                   starts));
+  }
+
   NinjaThread::PostTask(
       NinjaThread::MAIN,
       FROM_HERE,
       base::Bind(&MasterMainRunner::OnSlaveStatusUpdate,
                  master_main_runner_,
                  connection_id,
-                 response->load_average(),
-                 response->amount_of_running_commands(),
-                 response->amount_of_available_physical_memory()));
+                 status));
 }
 
 }  // namespace master
@@ -6,16 +6,22 @@
 #define  MASTER_MASTER_RPC_H_
 
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/memory/scoped_ptr.h"
 #include "base/timer/timer.h"
+#include "common/digest.h"
 #include "rpc/rpc_socket_server.h"
 #include "thread/ninja_thread_delegate.h"
 
 namespace slave {
-class RunCommandResponse;
+class CancelCommandResponse;
+class RunCommandsResponse;
+class StealCommandsResponse;
+class WaitForResultsResponse;
 class StatusResponse;
 class SystemInfoResponse;
 }  // namespace slave
@@ -42,15 +48,44 @@ class MasterRPC : public NinjaThreadDelegate,
   void OnClose(rpc::RpcConnection* connection) override;
 
   typedef std::vector<std::string> OutputPaths;
-  void StartCommandRemotely(int connection_id,
-                            const OutputPaths& paths,
-                            const std::string& rspfile_name,
-                            const std::string& rspfile_content,
-                            uint32 edge_id);
+
+  // The first one is the file path, the second one is its digest.
+  typedef std::vector<std::pair<std::string, std::string> > InputFiles;
+
+  // The slaves which the inputs may be fetched from instead of the master,
+  // keyed by path, see slave::InputFile.host.
+  typedef std::map<std::string, std::string> InputHosts;
+  struct Command {
+    uint32 edge_id;
+    uint32 attempt_id;
+    OutputPaths output_paths;
+    std::string rspfile_name;
+    std::string rspfile_content;
+    bool ship_inputs;
+    InputFiles inputs;
+    InputHosts input_hosts;
+    common::DigestType digest_type;
+    int compression_level;
+    int64 range_size;
+  };
+  typedef std::vector<Command> CommandVector;
+
+  // Sends |commands| to the slave in one message, their results come back in
+  // batches through WaitForResults.
+  void StartCommandsRemotely(int connection_id, const CommandVector& commands);
+  void CancelCommandRemotely(int connection_id,
+                             uint32 edge_id,
+                             uint32 attempt_id);
+  void StealCommandsRemotely(int connection_id, int max_commands);
   void QuitSlave(int connection_id, const std::string& reason);
 
-  void OnRemoteCommandDone(int connection_id,
-                           slave::RunCommandResponse* raw_response);
+  void OnRunCommandsDone(slave::RunCommandsResponse* raw_response);
+  void WaitForResults(int connection_id);
+  void OnResultsAvailable(int connection_id,
+                          slave::WaitForResultsResponse* raw_response);
+  void OnCancelCommandDone(slave::CancelCommandResponse* raw_response);
+  void OnCommandsStolen(int connection_id,
+                        slave::StealCommandsResponse* raw_response);
   void OnSlaveSystemInfoAvailable(int connection_id,
                                   slave::SystemInfoResponse* raw_response);
   void OnSlaveStatusUpdate(int connection_id,
@@ -66,6 +101,18 @@ class MasterRPC : public NinjaThreadDelegate,
   typedef std::map<int, rpc::RpcConnection*> ConnectionMap;
   ConnectionMap connections_;
 
+  // The amount of commands of each slave whose results are not back yet.
+  typedef std::map<int, int> RunningCommandsMap;
+  RunningCommandsMap running_commands_;
+
+  // The slaves with a pending WaitForResults call.
+  std::set<int> waiting_connections_;
+
+  // The amount of heartbeats since the last status request of each slave
+  // which has been answered. A single request is pending at a time.
+  typedef std::map<int, int> MissedHeartbeatsMap;
+  MissedHeartbeatsMap missed_heartbeats_;
+
   // Timer for checking slave status every two seconds.
   scoped_ptr<base::RepeatingTimer<MasterRPC> > timer_;
 
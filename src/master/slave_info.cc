@@ -0,0 +1,28 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "master/slave_info.h"
+
+namespace master {
+
+SlaveStatus::SlaveStatus()
+    : load_average(-1),
+      amount_of_running_commands(0),
+      amount_of_available_physical_memory(-1),
+      cpu_pressure(-1),
+      io_pressure(-1),
+      amount_of_free_disk_space(-1) {
+}
+
+SlaveInfo::SlaveInfo()
+    : number_of_processors(0),
+      amount_of_physical_memory(0),
+      amount_of_virtual_memory(0),
+      amount_of_slots(0),
+      prefetch_depth(0),
+      fetch_bytes_per_second(0),
+      amount_of_outstanding_edges(0) {
+}
+
+}  // namespace master
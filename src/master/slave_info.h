@@ -0,0 +1,62 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  MASTER_SLAVE_INFO_H_
+#define  MASTER_SLAVE_INFO_H_
+
+#include <map>
+#include <string>
+
+#include "base/basictypes.h"
+
+namespace master {
+
+// The status of a slave, which changes dynamically. It is polled from slaves
+// every two seconds.
+struct SlaveStatus {
+  SlaveStatus();
+
+  double load_average;
+  int amount_of_running_commands;
+  int64 amount_of_available_physical_memory;
+
+  // Pressure stall information in percent, negative if not available.
+  double cpu_pressure;
+  double io_pressure;
+
+  int64 amount_of_free_disk_space;
+};
+
+struct SlaveInfo {
+  SlaveInfo();
+
+  int32 number_of_processors;
+  int64 amount_of_physical_memory;
+  int64 amount_of_virtual_memory;
+  std::string operating_system_name;
+  std::string operating_system_version;
+  std::string operating_system_architecture;
+  std::string ip;
+
+  // The credit window advertised by the slave, zero if unknown.
+  int32 amount_of_slots;
+  int32 prefetch_depth;
+
+  // The smoothed throughput of the fetches of outputs from the slave, zero
+  // if unknown.
+  double fetch_bytes_per_second;
+
+  // The following fields will change dynamically.
+  SlaveStatus status;
+
+  // The amount of edges which are dispatched to the slave and not done yet.
+  int amount_of_outstanding_edges;
+};
+
+// Map the connection id to slave info.
+typedef std::map<int, SlaveInfo> SlaveInfoIdMap;
+
+}  // namespace master
+
+#endif  // MASTER_SLAVE_INFO_H_
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "master/slave_selector.h"
+
+#include <algorithm>
+
+namespace master {
+
+// static
+const int64 SlaveSelector::kMinAvailablePhysicalMemory = 512LL * 1024 * 1024;
+const int64 SlaveSelector::kMinFreeDiskSpace = 1024LL * 1024 * 1024;
+const double SlaveSelector::kMaxCPUPressure = 80.0;
+const double SlaveSelector::kMaxIOPressure = 40.0;
+
+SlaveSelector::SlaveSelector() {
+}
+
+SlaveSelector::~SlaveSelector() {
+}
+
+// static
+int SlaveSelector::GetCapacity(const SlaveInfo& info) {
+  const SlaveStatus& status = info.status;
+  if (status.amount_of_available_physical_memory >= 0 &&
+      status.amount_of_available_physical_memory <
+          kMinAvailablePhysicalMemory) {
+    return 0;
+  }
+  if (status.amount_of_free_disk_space >= 0 &&
+      status.amount_of_free_disk_space < kMinFreeDiskSpace) {
+    return 0;
+  }
+  if (status.io_pressure > kMaxIOPressure)
+    return 0;
+
+  // Keep the credit window of the slave full, so that a slot does not idle
+  // while the next edge is on its way. Slaves which don't advertise it get
+  // one more edge than processors.
+  int capacity = info.amount_of_slots > 0 ?
+      info.amount_of_slots + info.prefetch_depth :
+      info.number_of_processors + 1;
+
+  // Our own commands are part of the load average too, the rest is caused by
+  // other users of the machine.
+  if (status.load_average >= 0) {
+    int foreign_load = static_cast<int>(
+        status.load_average - status.amount_of_running_commands + 0.5);
+    if (foreign_load > 0)
+      capacity -= foreign_load;
+  }
+
+  // Tasks are stalled on CPU most of the time, don't add more of them.
+  if (status.cpu_pressure > kMaxCPUPressure &&
+      capacity > info.amount_of_outstanding_edges) {
+    capacity = info.amount_of_outstanding_edges;
+  }
+
+  return capacity > 0 ? capacity : 0;
+}
+
+int SlaveSelector::SelectSlave(const SlaveInfoIdMap& slaves) const {
+  int selected = -1;
+  int max_free_slots = 0;
+  int64 max_available_memory = 0;
+  for (SlaveInfoIdMap::const_iterator it = slaves.begin();
+       it != slaves.end();
+       ++it) {
+    int free_slots =
+        GetCapacity(it->second) - it->second.amount_of_outstanding_edges;
+    if (free_slots <= 0)
+      continue;
+
+    int64 available_memory =
+        it->second.status.amount_of_available_physical_memory;
+    if (free_slots > max_free_slots ||
+        (free_slots == max_free_slots &&
+         available_memory > max_available_memory)) {
+      selected = it->first;
+      max_free_slots = free_slots;
+      max_available_memory = available_memory;
+    }
+  }
+
+  return selected;
+}
+
+int SlaveSelector::SelectBacklogged(const SlaveInfoIdMap& slaves,
+                                    int* max_commands) const {
+  int selected = -1;
+  int backlog = 0;
+  *max_commands = 0;
+  for (SlaveInfoIdMap::const_iterator it = slaves.begin();
+       it != slaves.end();
+       ++it) {
+    int slots = it->second.amount_of_slots > 0 ?
+        it->second.amount_of_slots : it->second.number_of_processors;
+    int queued = it->second.amount_of_outstanding_edges - slots;
+    if (queued > backlog) {
+      selected = it->first;
+      backlog = queued;
+    }
+  }
+  if (selected < 0)
+    return -1;
+
+  int free_slots = 0;
+  for (SlaveInfoIdMap::const_iterator it = slaves.begin();
+       it != slaves.end();
+       ++it) {
+    if (it->first == selected)
+      continue;
+    free_slots += std::max(
+        GetCapacity(it->second) - it->second.amount_of_outstanding_edges, 0);
+  }
+  if (free_slots == 0)
+    return -1;
+
+  *max_commands = std::min((backlog + 1) / 2, free_slots);
+  return selected;
+}
+
+}  // namespace master
@@ -0,0 +1,54 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  MASTER_SLAVE_SELECTOR_H_
+#define  MASTER_SLAVE_SELECTOR_H_
+
+#include "base/basictypes.h"
+#include "master/slave_info.h"
+
+namespace master {
+
+// SlaveSelector decides how many edges a slave should have in flight and
+// which slave gets the next remote edge. The farm mixes shared workstations
+// with dedicated machines, so the capacity of a slave is derived from its
+// credit window, i.e. its executor slots plus a prefetch depth, minus the load
+// which is not caused by us, and a slave which is short of memory or disk, or
+// stalled on IO, gets no new edges at all.
+class SlaveSelector {
+ public:
+  // Below these a slave is likely to swap or fail to write outputs.
+  static const int64 kMinAvailablePhysicalMemory;
+  static const int64 kMinFreeDiskSpace;
+
+  // Pressure stall thresholds in percent, beyond which a slave is considered
+  // saturated.
+  static const double kMaxCPUPressure;
+  static const double kMaxIOPressure;
+
+  SlaveSelector();
+  ~SlaveSelector();
+
+  // Returns how many edges |info| should have queued or running.
+  static int GetCapacity(const SlaveInfo& info);
+
+  // Returns the connection id of the slave with the most free capacity, or -1
+  // if every slave is saturated. Ties go to the slave with more available
+  // physical memory.
+  int SelectSlave(const SlaveInfoIdMap& slaves) const;
+
+  // Returns the connection id of the slave with the most edges queued beyond
+  // its executor slots, or -1 if no slave has any, or if no other slave has
+  // free capacity to run them. |max_commands| is set to how many of them
+  // should move: half of them, since the slave runs the rest soon, and no
+  // more than the other slaves have room for, so that they don't come back.
+  int SelectBacklogged(const SlaveInfoIdMap& slaves, int* max_commands) const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SlaveSelector);
+};
+
+}  // namespace master
+
+#endif  // MASTER_SLAVE_SELECTOR_H_
@@ -0,0 +1,109 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "master/slave_selector.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace master {
+
+namespace {
+
+SlaveInfo CreateSlaveInfo(int number_of_processors) {
+  SlaveInfo info;
+  info.number_of_processors = number_of_processors;
+  info.status.load_average = 0;
+  info.status.amount_of_available_physical_memory = 8LL * 1024 * 1024 * 1024;
+  info.status.amount_of_free_disk_space = 100LL * 1024 * 1024 * 1024;
+  return info;
+}
+
+}  // namespace
+
+TEST(SlaveSelectorTest, Capacity) {
+  SlaveInfo info = CreateSlaveInfo(8);
+  EXPECT_EQ(9, SlaveSelector::GetCapacity(info));
+
+  // Load caused by our own commands does not reduce the capacity.
+  info.status.load_average = 6;
+  info.status.amount_of_running_commands = 6;
+  EXPECT_EQ(9, SlaveSelector::GetCapacity(info));
+
+  // Load caused by other users does.
+  info.status.load_average = 10;
+  EXPECT_EQ(5, SlaveSelector::GetCapacity(info));
+}
+
+TEST(SlaveSelectorTest, CreditWindow) {
+  SlaveInfo info = CreateSlaveInfo(8);
+  info.amount_of_slots = 10;
+  info.prefetch_depth = 4;
+  EXPECT_EQ(14, SlaveSelector::GetCapacity(info));
+
+  info.status.load_average = 12;
+  info.status.amount_of_running_commands = 10;
+  EXPECT_EQ(12, SlaveSelector::GetCapacity(info));
+}
+
+TEST(SlaveSelectorTest, SaturatedSlave) {
+  SlaveInfo info = CreateSlaveInfo(8);
+  info.status.amount_of_available_physical_memory =
+      SlaveSelector::kMinAvailablePhysicalMemory - 1;
+  EXPECT_EQ(0, SlaveSelector::GetCapacity(info));
+
+  info = CreateSlaveInfo(8);
+  info.status.io_pressure = SlaveSelector::kMaxIOPressure + 1;
+  EXPECT_EQ(0, SlaveSelector::GetCapacity(info));
+
+  info = CreateSlaveInfo(8);
+  info.status.cpu_pressure = SlaveSelector::kMaxCPUPressure + 1;
+  info.amount_of_outstanding_edges = 3;
+  EXPECT_EQ(3, SlaveSelector::GetCapacity(info));
+}
+
+TEST(SlaveSelectorTest, SelectSlave) {
+  SlaveSelector selector;
+  SlaveInfoIdMap slaves;
+  EXPECT_EQ(-1, selector.SelectSlave(slaves));
+
+  slaves[1] = CreateSlaveInfo(4);
+  slaves[2] = CreateSlaveInfo(8);
+  EXPECT_EQ(2, selector.SelectSlave(slaves));
+
+  slaves[2].amount_of_outstanding_edges = 6;
+  EXPECT_EQ(1, selector.SelectSlave(slaves));
+
+  slaves[1].amount_of_outstanding_edges = 5;
+  slaves[2].amount_of_outstanding_edges = 9;
+  EXPECT_EQ(-1, selector.SelectSlave(slaves));
+}
+
+TEST(SlaveSelectorTest, SelectBacklogged) {
+  SlaveSelector selector;
+  SlaveInfoIdMap slaves;
+  slaves[1] = CreateSlaveInfo(4);
+  slaves[2] = CreateSlaveInfo(8);
+  slaves[2].amount_of_slots = 10;
+
+  int max_commands;
+  slaves[1].amount_of_outstanding_edges = 4;
+  slaves[2].amount_of_outstanding_edges = 10;
+  EXPECT_EQ(-1, selector.SelectBacklogged(slaves, &max_commands));
+  EXPECT_EQ(0, max_commands);
+
+  // Nobody else has room for the backlog of slave 2.
+  slaves[1].amount_of_outstanding_edges = 6;
+  slaves[2].amount_of_outstanding_edges = 16;
+  EXPECT_EQ(-1, selector.SelectBacklogged(slaves, &max_commands));
+  EXPECT_EQ(0, max_commands);
+
+  // Half of the backlog moves, up to the free capacity of the others.
+  slaves[1].amount_of_outstanding_edges = 2;
+  EXPECT_EQ(2, selector.SelectBacklogged(slaves, &max_commands));
+  EXPECT_EQ(3, max_commands);
+  slaves[1].amount_of_outstanding_edges = 4;
+  EXPECT_EQ(2, selector.SelectBacklogged(slaves, &max_commands));
+  EXPECT_EQ(1, max_commands);
+}
+
+}  // namespace master
@@ -53,6 +53,12 @@ window.onload = function() {
             li.className = 'success';
           }
         }); 
+
+        post('/api/fetch_status', '', function(response) {
+          var status = JSON.parse(response);
+          document.getElementById('fetch-queue').textContent =
+              status.queued + ' queued, ' + status.active + ' active';
+        });
       }, 1000);
     });
   }
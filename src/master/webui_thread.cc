@@ -5,14 +5,21 @@
 #include "master/webui_thread.h"
 
 #include "base/bind.h"
+#include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/path_service.h"
 #include "base/strings/string_number_conversions.h"
+#include "common/options.h"
 #include "master/master_main_runner.h"
 #include "thread/ninja_thread.h"
 
 namespace {
 static bool g_should_quit_pool = false;
+
+// Each server is polled in turn, so keep the timeout short while there are
+// two of them.
+const int kPollTimeoutMs = 1000;
+const int kSharedPollTimeoutMs = 100;
 }  // namespace
 
 namespace master {
@@ -33,6 +40,9 @@ int WebUIThread::EventHandler(mg_connection* conn, mg_event ev) {
       } else  if (strcmp(conn->uri, "/api/result") == 0) {
         webui->HandleGetResult(conn);
         return MG_TRUE;
+      } else if (strcmp(conn->uri, "/api/fetch_status") == 0) {
+        webui->HandleGetFetchStatus(conn);
+        return MG_TRUE;
       }
 
       return MG_FALSE;
@@ -49,6 +59,8 @@ void WebUIThread::QuitPool() {
 
 WebUIThread::WebUIThread(MasterMainRunner* main_runner)
     : master_main_runner_(main_runner),
+      server_(NULL),
+      file_server_(NULL),
       weak_factory_(this) {
   NinjaThread::SetDelegate(NinjaThread::FILE, this);
 }
@@ -73,6 +85,20 @@ void WebUIThread::Init() {
       break;
     }
   }
+
+  // Slaves fetch the generated inputs of the commands they run from here.
+  if (base::CommandLine::ForCurrentProcess()->HasSwitch(
+          switches::kShipInputs)) {
+    file_server_ = mg_create_server(NULL, NULL);
+    mg_set_option(file_server_, "document_root", ".");
+    const char* error = mg_set_option(file_server_, "listening_port",
+                                      options::kMongooseServerPort);
+    if (error != NULL) {
+      LOG(ERROR) << "Failed to serve inputs on port "
+                 << options::kMongooseServerPort << ": " << error;
+      mg_destroy_server(&file_server_);
+    }
+  }
 }
 
 void WebUIThread::InitAsync() {
@@ -85,13 +111,20 @@ void WebUIThread::InitAsync() {
 
 void WebUIThread::CleanUp() {
   mg_destroy_server(&server_);
+  if (file_server_ != NULL)
+    mg_destroy_server(&file_server_);
 }
 
 void WebUIThread::PoolMongooseServer() {
   if (g_should_quit_pool)
     return;
 
-  mg_poll_server(server_, 1000);
+  if (file_server_ != NULL) {
+    mg_poll_server(server_, kSharedPollTimeoutMs);
+    mg_poll_server(file_server_, kSharedPollTimeoutMs);
+  } else {
+    mg_poll_server(server_, kPollTimeoutMs);
+  }
   NinjaThread::PostTask(
       NinjaThread::FILE,
       FROM_HERE,
@@ -123,4 +156,11 @@ void WebUIThread::HandleGetResult(mg_connection* conn) {
   mg_printf_data(conn, "]");
 }
 
+void WebUIThread::HandleGetFetchStatus(mg_connection* conn) {
+  if (fetch_status_.empty())
+    mg_printf_data(conn, "{ \"queued\": 0, \"active\": 0 }");
+  else
+    mg_printf_data(conn, fetch_status_.c_str());
+}
+
 }  // namespace master
@@ -39,13 +39,22 @@ class WebUIThread : public NinjaThreadDelegate {
     command_results_.push_back(json);
   }
 
+  void SetFetchStatus(const std::string& json) {
+    fetch_status_ = json;
+  }
+
  private:
   void HandleStart(mg_connection* conn);
   void HandleGetInitialStatus(mg_connection* conn);
   void HandleGetResult(mg_connection* conn);
+  void HandleGetFetchStatus(mg_connection* conn);
 
   MasterMainRunner* master_main_runner_;
   mg_server* server_;
+
+  // Serves the build directory to slaves when inputs are shipped, NULL
+  // otherwise.
+  mg_server* file_server_;
   base::WeakPtrFactory<WebUIThread> weak_factory_;
 
   // String in json format which contains info about command edge to be run.
@@ -53,6 +62,10 @@ class WebUIThread : public NinjaThreadDelegate {
 
   std::vector<std::string> command_results_;
 
+  // String in json format with the numbers of queued and active fetches of
+  // outputs.
+  std::string fetch_status_;
+
   DISALLOW_COPY_AND_ASSIGN(WebUIThread);
 };
 
@@ -0,0 +1,116 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/critical_path.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/ninja/src/build_log.h"
+#include "third_party/ninja/src/graph.h"
+
+namespace ninja {
+
+// static
+const int64 CriticalPath::kDefaultEdgeDuration = 100;
+
+CriticalPath::CriticalPath() : fallback_duration_(kDefaultEdgeDuration) {
+}
+
+CriticalPath::~CriticalPath() {
+}
+
+void CriticalPath::Compute(const std::set<Edge*>& edges, BuildLog* build_log) {
+  edges_ = edges;
+  durations_.clear();
+  priorities_.clear();
+
+  // The first one is the total duration, the second one is the edge count.
+  typedef std::map<std::string, std::pair<int64, int64> > RuleDurationMap;
+  RuleDurationMap rule_durations;
+  int64 total_duration = 0;
+  int64 known_edges = 0;
+  std::vector<Edge*> unknown_edges;
+  for (std::set<Edge*>::const_iterator it = edges_.begin();
+       it != edges_.end();
+       ++it) {
+    Edge* edge = *it;
+    if (edge->is_phony()) {
+      durations_[edge] = 0;
+      continue;
+    }
+
+    BuildLog::LogEntry* entry = NULL;
+    if (build_log != NULL && !edge->outputs_.empty())
+      entry = build_log->LookupByOutput(edge->outputs_[0]->path());
+    if (entry == NULL || entry->end_time < entry->start_time) {
+      unknown_edges.push_back(edge);
+      continue;
+    }
+
+    int64 duration = entry->end_time - entry->start_time;
+    durations_[edge] = duration;
+    std::pair<int64, int64>& rule = rule_durations[edge->rule().name()];
+    rule.first += duration;
+    rule.second++;
+    total_duration += duration;
+    known_edges++;
+  }
+
+  fallback_duration_ =
+      known_edges > 0 ? total_duration / known_edges : kDefaultEdgeDuration;
+  for (size_t i = 0; i < unknown_edges.size(); ++i) {
+    RuleDurationMap::const_iterator rule =
+        rule_durations.find(unknown_edges[i]->rule().name());
+    durations_[unknown_edges[i]] = rule != rule_durations.end() ?
+        rule->second.first / rule->second.second : fallback_duration_;
+  }
+
+  for (std::set<Edge*>::const_iterator it = edges_.begin();
+       it != edges_.end();
+       ++it) {
+    ComputePriority(*it);
+  }
+}
+
+int64 CriticalPath::GetPriority(Edge* edge) const {
+  EdgeValueMap::const_iterator it = priorities_.find(edge);
+  return it != priorities_.end() ? it->second : 0;
+}
+
+int64 CriticalPath::GetEstimatedDuration(Edge* edge) const {
+  EdgeValueMap::const_iterator it = durations_.find(edge);
+  return it != durations_.end() ? it->second : fallback_duration_;
+}
+
+int64 CriticalPath::ComputePriority(Edge* edge) {
+  EdgeValueMap::iterator it = priorities_.find(edge);
+  if (it != priorities_.end())
+    return it->second;
+
+  // Phony edges which are not part of the plan still connect edges that are,
+  // so walk through them at no cost.
+  int64 longest_tail = 0;
+  for (vector<Node*>::iterator out = edge->outputs_.begin();
+       out != edge->outputs_.end();
+       ++out) {
+    const vector<Edge*>& out_edges = (*out)->out_edges();
+    for (vector<Edge*>::const_iterator oe = out_edges.begin();
+         oe != out_edges.end();
+         ++oe) {
+      if (!(*oe)->is_phony() && edges_.find(*oe) == edges_.end())
+        continue;
+      longest_tail = std::max(longest_tail, ComputePriority(*oe));
+    }
+  }
+
+  int64 priority = longest_tail + (edge->is_phony() ? 0 :
+                                   GetEstimatedDuration(edge));
+  priorities_[edge] = priority;
+  return priority;
+}
+
+}  // namespace ninja
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_CRITICAL_PATH_H_
+#define  NINJA_CRITICAL_PATH_H_
+
+#include <map>
+#include <set>
+
+#include "base/basictypes.h"
+
+struct BuildLog;
+struct Edge;
+
+namespace ninja {
+
+// CriticalPath gives every edge of a plan a priority which is the estimated
+// time of the longest chain of edges that can not finish before it does,
+// including itself (the "bottom level" of the edge). Durations come from the
+// .ninja_log of previous builds. Running ready edges in descending priority
+// keeps long serial chains, e.g. codegen -> compile -> link, from waiting
+// behind hundreds of short compiles.
+class CriticalPath {
+ public:
+  // Duration in milliseconds used for an edge without any history, when no
+  // other edge has history either.
+  static const int64 kDefaultEdgeDuration;
+
+  CriticalPath();
+  ~CriticalPath();
+
+  // Computes durations and priorities for |edges|. |build_log| may be NULL,
+  // in which case every edge gets |kDefaultEdgeDuration| and the priority is
+  // proportional to the depth of the remaining graph.
+  void Compute(const std::set<Edge*>& edges, BuildLog* build_log);
+
+  // Returns the priority of |edge|, or 0 if it is unknown.
+  int64 GetPriority(Edge* edge) const;
+
+  // Returns the expected duration of |edge| in milliseconds. Edges without
+  // history are estimated by the mean duration of edges of the same rule,
+  // then by the mean duration of all edges.
+  int64 GetEstimatedDuration(Edge* edge) const;
+
+ private:
+  int64 ComputePriority(Edge* edge);
+
+  typedef std::map<Edge*, int64> EdgeValueMap;
+  EdgeValueMap durations_;
+  EdgeValueMap priorities_;
+
+  std::set<Edge*> edges_;
+  int64 fallback_duration_;
+
+  DISALLOW_COPY_AND_ASSIGN(CriticalPath);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_CRITICAL_PATH_H_
@@ -0,0 +1,66 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/critical_path.h"
+#include "ninja/test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const char kManifest[] =
+    "rule cc\n"
+    "  command = cc $in -o $out\n"
+    "rule link\n"
+    "  command = link $in -o $out\n"
+    "build a.o: cc a.c\n"
+    "build b.o: cc b.c\n"
+    "build app: link a.o b.o\n"
+    "build all: phony app\n";
+
+}  // namespace
+
+namespace ninja {
+
+class CriticalPathTest : public ManifestTest {
+ protected:
+  CriticalPathTest() : ManifestTest(kManifest) {}
+};
+
+TEST_F(CriticalPathTest, NoHistory) {
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, NULL);
+
+  const int64 kDuration = CriticalPath::kDefaultEdgeDuration;
+  EXPECT_EQ(kDuration * 2, critical_path.GetPriority(GetEdge("a.o")));
+  EXPECT_EQ(kDuration * 2, critical_path.GetPriority(GetEdge("b.o")));
+  EXPECT_EQ(kDuration, critical_path.GetPriority(GetEdge("app")));
+  EXPECT_EQ(0, critical_path.GetPriority(GetEdge("all")));
+}
+
+TEST_F(CriticalPathTest, LongestRemainingPath) {
+  build_log_.RecordCommand(GetEdge("a.o"), 0, 1000);
+  build_log_.RecordCommand(GetEdge("b.o"), 0, 10);
+  build_log_.RecordCommand(GetEdge("app"), 0, 500);
+
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, &build_log_);
+  EXPECT_EQ(1500, critical_path.GetPriority(GetEdge("a.o")));
+  EXPECT_EQ(510, critical_path.GetPriority(GetEdge("b.o")));
+  EXPECT_EQ(500, critical_path.GetPriority(GetEdge("app")));
+}
+
+TEST_F(CriticalPathTest, FallbackEstimate) {
+  build_log_.RecordCommand(GetEdge("a.o"), 0, 1000);
+
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, &build_log_);
+
+  // Same rule as "a.o".
+  EXPECT_EQ(1000, critical_path.GetEstimatedDuration(GetEdge("b.o")));
+  // No history for rule "link", use the mean of all edges.
+  EXPECT_EQ(1000, critical_path.GetEstimatedDuration(GetEdge("app")));
+  EXPECT_EQ(2000, critical_path.GetPriority(GetEdge("b.o")));
+}
+
+}  // namespace ninja
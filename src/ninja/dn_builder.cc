@@ -4,18 +4,25 @@
 
 #include "ninja/dn_builder.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/bind.h"
+#include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
 #include "base/json/json_writer.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/values.h"
+#include "common/action_cache.h"
+#include "common/options.h"
 #include "master/master_main_runner.h"
+#include "master/slave_selector.h"
 #include "third_party/ninja/src/build_log.h"
 #include "third_party/ninja/src/depfile_parser.h"
 #include "third_party/ninja/src/deps_log.h"
@@ -29,6 +36,48 @@
 
 using master::MasterMainRunner;
 
+namespace {
+
+// How often to look for straggler edges.
+const int kSpeculationIntervalInSeconds = 1;
+
+const int64 kDefaultActionCacheSizeInMB = 10 * 1024;
+
+// The statistics of ninja::Placement, in the build directory.
+const char kPlacementFileName[] = ".dn_placement";
+
+typedef base::Callback<void(const std::string&, bool, const std::string&)>
+    LookupCallback;
+
+void LookUpOnBlockingPool(scoped_refptr<common::ActionCache> action_cache,
+                          const std::string& command,
+                          const common::ActionCache::PathVector& inputs,
+                          const common::ActionCache::PathVector& outputs,
+                          const std::string& depfile,
+                          const LookupCallback& callback) {
+  std::string key;
+  common::ActionCache::PathVector deps;
+  std::string output;
+  bool hit = action_cache->Lookup(command, inputs, outputs, depfile, &key,
+                                  &deps, &output);
+
+  NinjaThread::PostTask(NinjaThread::MAIN,
+                        FROM_HERE,
+                        base::Bind(callback, key, hit, output));
+}
+
+void StoreOnBlockingPool(scoped_refptr<common::ActionCache> action_cache,
+                         const std::string& key,
+                         const common::ActionCache::PathVector& deps,
+                         const common::ActionCache::PathVector& outputs,
+                         const std::string& output) {
+  // E.g. an input changed in the meantime, the next run will store it.
+  if (!action_cache->Store(key, deps, outputs, output))
+    LOG(WARNING) << "Failed to store " << outputs[0] << " in action cache.";
+}
+
+}  // namespace
+
 namespace ninja {
 
 DNBuilder::DNBuilder(State* state,
@@ -41,7 +90,13 @@ DNBuilder::DNBuilder(State* state,
       command_runner_(NULL),
       disk_interface_(disk_interface),
       scan_(state, build_log, deps_log, disk_interface),
-      weak_factory_(this) {
+      weak_factory_(this),
+      use_critical_path_(true),
+      ready_sequence_(0),
+      local_queued_ms_(0),
+      placement_(&critical_path_),
+      speculator_(&critical_path_),
+      pch_affinity_(&critical_path_) {
   status_.reset(new BuildStatus(config));
   command_executor_.AddObserver(this);
 }
@@ -104,7 +159,48 @@ bool DNBuilder::Build(string* err, master::MasterMainRunner* runner) {
   std::string json;
   base::JSONWriter::Write(commands.get(), &json);
   runner->SetWebUIInitialStatus(json);
+
+  const base::CommandLine* command_line =
+      base::CommandLine::ForCurrentProcess();
+  // The durations are needed by |speculator_| and |placement_| even if the
+  // ready edges are not ordered by priority.
+  use_critical_path_ = !command_line->HasSwitch(switches::kDisableCriticalPath);
+  critical_path_.Compute(command_edge_set, scan_.build_log());
+  if (!command_line->HasSwitch(switches::kDisablePartitioning))
+    partitioner_.Compute(command_edge_set);
+  pch_affinity_.Compute(command_edge_set);
+
+  if (!command_line->HasSwitch(switches::kDisablePlacement)) {
+    std::string build_dir = state_->bindings_.LookupVariable("builddir");
+    placement_path_ =
+        base::FilePath::FromUTF8Unsafe(build_dir.empty() ? "." : build_dir)
+            .AppendASCII(kPlacementFileName);
+    placement_.set_ship_inputs(command_line->HasSwitch(switches::kShipInputs));
+    placement_.Load(placement_path_);
+  }
+
+  if (command_line->HasSwitch(switches::kActionCacheDir) && !config_.dry_run) {
+    int64 size_in_mb = kDefaultActionCacheSizeInMB;
+    if (command_line->HasSwitch(switches::kActionCacheSize)) {
+      base::StringToInt64(
+          command_line->GetSwitchValueASCII(switches::kActionCacheSize),
+          &size_in_mb);
+    }
+    action_cache_ = new common::ActionCache(
+        command_line->GetSwitchValuePath(switches::kActionCacheDir),
+        size_in_mb * 1024 * 1024);
+    if (!action_cache_->Init()) {
+      LOG(ERROR) << "Failed to initialize action cache.";
+      action_cache_ = NULL;
+    }
+  }
+
   start_build_time_ = base::Time::Now();
+  speculation_timer_.Start(
+      FROM_HERE,
+      base::TimeDelta::FromSeconds(kSpeculationIntervalInSeconds),
+      this,
+      &DNBuilder::Speculate);
 
   InitialalBuild();
   return true;
@@ -114,7 +210,7 @@ void DNBuilder::InitialalBuild() {
   DCHECK(!plan_.more_to_do());
 
   while (command_executor_.CanRunMore()) {
-    Edge* edge = plan_.FindWork();
+    Edge* edge = FindWork(false);
     if (edge == NULL)
       break;
 
@@ -127,38 +223,385 @@ void DNBuilder::InitialalBuild() {
     return;
   }
 
-  const MasterMainRunner::SlaveInfoIdMap& slaves = command_runner_->GetSlaves();
-  for (MasterMainRunner::SlaveInfoIdMap::const_iterator it = slaves.begin();
+  ScheduleRemoteWork();
+}
+
+Edge* DNBuilder::FindWork(bool remote) {
+  // Drain the ready set of |plan_|, whose order is just pointer order. Phony
+  // edges have nothing to run, finish them right away since that may make
+  // more edges ready.
+  while (Edge* edge = plan_.FindWork()) {
+    if (edge->is_phony()) {
+      plan_.EdgeFinished(edge);
+      continue;
+    }
+
+    if (action_cache_.get() != NULL && IsCacheable(edge)) {
+      LookUpActionCache(edge);
+      continue;
+    }
+
+    AddReadyEdge(edge);
+  }
+
+  while (true) {
+    ReadyQueue* queue = &ready_queue_;
+    if (!remote && !local_ready_queue_.empty() &&
+        (ready_queue_.empty() ||
+         ready_queue_.value_comp()(*local_ready_queue_.begin(),
+                                   *ready_queue_.begin()))) {
+      queue = &local_ready_queue_;
+    }
+    if (queue->empty())
+      return NULL;
+
+    Edge* edge = queue->begin()->second;
+    queue->erase(queue->begin());
+    if (queue == &local_ready_queue_)
+      local_queued_ms_ -= critical_path_.GetEstimatedDuration(edge);
+
+    // An input has been lost with a slave and runs again, see OutputsLost().
+    // |plan_| makes |edge| ready again once it is back.
+    if (edge->AllInputsReady())
+      return edge;
+  }
+}
+
+void DNBuilder::AddReadyEdge(Edge* edge) {
+  ReadyQueue* queue = &ready_queue_;
+  if (!Placement::CanRunRemotely(edge) ||
+      (!placement_path_.empty() &&
+       placement_.ShouldRunLocally(
+           edge, GetLinkBytesPerSecond(),
+           local_queued_ms_ / std::max(config_.parallelism, 1)))) {
+    queue = &local_ready_queue_;
+  }
+  QueueEdge(queue, edge);
+}
+
+void DNBuilder::QueueEdge(ReadyQueue* queue, Edge* edge) {
+  int64 key = use_critical_path_ ? critical_path_.GetPriority(edge) :
+                                   -(++ready_sequence_);
+  queue->insert(std::make_pair(key, edge));
+  if (queue == &local_ready_queue_) {
+    local_queued_ms_ += critical_path_.GetEstimatedDuration(edge);
+    speculator_.SetLocalOnly(edge);
+  }
+}
+
+double DNBuilder::GetLinkBytesPerSecond() const {
+  double total = 0;
+  int known = 0;
+  const master::SlaveInfoIdMap& slaves = command_runner_->GetSlaves();
+  for (master::SlaveInfoIdMap::const_iterator it = slaves.begin();
        it != slaves.end();
        ++it) {
-    int edge_counter = 0;
-    while (edge_counter <= it->second.number_of_processors) {
-      Edge* edge = plan_.FindWork();
-      if (edge == NULL)
-        break;
-
-      status_->BuildEdgeStarted(edge);
-      command_runner_->StartEdgeRemotelly(edge, it->first);
-      outstanding_edge_list_.push_back(edge);
-      edge_counter++;
+    if (it->second.fetch_bytes_per_second > 0) {
+      total += it->second.fetch_bytes_per_second;
+      known++;
     }
   }
+  return known > 0 ? total / known : 0;
 }
 
+bool DNBuilder::IsCacheable(Edge* edge) const {
+  // Without a deps log, the discovered deps are only known from a depfile
+  // which ninja reads on the next run, they can not be part of the key.
+  return !edge->GetBinding("deps").empty() ||
+         edge->GetUnescapedDepfile().empty();
+}
 
-bool DNBuilder::HasRemoteCommandRunLocally(Edge* edge) {
+void DNBuilder::LookUpActionCache(Edge* edge) {
+  looking_up_edges_.insert(edge);
+  if (command_runner_ == NULL ||
+      !command_runner_->MaterializeInputs(
+          edge,
+          base::Bind(&DNBuilder::OnCacheInputsMaterialized,
+                     weak_factory_.GetWeakPtr(),
+                     edge))) {
+    OnCacheInputsMaterialized(edge, true);
+  }
+}
+
+void DNBuilder::OnCacheInputsMaterialized(Edge* edge, bool success) {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
-  for (OutstandingEdgeList::iterator it = outstanding_edge_list_.begin();
-       it != outstanding_edge_list_.end();
-       ++it) {
-    if (*it == edge) {
-      return false;
-    }
+  // The build has finished in the meantime.
+  if (looking_up_edges_.find(edge) == looking_up_edges_.end())
+    return;
+
+  // The inputs are fetched again when |edge| starts.
+  if (!success) {
+    OnActionCacheLookupDone(edge, std::string(), false, std::string());
+    return;
+  }
+
+  // Order-only inputs don't change the outputs.
+  common::ActionCache::PathVector inputs;
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end() - edge->order_only_deps_;
+       ++i) {
+    inputs.push_back((*i)->path());
+  }
+  common::ActionCache::PathVector outputs;
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end();
+       ++o) {
+    outputs.push_back((*o)->path());
   }
+  // The deps of a gcc-style edge are read from its depfile, which is deleted
+  // once they are in the deps log. It is written again on a hit.
+  std::string depfile;
+  if (edge->GetBinding("deps") == "gcc")
+    depfile = edge->GetUnescapedDepfile();
 
+  // The command is kept to run it on a miss.
+  std::string command = edge->EvaluateCommand();
+  commands_[edge] = command;
+  NinjaThread::PostBlockingPoolTask(
+      FROM_HERE,
+      base::Bind(&LookUpOnBlockingPool,
+                 action_cache_,
+                 common::ActionCache::GetKeyCommand(
+                     command, edge->GetBinding("rspfile_content")),
+                 inputs,
+                 outputs,
+                 depfile,
+                 base::Bind(&DNBuilder::OnActionCacheLookupDone,
+                            weak_factory_.GetWeakPtr(),
+                            edge)));
+}
+
+void DNBuilder::OnActionCacheLookupDone(Edge* edge,
+                                        const std::string& key,
+                                        bool hit,
+                                        const std::string& output) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  // The build has finished in the meantime.
+  if (looking_up_edges_.erase(edge) == 0)
+    return;
+
+  if (hit) {
+    commands_.erase(edge);
+    status_->BuildEdgeStarted(edge);
+    CommandRunner::Result result;
+    result.edge = edge;
+    result.status = ExitSuccess;
+    result.output = output;
+    std::string error;
+    FinishCommand(&result, &error);
+  } else {
+    if (!key.empty())
+      action_keys_[edge] = key;
+    AddReadyEdge(edge);
+  }
+
+  BuildLoop();
+  ScheduleRemoteWork();
+}
+
+void DNBuilder::RemoteEdgeRunning(Edge* edge,
+                                  int connection_id,
+                                  uint32 attempt,
+                                  base::TimeDelta wait_time) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  speculator_.CopyRunning(edge, connection_id, attempt, wait_time);
+}
+
+bool DNBuilder::ClaimRemoteResult(Edge* edge,
+                                  int connection_id,
+                                  uint32 attempt,
+                                  base::TimeDelta wait_time,
+                                  int64 output_bytes) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  base::TimeTicks now = base::TimeTicks::Now();
+  base::TimeTicks start;
+  if (!speculator_.IsCurrentAttempt(edge, connection_id, attempt) ||
+      !speculator_.GetStartTime(edge, connection_id, &start)) {
+    return false;
+  }
+  // The start of the command may not have been reported yet.
+  speculator_.CopyRunning(edge, connection_id, attempt, wait_time);
+  if (!speculator_.ClaimResult(edge, connection_id, now))
+    return false;
+
+  // The wait on the slave depends on its load at the moment, it is not what
+  // the edge costs remotely.
+  if (!placement_path_.empty()) {
+    placement_.RecordRemoteRun(edge, std::max(now - start - wait_time,
+                                              base::TimeDelta()),
+                               output_bytes);
+  }
+
+  // A local copy writes the same files as the fetch of the outputs, kill it
+  // before the fetch starts.
+  if (speculator_.IsRunningOn(edge, Speculator::kLocalExecutor)) {
+    if (command_executor_.HasCommand(edge))
+      fetches_after_local_copy_[edge] = base::Closure();
+    CancelCopy(edge, Speculator::kLocalExecutor);
+    speculator_.CopyFailed(edge, Speculator::kLocalExecutor);
+  }
   return true;
 }
 
+void DNBuilder::FetchAfterLocalCopy(Edge* edge, const base::Closure& fetch) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  std::map<Edge*, base::Closure>::iterator it =
+      fetches_after_local_copy_.find(edge);
+  if (it == fetches_after_local_copy_.end()) {
+    fetch.Run();
+    return;
+  }
+  it->second = fetch;
+}
+
+int64 DNBuilder::GetDownstreamPriority(Edge* edge) const {
+  // The priority of an edge is its own duration plus the longest chain of
+  // edges after it.
+  return std::max(critical_path_.GetPriority(edge) -
+                      critical_path_.GetEstimatedDuration(edge),
+                  static_cast<int64>(0));
+}
+
+void DNBuilder::RemoteEdgeFinished(CommandRunner::Result* result,
+                                   int connection_id) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  std::string error;
+  FinishCommand(result, &error);
+
+  std::vector<int> losers;
+  speculator_.EdgeFinished(result->edge, &losers);
+  for (size_t i = 0; i < losers.size(); ++i)
+    CancelCopy(result->edge, losers[i]);
+
+  BuildLoop();
+  ScheduleRemoteWork();
+}
+
+void DNBuilder::RemoteEdgeFailed(Edge* edge,
+                                 int connection_id,
+                                 uint32 attempt) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  // Don't abort the build since the edge may pass locally, e.g. the slave
+  // lacks a tool. Give it a chance to run on the master. The interrupted
+  // result of a stolen or canceled copy is stale.
+  if (speculator_.IsCurrentAttempt(edge, connection_id, attempt) &&
+      speculator_.CopyFailed(edge, connection_id)) {
+    QueueEdge(&local_ready_queue_, edge);
+  }
+
+  BuildLoop();
+  ScheduleRemoteWork();
+}
+
+void DNBuilder::SlaveLost(int connection_id) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  pch_affinity_.SlaveLost(connection_id);
+  std::vector<Edge*> orphans;
+  speculator_.ExecutorLost(connection_id, &orphans);
+  for (size_t i = 0; i < orphans.size(); ++i) {
+    QueueEdge(&ready_queue_, orphans[i]);
+  }
+
+  BuildLoop();
+  ScheduleRemoteWork();
+}
+
+void DNBuilder::OutputsLost(const std::vector<Node*>& outputs) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  // All of them are marked first, so that an edge which needs another one
+  // doesn't get ready before it.
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (outputs[i]->in_edge() == NULL)
+      continue;
+    outputs[i]->in_edge()->outputs_ready_ = false;
+    outputs[i]->MarkDirty();
+  }
+  std::string error;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (outputs[i]->in_edge() != NULL && !plan_.AddTarget(outputs[i], &error))
+      LOG(ERROR) << error;
+  }
+
+  BuildLoop();
+  ScheduleRemoteWork();
+}
+
+void DNBuilder::OutputMaterialized(const std::string& output) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  Node* node = state_->LookupNode(output);
+  if (node == NULL || node->in_edge() == NULL ||
+      node->in_edge()->GetBinding("deps").empty() || config_.dry_run) {
+    return;
+  }
+
+  DepsLog::Deps* deps = scan_.deps_log()->GetDeps(node);
+  TimeStamp mtime = disk_interface_->Stat(output);
+  if (deps == NULL || mtime <= deps->mtime)
+    return;
+  std::vector<Node*> nodes(deps->nodes, deps->nodes + deps->node_count);
+  if (!scan_.deps_log()->RecordDeps(node, mtime, nodes))
+    LOG(ERROR) << "Error writing to deps log: " << strerror(errno);
+}
+
+void DNBuilder::RemoteEdgeStolen(Edge* edge,
+                                 int connection_id,
+                                 uint32 attempt) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  // The interrupted result of the stolen copy is ignored later, since the
+  // copy is gone.
+  if (speculator_.IsCurrentAttempt(edge, connection_id, attempt) &&
+      speculator_.CopyFailed(edge, connection_id)) {
+    stolen_edges_[edge] = connection_id;
+    QueueEdge(&ready_queue_, edge);
+  }
+}
+
+void DNBuilder::Speculate() {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  std::vector<Edge*> late_edges;
+  speculator_.GetLateEdges(base::TimeTicks::Now(), &late_edges);
+  if (late_edges.empty())
+    return;
+
+  // Idle executors, the fastest one first. Each of them gets at most one
+  // backup copy at a time.
+  std::vector<std::pair<double, int> > executors;
+  if (command_executor_.CanRunMore()) {
+    executors.push_back(std::make_pair(
+        speculator_.GetSlowness(Speculator::kLocalExecutor),
+        Speculator::kLocalExecutor));
+  }
+  const master::SlaveInfoIdMap& slaves = command_runner_->GetSlaves();
+  for (master::SlaveInfoIdMap::const_iterator it = slaves.begin();
+       it != slaves.end();
+       ++it) {
+    if (master::SlaveSelector::GetCapacity(it->second) >
+        it->second.amount_of_outstanding_edges) {
+      executors.push_back(
+          std::make_pair(speculator_.GetSlowness(it->first), it->first));
+    }
+  }
+  std::sort(executors.begin(), executors.end());
+
+  for (size_t i = 0; i < late_edges.size() && !executors.empty(); ++i) {
+    Edge* edge = late_edges[i];
+    for (size_t j = 0; j < executors.size(); ++j) {
+      int executor = executors[j].second;
+      if (!speculator_.CanRunOn(edge, executor))
+        continue;
+
+      if (executor == Speculator::kLocalExecutor) {
+        if (!StartEdgeLocally(edge))
+          LOG(ERROR) << "Can not start backup edge locally.";
+      } else {
+        StartEdgeRemotely(edge, executor);
+      }
+      executors.erase(executors.begin() + j);
+      break;
+    }
+  }
+}
+
 void DNBuilder::BuildLoop() {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
   DCHECK(command_runner_ != NULL);
@@ -168,14 +611,9 @@ void DNBuilder::BuildLoop() {
   }
 
   while (command_executor_.CanRunMore()) {
-    Edge* edge = plan_.FindWork();
-    if (edge == NULL) {
-      if (outstanding_edge_list_.empty())
-        break;
-
-      edge = outstanding_edge_list_.front();
-      outstanding_edge_list_.pop_front();
-    }
+    Edge* edge = FindWork(false);
+    if (edge == NULL)
+      break;
 
     if (!StartEdgeLocally(edge)) {
       LOG(ERROR) << "Can not start edge locally.";
@@ -195,7 +633,10 @@ bool DNBuilder::StartEdgeLocally(Edge* edge) {
     plan_.EdgeFinished(edge);
     return true;
   }
-  status_->BuildEdgeStarted(edge);
+
+  // Backup copies and retries are already reported as started.
+  if (!speculator_.IsOutstanding(edge))
+    status_->BuildEdgeStarted(edge);
 
   // Create directories necessary for outputs.
   for (vector<Node*>::iterator o = edge->outputs_.begin();
@@ -214,17 +655,74 @@ bool DNBuilder::StartEdgeLocally(Edge* edge) {
       return false;
   }
 
-  std::string command = edge->EvaluateCommand();
-  command_edge_map_[command] = edge;
-  command_executor_.RunCommand(edge->EvaluateCommand());
+  stolen_edges_.erase(edge);
+  speculator_.EdgeStarted(edge, Speculator::kLocalExecutor,
+                          base::TimeTicks::Now());
+  if (command_runner_->MaterializeInputs(
+          edge,
+          base::Bind(&DNBuilder::OnInputsMaterialized,
+                     weak_factory_.GetWeakPtr(),
+                     edge))) {
+    return true;
+  }
+  command_executor_.RunCommand(edge, TakeCommand(edge));
   return true;
 }
 
+std::string DNBuilder::TakeCommand(Edge* edge) {
+  std::map<Edge*, std::string>::iterator it = commands_.find(edge);
+  if (it == commands_.end())
+    return edge->EvaluateCommand();
+  std::string command;
+  command.swap(it->second);
+  commands_.erase(it);
+  return command;
+}
+
+void DNBuilder::OnInputsMaterialized(Edge* edge, bool success) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  // Cancelled in the meantime, e.g. a remote copy has won.
+  if (!speculator_.IsRunningOn(edge, Speculator::kLocalExecutor))
+    return;
+
+  if (success) {
+    command_executor_.RunCommand(edge, TakeCommand(edge));
+    return;
+  }
+
+  // An input has been lost with its slave, |plan_| makes |edge| ready again
+  // once it has been built again, see OutputsLost().
+  if (!edge->AllInputsReady()) {
+    speculator_.CopyFailed(edge, Speculator::kLocalExecutor);
+    return;
+  }
+
+  CommandRunner::Result result;
+  result.edge = edge;
+  result.status = ExitFailure;
+  result.output = "failed to fetch the inputs left on the slaves";
+  OnCommandFinished(&result);
+}
+
 bool DNBuilder::FinishCommand(CommandRunner::Result* result, string* err) {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
   METRIC_RECORD("FinishCommand");
   command_runner_->BuildEdgeFinished(result);
 
+  // The output stream is filtered below. The cache keeps it as it is, so
+  // that msvc-style deps can be extracted from it again on a hit.
+  std::string action_key;
+  std::map<Edge*, std::string>::iterator action_key_it =
+      action_keys_.find(result->edge);
+  if (action_key_it != action_keys_.end()) {
+    action_key = action_key_it->second;
+    action_keys_.erase(action_key_it);
+  }
+  // Left over if the edge ran remotely.
+  commands_.erase(result->edge);
+  const std::string raw_output =
+      action_key.empty() ? std::string() : result->output;
+
   if (!result->success()) {
     LOG(ERROR) << "subcommand failed: " << result->output;
     BuildFinished();
@@ -232,14 +730,6 @@ bool DNBuilder::FinishCommand(CommandRunner::Result* result, string* err) {
   }
 
   Edge* edge = result->edge;
-  for (OutstandingEdgeList::iterator it = outstanding_edge_list_.begin();
-       it != outstanding_edge_list_.end();
-       ++it) {
-    if (*it == edge) {
-      outstanding_edge_list_.erase(it);
-      break;
-    }
-  }
 
   // First try to extract dependencies from the result, if any.
   // This must happen first as it filters the command output (we want
@@ -333,6 +823,26 @@ bool DNBuilder::FinishCommand(CommandRunner::Result* result, string* err) {
       return false;
     }
   }
+
+  if (!action_key.empty()) {
+    common::ActionCache::PathVector deps;
+    for (size_t i = 0; i < deps_nodes.size(); ++i)
+      deps.push_back(deps_nodes[i]->path());
+    common::ActionCache::PathVector outputs;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end();
+         ++o) {
+      outputs.push_back((*o)->path());
+    }
+    NinjaThread::PostBlockingPoolTask(
+        FROM_HERE,
+        base::Bind(&StoreOnBlockingPool,
+                   action_cache_,
+                   action_key,
+                   deps,
+                   outputs,
+                   raw_output));
+  }
   return true;
 }
 
@@ -395,55 +905,169 @@ bool DNBuilder::ExtractDeps(CommandRunner::Result* result,
 }
 
 void DNBuilder::BuildFinished() {
+  speculation_timer_.Stop();
+  looking_up_edges_.clear();
+  action_keys_.clear();
+  commands_.clear();
+  stolen_edges_.clear();
+
+  // Nobody will use the results of the edges still running, e.g. after a
+  // failure.
+  Speculator::CopyVector copies;
+  speculator_.CancelAll(&copies);
+  for (size_t i = 0; i < copies.size(); ++i)
+    CancelCopy(copies[i].first, copies[i].second);
+
+  if (!placement_path_.empty() && !config_.dry_run &&
+      !placement_.Save(placement_path_)) {
+    LOG(WARNING) << "Failed to save " << placement_path_.AsUTF8Unsafe();
+  }
+
   base::TimeDelta time_between_use = base::Time::Now() - start_build_time_;
   LOG(INFO) << time_between_use.InSecondsF();
   status_->BuildFinished();
   command_runner_->BuildFinished();
 }
 
-void DNBuilder::OnCommandStarted(const std::string& command) {
+void DNBuilder::OnCommandStarted(Edge* edge) {
 }
 
-void DNBuilder::OnCommandFinished(const std::string& command,
-                                  const CommandRunner::Result* result) {
-  std::map<std::string, Edge*>::iterator it = command_edge_map_.find(command);
-  DCHECK(it != command_edge_map_.end());
+void DNBuilder::OnCommandFinished(const CommandRunner::Result* result) {
   CommandRunner::Result r = *result;
-  r.edge = it->second;
-  std::string error;
-  FinishCommand(&r, &error);
 
-  for (std::map<int, int>::iterator it = pending_edge_request_.begin();
-       it != pending_edge_request_.end();
-       ++it) {
-    if (it->second > 0) {
-      if (RequestEdge(it->first))
-        it->second--;
-    }
+  // The subprocess of a local copy killed for a remote result has been
+  // reaped, the outputs can be fetched now.
+  std::map<Edge*, base::Closure>::iterator fetch =
+      fetches_after_local_copy_.find(r.edge);
+  if (fetch != fetches_after_local_copy_.end()) {
+    base::Closure callback = fetch->second;
+    fetches_after_local_copy_.erase(fetch);
+    if (!callback.is_null())
+      callback.Run();
+  }
+
+  // A failed backup copy doesn't fail the edge while another copy still
+  // runs, the same as a failed remote copy, see RemoteEdgeFailed(). The
+  // result of a copy which lost against another copy is discarded.
+  if (!r.success() &&
+      speculator_.IsRunningOn(r.edge, Speculator::kLocalExecutor) &&
+      speculator_.IsRunningElsewhere(r.edge, Speculator::kLocalExecutor)) {
+    speculator_.CopyFailed(r.edge, Speculator::kLocalExecutor);
+  } else if (speculator_.ClaimResult(r.edge, Speculator::kLocalExecutor,
+                                     base::TimeTicks::Now())) {
+    std::string error;
+    FinishCommand(&r, &error);
+
+    std::vector<int> losers;
+    speculator_.EdgeFinished(r.edge, &losers);
+    for (size_t i = 0; i < losers.size(); ++i)
+      CancelCopy(r.edge, losers[i]);
   }
 
   BuildLoop();
+  ScheduleRemoteWork();
 }
 
-bool DNBuilder::RequestEdge(int connection_id) {
-  if (!plan_.more_to_do())
-    return false;
+void DNBuilder::ScheduleRemoteWork() {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  if (command_runner_ == NULL)
+    return;
+
+  // Edges which wait for a slave holding their precompiled header, or for
+  // another slave than the one they have been stolen from.
+  std::vector<Edge*> deferred_edges;
+  while (plan_.more_to_do()) {
+    int connection_id = command_runner_->SelectSlave();
+    if (connection_id < 0)
+      break;
 
-  Edge* edge = plan_.FindRemoteWork();
-  if (edge == NULL) {
-    if (pending_edge_request_.find(connection_id) !=
-        pending_edge_request_.end()) {
-      pending_edge_request_[connection_id]++;
-    } else {
-      pending_edge_request_[connection_id] = 1;
+    Edge* edge = FindWork(true);
+    if (edge == NULL) {
+      // Stolen edges would only be deferred again.
+      if (deferred_edges.empty())
+        command_runner_->StealWork();
+      break;
     }
-    return false;
+
+    connection_id =
+        SelectPchSlave(edge, SelectPartitionSlave(edge, connection_id));
+    std::map<Edge*, int>::iterator stolen = stolen_edges_.find(edge);
+    if (connection_id < 0 ||
+        (stolen != stolen_edges_.end() && stolen->second == connection_id)) {
+      deferred_edges.push_back(edge);
+      continue;
+    }
+    StartEdgeRemotely(edge, connection_id);
   }
 
-  status_->BuildEdgeStarted(edge);
-  command_runner_->StartEdgeRemotelly(edge, connection_id);
-  outstanding_edge_list_.push_back(edge);
-  return true;
+  for (size_t i = 0; i < deferred_edges.size(); ++i)
+    QueueEdge(&ready_queue_, deferred_edges[i]);
+}
+
+int DNBuilder::SelectPchSlave(Edge* edge, int selected) {
+  Edge* pch = pch_affinity_.GetPch(edge);
+  if (pch == NULL || pch_affinity_.IsHolder(pch, selected))
+    return selected;
+
+  // The holder with the most free capacity.
+  int holder = -1;
+  int most_free = 0;
+  const master::SlaveInfoIdMap& slaves = command_runner_->GetSlaves();
+  for (master::SlaveInfoIdMap::const_iterator it = slaves.begin();
+       it != slaves.end();
+       ++it) {
+    if (!pch_affinity_.IsHolder(pch, it->first))
+      continue;
+    int free_capacity = master::SlaveSelector::GetCapacity(it->second) -
+                        it->second.amount_of_outstanding_edges;
+    if (free_capacity > most_free) {
+      holder = it->first;
+      most_free = free_capacity;
+    }
+  }
+  if (holder >= 0)
+    return holder;
+
+  return pch_affinity_.CanAddHolder(pch) ? selected : -1;
+}
+
+int DNBuilder::SelectPartitionSlave(Edge* edge, int selected) {
+  Edge* partition = partitioner_.GetPartition(edge);
+  if (partition == NULL)
+    return selected;
+
+  const master::SlaveInfoIdMap& slaves = command_runner_->GetSlaves();
+  PartitionSlaveMap::iterator it = partition_slaves_.find(partition);
+  if (it != partition_slaves_.end()) {
+    master::SlaveInfoIdMap::const_iterator slave = slaves.find(it->second);
+    if (slave != slaves.end()) {
+      if (master::SlaveSelector::GetCapacity(slave->second) >
+          slave->second.amount_of_outstanding_edges) {
+        return it->second;
+      }
+      return selected;
+    }
+  }
+
+  partition_slaves_[partition] = selected;
+  return selected;
+}
+
+void DNBuilder::StartEdgeRemotely(Edge* edge, int connection_id) {
+  if (!speculator_.IsOutstanding(edge))
+    status_->BuildEdgeStarted(edge);
+  stolen_edges_.erase(edge);
+  uint32 attempt =
+      speculator_.EdgeStarted(edge, connection_id, base::TimeTicks::Now());
+  pch_affinity_.EdgeStarted(edge, connection_id);
+  command_runner_->StartEdgeRemotelly(edge, connection_id, attempt);
+}
+
+void DNBuilder::CancelCopy(Edge* edge, int executor) {
+  if (executor == Speculator::kLocalExecutor)
+    command_executor_.CancelCommand(edge);
+  else
+    command_runner_->CancelEdgeRemotely(edge, executor);
 }
 
 }  // namespace ninja
@@ -5,17 +5,32 @@
 #ifndef  NINJA_DN_BUILDER_H_
 #define  NINJA_DN_BUILDER_H_
 
-#include <list>
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "base/callback.h"
+#include "base/memory/ref_counted.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/files/file_path.h"
 #include "base/memory/weak_ptr.h"
 #include "base/time/time.h"
+#include "base/timer/timer.h"
 #include "common/command_executor.h"
+#include "ninja/critical_path.h"
+#include "ninja/partitioner.h"
+#include "ninja/pch_affinity.h"
+#include "ninja/placement.h"
+#include "ninja/speculator.h"
 #include "third_party/ninja/src/build.h"
 
+namespace common {
+class ActionCache;
+}  // namespace common
+
 namespace master {
 class MasterMainRunner;
 }  // namespace master
@@ -49,18 +64,135 @@ class DNBuilder : public common::CommandExecutor::Observer {
   /// @return false if the build can not proceed further due to a fatal error.
   bool FinishCommand(CommandRunner::Result* result, string* err);
 
-  bool HasRemoteCommandRunLocally(Edge* edge);
+  // Called when the copy |attempt| of |edge| sent to slave |connection_id|
+  // started to run, after waiting |wait_time| there.
+  void RemoteEdgeRunning(Edge* edge,
+                         int connection_id,
+                         uint32 attempt,
+                         base::TimeDelta wait_time);
+
+  // Called when the copy |attempt| of |edge| run by slave |connection_id|
+  // succeeded, after waiting |wait_time| there, with outputs of
+  // |output_bytes| in total. Returns true if it is the first result of
+  // |edge|, then its outputs should be fetched and passed to
+  // RemoteEdgeFinished(). Otherwise the result should be discarded, e.g. it
+  // is stale, see Speculator::IsCurrentAttempt().
+  bool ClaimRemoteResult(Edge* edge,
+                         int connection_id,
+                         uint32 attempt,
+                         base::TimeDelta wait_time,
+                         int64 output_bytes);
+
+  // Runs |fetch|, which fetches the outputs of the claimed remote result of
+  // |edge|, once the local copy of |edge| killed by ClaimRemoteResult() has
+  // exited, since it writes the same files. Runs it at once if there is no
+  // such copy.
+  void FetchAfterLocalCopy(Edge* edge, const base::Closure& fetch);
+
+  // Returns the critical path priority of the edges which wait for the
+  // outputs of |edge|, i.e. how much work its outputs unblock.
+  int64 GetDownstreamPriority(Edge* edge) const;
+  void RemoteEdgeFinished(CommandRunner::Result* result, int connection_id);
+
+  // Called when the copy |attempt| of |edge| run by slave |connection_id|
+  // failed, or its outputs could not be fetched.
+  void RemoteEdgeFailed(Edge* edge, int connection_id, uint32 attempt);
+
+  // Called when the connection of slave |connection_id| is gone. Its edges
+  // go back to the ready queue.
+  void SlaveLost(int connection_id);
+
+  // Called when |outputs|, which have been left on a slave, are gone with it.
+  // Their edges run again, and the edges which need them wait until then.
+  void OutputsLost(const std::vector<Node*>& outputs);
+
+  // Called when |output|, which has been left on a slave, has been fetched.
+  // Its deps were recorded before it arrived, they are recorded again with
+  // its modification time, otherwise the next build finds them out of date.
+  void OutputMaterialized(const std::string& output);
+
+  // Called when slave |connection_id| gave up the copy |attempt| of |edge|
+  // before starting it, see master::MasterMainRunner::StealWork().
+  void RemoteEdgeStolen(Edge* edge, int connection_id, uint32 attempt);
+
   void BuildLoop();
   void BuildFinished();
 
-  void OnCommandStarted(const std::string& command) override;
-  void OnCommandFinished(const std::string& command,
-                         const CommandRunner::Result* result) override;
-  bool RequestEdge(int connection_id);
+  // common::CommandExecutor::Observer implementations.
+  void OnCommandStarted(Edge* edge) override;
+  void OnCommandFinished(const CommandRunner::Result* result) override;
+
+  // Dispatches ready edges to slaves until there is no ready edge or every
+  // slave is saturated, see master::SlaveSelector. The edges of each slave
+  // are sent in one batch. If a slave is idle while there is no ready edge,
+  // queued edges are stolen from the most backlogged slave.
+  void ScheduleRemoteWork();
 
  private:
   void InitialalBuild();
 
+  // Returns the ready edge with the highest critical path priority, or NULL if
+  // there is no ready edge. Edges which must run on the master are only
+  // returned if |remote| is false.
+  Edge* FindWork(bool remote);
+
+  // Queues the ready |edge| by its priority, on |local_ready_queue_| if it
+  // can't run remotely, or if |placement_| finds it faster here.
+  void AddReadyEdge(Edge* edge);
+
+  // Ready queues are ordered by this key, descending. It is the critical path
+  // priority of |edge|, or a decreasing sequence number with
+  // switches::kDisableCriticalPath, so that edges run in the order they got
+  // ready. Edges queued on |local_ready_queue_| don't get backup copies on
+  // the slaves either.
+  typedef std::set<std::pair<int64, Edge*>,
+                   std::greater<std::pair<int64, Edge*> > > ReadyQueue;
+  void QueueEdge(ReadyQueue* queue, Edge* edge);
+
+  // Returns the mean throughput of the links to the slaves, zero if unknown.
+  double GetLinkBytesPerSecond() const;
+
+  void StartEdgeRemotely(Edge* edge, int connection_id);
+
+  // Returns the slave which runs the partition of |edge|, see Partitioner, if
+  // it still has free capacity. Otherwise returns |selected|, which then runs
+  // the partition unless its slave is still connected, i.e. an idle slave
+  // takes whatever is ready rather than waiting for its partitions.
+  int SelectPartitionSlave(Edge* edge, int selected);
+
+  // Returns |selected| unless |edge| reads a precompiled header which
+  // |selected| doesn't hold, see PchAffinity. Then returns the holder with
+  // the most free capacity, or |selected| if another copy of the header pays
+  // off, or -1 if |edge| should wait for a holder.
+  int SelectPchSlave(Edge* edge, int selected);
+
+  // Returns the command of |edge| evaluated for its action cache lookup, if
+  // any, otherwise evaluates it.
+  std::string TakeCommand(Edge* edge);
+
+  // Runs |edge| here once its inputs left on the slaves have been fetched,
+  // see master::MasterMainRunner::MaterializeInputs().
+  void OnInputsMaterialized(Edge* edge, bool success);
+
+  // Returns true if the result of |edge| can be kept in |action_cache_|.
+  bool IsCacheable(Edge* edge) const;
+
+  // Looks for a result of |edge| in |action_cache_| on the blocking pool,
+  // once its inputs left on the slaves have been fetched, since the key
+  // hashes them. |edge| is finished on a hit, or queued to run on a miss.
+  void LookUpActionCache(Edge* edge);
+  void OnCacheInputsMaterialized(Edge* edge, bool success);
+  void OnActionCacheLookupDone(Edge* edge,
+                               const std::string& key,
+                               bool hit,
+                               const std::string& output);
+
+  // Kills the copy of |edge| run by |executor|, see Speculator.
+  void CancelCopy(Edge* edge, int executor);
+
+  // Starts backup copies of late edges on idle executors.
+  void Speculate();
+
   bool ExtractDeps(CommandRunner::Result* result, const string& deps_type,
                    const string& deps_prefix, vector<Node*>* deps_nodes,
                    string* err);
@@ -77,15 +209,65 @@ class DNBuilder : public common::CommandExecutor::Observer {
 
   int pending_commands_;
 
-  typedef std::list<Edge*> OutstandingEdgeList;
-  OutstandingEdgeList outstanding_edge_list_;
-
   base::Time start_build_time_;
 
   common::CommandExecutor command_executor_;
-  std::map<std::string, Edge*> command_edge_map_;
 
-  std::map<int, int> pending_edge_request_;
+  CriticalPath critical_path_;
+  bool use_critical_path_;
+
+  // The number of edges queued so far, see QueueEdge().
+  int64 ready_sequence_;
+
+  Partitioner partitioner_;
+
+  // The slave of each partition, keyed by the root edge of the partition.
+  typedef std::map<Edge*, int> PartitionSlaveMap;
+  PartitionSlaveMap partition_slaves_;
+
+  // Ready edges taken out of |plan_|, see QueueEdge().
+  ReadyQueue ready_queue_;
+
+  // The slave which gave up each stolen edge. The edge doesn't go back there,
+  // see ScheduleRemoteWork().
+  std::map<Edge*, int> stolen_edges_;
+
+  // Ready edges which are only allowed to run on the master, e.g. edges that
+  // failed remotely, or which are not worth sending out, see Placement.
+  ReadyQueue local_ready_queue_;
+
+  // The estimated duration of the edges in |local_ready_queue_| in total, in
+  // milliseconds. Placement weighs it against the cost of a remote run.
+  int64 local_queued_ms_;
+
+  Placement placement_;
+
+  // Where |placement_| is kept across builds, empty unless it is enabled.
+  base::FilePath placement_path_;
+
+  Speculator speculator_;
+
+  PchAffinity pch_affinity_;
+  base::RepeatingTimer<DNBuilder> speculation_timer_;
+
+  // NULL unless switches::kActionCacheDir is given.
+  scoped_refptr<common::ActionCache> action_cache_;
+
+  // Edges taken out of |plan_| whose cache lookup is in flight.
+  std::set<Edge*> looking_up_edges_;
+
+  // The fetches of remote results which wait for the local copy of their
+  // edge to exit, see FetchAfterLocalCopy(). The callback is null until the
+  // fetch is handed over.
+  std::map<Edge*, base::Closure> fetches_after_local_copy_;
+
+  // The input key of edges which missed |action_cache_|, their result is
+  // stored under it when they succeed.
+  std::map<Edge*, std::string> action_keys_;
+
+  // The commands evaluated for the |action_cache_| lookup of the edges which
+  // missed, so that they are not evaluated again to run, see TakeCommand().
+  std::map<Edge*, std::string> commands_;
 
   DISALLOW_COPY_AND_ASSIGN(DNBuilder);
 };
@@ -66,6 +66,7 @@ struct NinjaMain : public BuildLogUser {
 
   State& state() { return state_; }
   RealDiskInterface*  disk_interface() { return &disk_interface_; }
+  const std::string& build_dir() const { return build_dir_; }
 
   void GetAllEdges(std::set<Edge*>* edges);
 
@@ -0,0 +1,88 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/partitioner.h"
+
+#include <vector>
+
+#include "third_party/ninja/src/graph.h"
+
+namespace ninja {
+
+Partitioner::Partitioner() {
+}
+
+Partitioner::~Partitioner() {
+}
+
+void Partitioner::Compute(const std::set<Edge*>& edges) {
+  edges_ = edges;
+  partitions_.clear();
+
+  for (std::set<Edge*>::const_iterator it = edges_.begin();
+       it != edges_.end();
+       ++it) {
+    ComputePartition(*it);
+  }
+}
+
+Edge* Partitioner::GetPartition(Edge* edge) const {
+  EdgePartitionMap::const_iterator it = partitions_.find(edge);
+  return it != partitions_.end() ? it->second : NULL;
+}
+
+Edge* Partitioner::ComputePartition(Edge* edge) {
+  EdgePartitionMap::iterator it = partitions_.find(edge);
+  if (it != partitions_.end())
+    return it->second;
+
+  Edge* consumer = IsRoot(edge) ? NULL : GetSoleConsumer(edge);
+  Edge* partition = consumer != NULL ? ComputePartition(consumer) : edge;
+  partitions_[edge] = partition;
+  return partition;
+}
+
+bool Partitioner::IsRoot(Edge* edge) const {
+  int generated_inputs = 0;
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end() - edge->order_only_deps_;
+       ++i) {
+    Edge* in_edge = (*i)->in_edge();
+    if (in_edge == NULL || in_edge->is_phony() ||
+        edges_.find(in_edge) == edges_.end()) {
+      continue;
+    }
+    if (++generated_inputs > 1)
+      return true;
+  }
+  return false;
+}
+
+Edge* Partitioner::GetSoleConsumer(Edge* edge) const {
+  std::set<Edge*> consumers;
+  CollectConsumers(edge, &consumers);
+  return consumers.size() == 1 ? *consumers.begin() : NULL;
+}
+
+void Partitioner::CollectConsumers(Edge* edge,
+                                   std::set<Edge*>* consumers) const {
+  for (vector<Node*>::iterator out = edge->outputs_.begin();
+       out != edge->outputs_.end();
+       ++out) {
+    const vector<Edge*>& out_edges = (*out)->out_edges();
+    for (vector<Edge*>::const_iterator oe = out_edges.begin();
+         oe != out_edges.end();
+         ++oe) {
+      // More than one consumer is as good as many, stop walking.
+      if (consumers->size() > 1)
+        return;
+      if ((*oe)->is_phony())
+        CollectConsumers(*oe, consumers);
+      else if (edges_.find(*oe) != edges_.end())
+        consumers->insert(*oe);
+    }
+  }
+}
+
+}  // namespace ninja
@@ -0,0 +1,58 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_PARTITIONER_H_
+#define  NINJA_PARTITIONER_H_
+
+#include <map>
+#include <set>
+
+#include "base/basictypes.h"
+
+struct Edge;
+
+namespace ninja {
+
+// Partitioner splits the edges of a plan into subgraphs whose outputs are
+// mostly consumed inside the subgraph, so that running a whole subgraph on
+// one slave saves shipping the intermediate outputs around. A subgraph is
+// rooted at an edge which gathers several generated inputs, e.g. an archive
+// or a link, or whose outputs are used by more or less than one edge. Every
+// other edge belongs to the subgraph of its only consumer, thus the objects
+// of a static library end up with the archive which consumes them, while
+// the archives themselves are not merged into the link.
+class Partitioner {
+ public:
+  Partitioner();
+  ~Partitioner();
+
+  // Computes the partitions of |edges|.
+  void Compute(const std::set<Edge*>& edges);
+
+  // Returns the root edge of the partition of |edge|, or NULL if |edge| is
+  // unknown.
+  Edge* GetPartition(Edge* edge) const;
+
+ private:
+  Edge* ComputePartition(Edge* edge);
+
+  // Returns true if |edge| has at least two inputs built by the plan.
+  bool IsRoot(Edge* edge) const;
+
+  // Returns the only edge of the plan which reads the outputs of |edge|, or
+  // NULL if there is none or more than one. Phony edges are walked through.
+  Edge* GetSoleConsumer(Edge* edge) const;
+  void CollectConsumers(Edge* edge, std::set<Edge*>* consumers) const;
+
+  typedef std::map<Edge*, Edge*> EdgePartitionMap;
+  EdgePartitionMap partitions_;
+
+  std::set<Edge*> edges_;
+
+  DISALLOW_COPY_AND_ASSIGN(Partitioner);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_PARTITIONER_H_
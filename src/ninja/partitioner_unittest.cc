@@ -0,0 +1,89 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include <set>
+
+#include "ninja/partitioner.h"
+#include "ninja/test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const char kManifest[] =
+    "rule gen\n"
+    "  command = gen $in -o $out\n"
+    "rule cc\n"
+    "  command = cc $in -o $out\n"
+    "rule alink\n"
+    "  command = ar rcs $out $in\n"
+    "rule link\n"
+    "  command = link $in -o $out\n"
+    "build g.c: gen g.in\n"
+    "build g.o: cc g.c\n"
+    "build a.o: cc a.c\n"
+    "build liba.a: alink a.o g.o\n"
+    "build b.o: cc b.c\n"
+    "build c.o: cc c.c\n"
+    "build libb.a: alink b.o c.o\n"
+    "build config.h: gen config.in\n"
+    "build main.o: cc main.c || config.h\n"
+    "build test.o: cc test.c || config.h\n"
+    "build app: link main.o liba.a libb.a\n"
+    "build app_test: link test.o liba.a\n"
+    "build all: phony app app_test\n";
+
+}  // namespace
+
+namespace ninja {
+
+class PartitionerTest : public ManifestTest {
+ protected:
+  PartitionerTest() : ManifestTest(kManifest) {}
+};
+
+TEST_F(PartitionerTest, ObjectsJoinTheirArchive) {
+  Partitioner partitioner;
+  partitioner.Compute(edges_);
+
+  Edge* liba = GetEdge("liba.a");
+  EXPECT_EQ(liba, partitioner.GetPartition(liba));
+  EXPECT_EQ(liba, partitioner.GetPartition(GetEdge("a.o")));
+  EXPECT_EQ(liba, partitioner.GetPartition(GetEdge("g.o")));
+  EXPECT_EQ(liba, partitioner.GetPartition(GetEdge("g.c")));
+
+  Edge* libb = GetEdge("libb.a");
+  EXPECT_EQ(libb, partitioner.GetPartition(GetEdge("b.o")));
+  EXPECT_EQ(libb, partitioner.GetPartition(GetEdge("c.o")));
+}
+
+TEST_F(PartitionerTest, SharedOutputsStartPartitions) {
+  Partitioner partitioner;
+  partitioner.Compute(edges_);
+
+  // Archives are not merged into the links, and liba.a is used by both.
+  Edge* app = GetEdge("app");
+  EXPECT_EQ(app, partitioner.GetPartition(app));
+  EXPECT_EQ(app, partitioner.GetPartition(GetEdge("main.o")));
+  EXPECT_EQ(GetEdge("libb.a"), partitioner.GetPartition(GetEdge("libb.a")));
+  EXPECT_EQ(GetEdge("app_test"),
+            partitioner.GetPartition(GetEdge("test.o")));
+
+  // The header is read by two objects.
+  Edge* config = GetEdge("config.h");
+  EXPECT_EQ(config, partitioner.GetPartition(config));
+}
+
+TEST_F(PartitionerTest, EdgesOutsideOfPlan) {
+  // Only liba.a is out of date.
+  std::set<Edge*> edges;
+  edges.insert(GetEdge("a.o"));
+  edges.insert(GetEdge("liba.a"));
+  Partitioner partitioner;
+  partitioner.Compute(edges);
+
+  EXPECT_EQ(GetEdge("liba.a"), partitioner.GetPartition(GetEdge("a.o")));
+  EXPECT_TRUE(partitioner.GetPartition(GetEdge("g.o")) == NULL);
+}
+
+}  // namespace ninja
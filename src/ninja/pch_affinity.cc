@@ -0,0 +1,131 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/pch_affinity.h"
+
+#include <string>
+#include <vector>
+
+#include "base/strings/string_util.h"
+#include "ninja/critical_path.h"
+#include "third_party/ninja/src/graph.h"
+
+namespace ninja {
+
+PchAffinity::Pch::Pch() : remaining_work(0) {
+}
+
+PchAffinity::Pch::~Pch() {
+}
+
+PchAffinity::PchAffinity(const CriticalPath* critical_path)
+    : critical_path_(critical_path) {
+}
+
+PchAffinity::~PchAffinity() {
+}
+
+// static
+bool PchAffinity::IsPchPath(const std::string& path) {
+  return EndsWith(path, ".pch", false) || EndsWith(path, ".gch", false);
+}
+
+// static
+int PchAffinity::ComputeMaxCopies(int64 pch_cost, int64 remaining_work) {
+  if (pch_cost <= 0)
+    return kint32max;
+
+  int copies = 1;
+  while (static_cast<int64>(copies + 1) * copies <= remaining_work / pch_cost)
+    copies++;
+  return copies;
+}
+
+void PchAffinity::Compute(const std::set<Edge*>& edges) {
+  pchs_.clear();
+  dependents_.clear();
+
+  for (std::set<Edge*>::const_iterator it = edges.begin();
+       it != edges.end();
+       ++it) {
+    Edge* edge = *it;
+    if (edge->is_phony())
+      continue;
+    for (vector<Node*>::iterator out = edge->outputs_.begin();
+         out != edge->outputs_.end();
+         ++out) {
+      if (IsPchPath((*out)->path())) {
+        pchs_[edge];
+        break;
+      }
+    }
+  }
+  if (pchs_.empty())
+    return;
+
+  // The header is usually an implicit or order-only input of the compiles.
+  for (std::set<Edge*>::const_iterator it = edges.begin();
+       it != edges.end();
+       ++it) {
+    Edge* edge = *it;
+    if (edge->is_phony() || pchs_.find(edge) != pchs_.end())
+      continue;
+    for (vector<Node*>::iterator in = edge->inputs_.begin();
+         in != edge->inputs_.end();
+         ++in) {
+      PchMap::iterator pch = pchs_.find((*in)->in_edge());
+      if (pch == pchs_.end())
+        continue;
+      dependents_[edge] = pch->first;
+      pch->second.remaining_work +=
+          critical_path_->GetEstimatedDuration(edge);
+      break;
+    }
+  }
+}
+
+Edge* PchAffinity::GetPch(Edge* edge) const {
+  if (pchs_.find(edge) != pchs_.end())
+    return edge;
+  EdgePchMap::const_iterator it = dependents_.find(edge);
+  return it != dependents_.end() ? it->second : NULL;
+}
+
+void PchAffinity::EdgeStarted(Edge* edge, int slave) {
+  Edge* pch_edge = GetPch(edge);
+  if (pch_edge == NULL)
+    return;
+
+  Pch& pch = pchs_[pch_edge];
+  pch.holders.insert(slave);
+  // Backup copies and retries don't add to the parallelism, count the first
+  // start only.
+  EdgePchMap::iterator dependent = dependents_.find(edge);
+  if (dependent != dependents_.end()) {
+    pch.remaining_work -= critical_path_->GetEstimatedDuration(edge);
+    dependents_.erase(dependent);
+  }
+}
+
+void PchAffinity::SlaveLost(int slave) {
+  for (PchMap::iterator it = pchs_.begin(); it != pchs_.end(); ++it)
+    it->second.holders.erase(slave);
+}
+
+bool PchAffinity::IsHolder(Edge* pch, int slave) const {
+  PchMap::const_iterator it = pchs_.find(pch);
+  return it != pchs_.end() &&
+         it->second.holders.find(slave) != it->second.holders.end();
+}
+
+bool PchAffinity::CanAddHolder(Edge* pch) const {
+  PchMap::const_iterator it = pchs_.find(pch);
+  if (it == pchs_.end())
+    return true;
+  int max_copies = ComputeMaxCopies(critical_path_->GetEstimatedDuration(pch),
+                                    it->second.remaining_work);
+  return static_cast<int>(it->second.holders.size()) < max_copies;
+}
+
+}  // namespace ninja
@@ -0,0 +1,86 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_PCH_AFFINITY_H_
+#define  NINJA_PCH_AFFINITY_H_
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "base/basictypes.h"
+
+struct Edge;
+
+namespace ninja {
+
+class CriticalPath;
+
+// PchAffinity tracks the slaves which hold a precompiled header built by the
+// plan. A slave gets the header by running the edge which produces it, or by
+// running a compile which reads it, since the slave then builds or fetches
+// the header first. Every such copy costs about one build of the header, so
+// the compiles should go to slaves which hold it already, and a new slave is
+// only worth it while the compiles left can use the extra parallelism.
+class PchAffinity {
+ public:
+  explicit PchAffinity(const CriticalPath* critical_path);
+  ~PchAffinity();
+
+  // Returns true if |path| looks like a precompiled header, e.g. a .pch of
+  // MSVC or a .gch of GCC.
+  static bool IsPchPath(const std::string& path);
+
+  // Returns how many slaves should hold a header which takes |pch_cost| to
+  // build, while its compiles have |remaining_work| left in total. The k-th
+  // copy saves remaining_work / (k - 1) - remaining_work / k, so copies are
+  // added until that drops below |pch_cost|. At least one.
+  static int ComputeMaxCopies(int64 pch_cost, int64 remaining_work);
+
+  // Finds the edges of |edges| which produce a precompiled header, and the
+  // edges of |edges| which read one of them.
+  void Compute(const std::set<Edge*>& edges);
+
+  // Returns the edge producing the precompiled header read by |edge|, |edge|
+  // itself if it produces one, or NULL.
+  Edge* GetPch(Edge* edge) const;
+
+  // A copy of |edge| is started on |slave|.
+  void EdgeStarted(Edge* edge, int slave);
+
+  // |slave| is gone.
+  void SlaveLost(int slave);
+
+  // Returns true if |slave| holds the header of |pch|.
+  bool IsHolder(Edge* pch, int slave) const;
+
+  // Returns true if |pch| should be copied to one more slave.
+  bool CanAddHolder(Edge* pch) const;
+
+ private:
+  struct Pch {
+    Pch();
+    ~Pch();
+
+    std::set<int> holders;
+
+    // The estimated duration of the compiles which are not started yet.
+    int64 remaining_work;
+  };
+
+  typedef std::map<Edge*, Pch> PchMap;
+  PchMap pchs_;
+
+  // Maps a compile to the edge of the header it reads.
+  typedef std::map<Edge*, Edge*> EdgePchMap;
+  EdgePchMap dependents_;
+
+  const CriticalPath* critical_path_;
+
+  DISALLOW_COPY_AND_ASSIGN(PchAffinity);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_PCH_AFFINITY_H_
@@ -0,0 +1,94 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/critical_path.h"
+#include "ninja/pch_affinity.h"
+#include "ninja/test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const char kManifest[] =
+    "rule cc_pch\n"
+    "  command = cc -x c++-header $in -o $out\n"
+    "rule cc\n"
+    "  command = cc $in -o $out\n"
+    "rule link\n"
+    "  command = link $in -o $out\n"
+    "build precompile.h.gch: cc_pch precompile.h\n"
+    "build a.o: cc a.c | precompile.h.gch\n"
+    "build b.o: cc b.c | precompile.h.gch\n"
+    "build c.o: cc c.c\n"
+    "build app: link a.o b.o c.o\n";
+
+const int kSlave = 1;
+const int kAnotherSlave = 2;
+
+}  // namespace
+
+namespace ninja {
+
+class PchAffinityTest : public ManifestTest {
+ protected:
+  PchAffinityTest() : ManifestTest(kManifest) {}
+};
+
+TEST_F(PchAffinityTest, MaxCopies) {
+  EXPECT_EQ(1, PchAffinity::ComputeMaxCopies(100, 0));
+  EXPECT_EQ(1, PchAffinity::ComputeMaxCopies(100, 199));
+  EXPECT_EQ(2, PchAffinity::ComputeMaxCopies(100, 200));
+  EXPECT_EQ(3, PchAffinity::ComputeMaxCopies(100, 600));
+  EXPECT_EQ(10, PchAffinity::ComputeMaxCopies(10, 900));
+}
+
+TEST_F(PchAffinityTest, FindDependents) {
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, NULL);
+  PchAffinity pch_affinity(&critical_path);
+  pch_affinity.Compute(edges_);
+
+  Edge* pch = GetEdge("precompile.h.gch");
+  EXPECT_EQ(pch, pch_affinity.GetPch(pch));
+  EXPECT_EQ(pch, pch_affinity.GetPch(GetEdge("a.o")));
+  EXPECT_EQ(pch, pch_affinity.GetPch(GetEdge("b.o")));
+  EXPECT_TRUE(pch_affinity.GetPch(GetEdge("c.o")) == NULL);
+  EXPECT_TRUE(pch_affinity.GetPch(GetEdge("app")) == NULL);
+}
+
+TEST_F(PchAffinityTest, Holders) {
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, NULL);
+  PchAffinity pch_affinity(&critical_path);
+  pch_affinity.Compute(edges_);
+
+  // Both compiles take as long as the header, a second copy pays off.
+  Edge* pch = GetEdge("precompile.h.gch");
+  pch_affinity.EdgeStarted(pch, kSlave);
+  EXPECT_TRUE(pch_affinity.IsHolder(pch, kSlave));
+  EXPECT_FALSE(pch_affinity.IsHolder(pch, kAnotherSlave));
+  EXPECT_TRUE(pch_affinity.CanAddHolder(pch));
+
+  // With one compile left it doesn't.
+  pch_affinity.EdgeStarted(GetEdge("a.o"), kSlave);
+  EXPECT_FALSE(pch_affinity.CanAddHolder(pch));
+
+  pch_affinity.SlaveLost(kSlave);
+  EXPECT_FALSE(pch_affinity.IsHolder(pch, kSlave));
+  EXPECT_TRUE(pch_affinity.CanAddHolder(pch));
+}
+
+TEST_F(PchAffinityTest, ExpensiveHeader) {
+  build_log_.RecordCommand(GetEdge("precompile.h.gch"), 0, 1000);
+  build_log_.RecordCommand(GetEdge("a.o"), 0, 100);
+  CriticalPath critical_path;
+  critical_path.Compute(edges_, &build_log_);
+  PchAffinity pch_affinity(&critical_path);
+  pch_affinity.Compute(edges_);
+
+  Edge* pch = GetEdge("precompile.h.gch");
+  pch_affinity.EdgeStarted(pch, kSlave);
+  EXPECT_FALSE(pch_affinity.CanAddHolder(pch));
+}
+
+}  // namespace ninja
@@ -0,0 +1,189 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/placement.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "ninja/critical_path.h"
+#include "third_party/ninja/src/graph.h"
+
+namespace {
+
+// The weight of the latest remote run in the statistics of its rule.
+const double kSmoothingFactor = 0.25;
+
+}  // namespace
+
+namespace ninja {
+
+// static
+const int64 Placement::kDefaultOverheadMs = 100;
+
+// static
+const double Placement::kDefaultBytesPerSecond = 10 * 1024 * 1024;
+
+// static
+const double Placement::kMaxRemoteSlowdown = 2;
+
+// static
+const int Placement::kRemoteSampleInterval = 20;
+
+// static
+const char* const Placement::kLocalRules[] = {"stamp", "copy", "touch", NULL};
+
+Placement::RuleStats::RuleStats() : overhead_ms(0), output_bytes(0) {
+}
+
+Placement::Placement(const CriticalPath* critical_path)
+    : critical_path_(critical_path), ship_inputs_(false) {
+}
+
+Placement::~Placement() {
+}
+
+// static
+bool Placement::CanRunRemotely(Edge* edge) {
+  if (edge->GetBindingBool("generator"))
+    return false;
+
+  for (const char* const* rule = kLocalRules; *rule != NULL; ++rule) {
+    if (edge->rule().name() == *rule)
+      return false;
+  }
+  return true;
+}
+
+bool Placement::Load(const base::FilePath& path) {
+  std::string content;
+  if (!base::ReadFileToString(path, &content))
+    return false;
+
+  // Each line is "<overhead_ms> <output_bytes> <rule>".
+  std::vector<std::string> lines;
+  base::SplitString(content, '\n', &lines);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    size_t first = lines[i].find(' ');
+    if (first == std::string::npos)
+      continue;
+    size_t second = lines[i].find(' ', first + 1);
+    if (second == std::string::npos || second + 1 == lines[i].size())
+      continue;
+
+    int64 overhead_ms;
+    int64 output_bytes;
+    if (!base::StringToInt64(lines[i].substr(0, first), &overhead_ms) ||
+        !base::StringToInt64(lines[i].substr(first + 1, second - first - 1),
+                             &output_bytes)) {
+      continue;
+    }
+    RuleStats& stats = rule_stats_[lines[i].substr(second + 1)];
+    stats.overhead_ms = static_cast<double>(overhead_ms);
+    stats.output_bytes = static_cast<double>(output_bytes);
+  }
+  return true;
+}
+
+bool Placement::Save(const base::FilePath& path) const {
+  std::string content;
+  for (RuleStatsMap::const_iterator it = rule_stats_.begin();
+       it != rule_stats_.end();
+       ++it) {
+    int64 overhead_ms = static_cast<int64>(it->second.overhead_ms);
+    int64 output_bytes = static_cast<int64>(it->second.output_bytes);
+    content += base::Int64ToString(overhead_ms) + " " +
+               base::Int64ToString(output_bytes) + " " + it->first + "\n";
+  }
+
+  base::FilePath temp_path = path.AddExtension(FILE_PATH_LITERAL("tmp"));
+  return base::WriteFile(temp_path, content.data(), content.size()) ==
+             static_cast<int>(content.size()) &&
+         base::ReplaceFile(temp_path, path, NULL);
+}
+
+int64 Placement::GetLocalCost(Edge* edge) const {
+  return critical_path_->GetEstimatedDuration(edge);
+}
+
+int64 Placement::GetRemoteCost(Edge* edge, double bytes_per_second) const {
+  if (bytes_per_second <= 0)
+    bytes_per_second = kDefaultBytesPerSecond;
+
+  double bytes = GetBytesPerOutput(edge) * edge->outputs_.size();
+  if (ship_inputs_) {
+    for (vector<Node*>::iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end();
+         ++i) {
+      Edge* in_edge = (*i)->in_edge();
+      if (in_edge != NULL && !in_edge->is_phony())
+        bytes += GetBytesPerOutput(in_edge);
+    }
+  }
+
+  return GetLocalCost(edge) + static_cast<int64>(
+      GetOverheadMs(edge) + bytes * 1000 / bytes_per_second);
+}
+
+bool Placement::ShouldRunLocally(Edge* edge,
+                                 double bytes_per_second,
+                                 int64 local_wait_ms) {
+  if (!CanRunRemotely(edge))
+    return true;
+
+  if (GetRemoteCost(edge, bytes_per_second) <=
+      GetLocalCost(edge) * kMaxRemoteSlowdown + local_wait_ms) {
+    return false;
+  }
+  return ++local_counts_[edge->rule().name()] % kRemoteSampleInterval != 0;
+}
+
+void Placement::RecordRemoteRun(Edge* edge,
+                                base::TimeDelta elapsed,
+                                int64 output_bytes) {
+  if (edge->outputs_.empty())
+    return;
+
+  double overhead_ms = std::max(
+      elapsed.InMillisecondsF() - critical_path_->GetEstimatedDuration(edge),
+      0.0);
+  double bytes_per_output =
+      static_cast<double>(output_bytes) / edge->outputs_.size();
+
+  RuleStatsMap::iterator it = rule_stats_.find(edge->rule().name());
+  if (it == rule_stats_.end()) {
+    RuleStats& stats = rule_stats_[edge->rule().name()];
+    stats.overhead_ms = overhead_ms;
+    stats.output_bytes = bytes_per_output;
+    return;
+  }
+  it->second.overhead_ms +=
+      kSmoothingFactor * (overhead_ms - it->second.overhead_ms);
+  it->second.output_bytes +=
+      kSmoothingFactor * (bytes_per_output - it->second.output_bytes);
+}
+
+double Placement::GetBytesPerOutput(Edge* edge) const {
+  RuleStatsMap::const_iterator it = rule_stats_.find(edge->rule().name());
+  return it != rule_stats_.end() ? it->second.output_bytes : 0;
+}
+
+double Placement::GetOverheadMs(Edge* edge) const {
+  RuleStatsMap::const_iterator it = rule_stats_.find(edge->rule().name());
+  if (it != rule_stats_.end())
+    return it->second.overhead_ms;
+  if (rule_stats_.empty())
+    return static_cast<double>(kDefaultOverheadMs);
+
+  // The mean of the other rules.
+  double total = 0;
+  for (it = rule_stats_.begin(); it != rule_stats_.end(); ++it)
+    total += it->second.overhead_ms;
+  return total / rule_stats_.size();
+}
+
+}  // namespace ninja
@@ -0,0 +1,115 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_PLACEMENT_H_
+#define  NINJA_PLACEMENT_H_
+
+#include <map>
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/files/file_path.h"
+#include "base/time/time.h"
+
+struct Edge;
+
+namespace ninja {
+
+class CriticalPath;
+
+// Placement decides whether a ready edge is worth sending to a slave. Running
+// an edge here costs its duration, see CriticalPath. Running it remotely
+// costs its duration plus the overhead of the dispatch, i.e. the RPCs and the
+// hashing on the slave, plus the transfer of its outputs, and of its
+// generated inputs if they are shipped, over the link to the slaves. The
+// overhead and the output size are learned per rule from remote runs and kept
+// across builds in a small file of the build directory. The time an edge
+// waits on a busy slave is not part of the overhead, it passes with the load.
+//
+// An edge which would take more than kMaxRemoteSlowdown times as long
+// remotely, plus the wait for the work already queued here, e.g. a stamp, or a link whose output is huge, stays here. Edges
+// of the rules in kLocalRules stay here too, they only touch the file
+// system. One in kRemoteSampleInterval edges of a rule which stays here runs
+// remotely anyway, so that the statistics of the rule keep up, e.g. with a
+// faster link.
+class Placement {
+ public:
+  // The dispatch overhead of a rule which has never run remotely, when no
+  // other rule has either.
+  static const int64 kDefaultOverheadMs;
+
+  // The throughput of the link to the slaves while it is unknown.
+  static const double kDefaultBytesPerSecond;
+
+  static const double kMaxRemoteSlowdown;
+
+  static const int kRemoteSampleInterval;
+
+  // NULL terminated.
+  static const char* const kLocalRules[];
+
+  explicit Placement(const CriticalPath* critical_path);
+  ~Placement();
+
+  // Returns false for edges which only the master may run, i.e. the generator
+  // edge which rebuilds the manifest, and the edges of kLocalRules.
+  static bool CanRunRemotely(Edge* edge);
+
+  void set_ship_inputs(bool ship_inputs) { ship_inputs_ = ship_inputs; }
+
+  // Loads the rule statistics written by Save() in an earlier build. Returns
+  // false if there are none.
+  bool Load(const base::FilePath& path);
+  bool Save(const base::FilePath& path) const;
+
+  // Returns the estimated cost of |edge| in milliseconds, here or on a slave
+  // whose link has a throughput of |bytes_per_second|. The throughput is
+  // kDefaultBytesPerSecond if it is not positive.
+  int64 GetLocalCost(Edge* edge) const;
+  int64 GetRemoteCost(Edge* edge, double bytes_per_second) const;
+
+  // Returns true if |edge| should not be sent to a slave. |local_wait_ms| is
+  // how long an edge queued here waits before it runs, i.e. the work queued
+  // here divided by the parallelism. It is asked once per ready edge, since
+  // it samples the edges which stay here.
+  bool ShouldRunLocally(Edge* edge,
+                        double bytes_per_second,
+                        int64 local_wait_ms);
+
+  // The first result of |edge| arrived |elapsed| after it has been sent to a
+  // slave, not counting its wait there, with outputs of |output_bytes| in
+  // total.
+  void RecordRemoteRun(Edge* edge, base::TimeDelta elapsed, int64 output_bytes);
+
+ private:
+  struct RuleStats {
+    RuleStats();
+
+    // Smoothed, the size is per output.
+    double overhead_ms;
+    double output_bytes;
+  };
+
+  // Returns the estimated size of an output of |edge|, zero if unknown so
+  // that the edge is tried remotely and learned.
+  double GetBytesPerOutput(Edge* edge) const;
+
+  double GetOverheadMs(Edge* edge) const;
+
+  const CriticalPath* critical_path_;
+  bool ship_inputs_;
+
+  typedef std::map<std::string, RuleStats> RuleStatsMap;
+  RuleStatsMap rule_stats_;
+
+  // The number of edges of each rule kept here because of their cost, see
+  // kRemoteSampleInterval. Not saved.
+  std::map<std::string, int> local_counts_;
+
+  DISALLOW_COPY_AND_ASSIGN(Placement);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_PLACEMENT_H_
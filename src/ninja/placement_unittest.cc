@@ -0,0 +1,137 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "base/files/scoped_temp_dir.h"
+#include "ninja/critical_path.h"
+#include "ninja/placement.h"
+#include "ninja/test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const char kManifest[] =
+    "rule cc\n"
+    "  command = cc $in -o $out\n"
+    "rule link\n"
+    "  command = link $in -o $out\n"
+    "rule stamp\n"
+    "  command = touch $out\n"
+    "build a.o: cc a.c\n"
+    "build app: link a.o\n"
+    "build app.stamp: stamp app\n";
+
+const int64 kMB = 1024 * 1024;
+const double kSlowLink = 10 * kMB;
+const double kFastLink = 1000 * kMB;
+
+}  // namespace
+
+namespace ninja {
+
+class PlacementTest : public ManifestTest {
+ protected:
+  PlacementTest() : ManifestTest(kManifest) {}
+
+  void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(ManifestTest::SetUp());
+    build_log_.RecordCommand(GetEdge("a.o"), 0, 1000);
+    build_log_.RecordCommand(GetEdge("app"), 0, 1000);
+    build_log_.RecordCommand(GetEdge("app.stamp"), 0, 1);
+    critical_path_.Compute(edges_, &build_log_);
+  }
+
+  CriticalPath critical_path_;
+};
+
+TEST_F(PlacementTest, NoHistory) {
+  Placement placement(&critical_path_);
+  EXPECT_EQ(1000 + Placement::kDefaultOverheadMs,
+            placement.GetRemoteCost(GetEdge("a.o"), 0));
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("a.o"), 0, 0));
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("app"), 0, 0));
+
+  // Even before it is known to be cheap.
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app.stamp"), kFastLink, 0));
+}
+
+TEST_F(PlacementTest, HugeOutputs) {
+  Placement placement(&critical_path_);
+  placement.RecordRemoteRun(GetEdge("app"),
+                            base::TimeDelta::FromMilliseconds(1500),
+                            100 * kMB);
+
+  // 500ms of overhead, plus 10s to fetch the output.
+  EXPECT_EQ(11500, placement.GetRemoteCost(GetEdge("app"), kSlowLink));
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("app"), kFastLink, 0));
+
+  // Other rules get the overhead of the known ones.
+  EXPECT_EQ(1500, placement.GetRemoteCost(GetEdge("a.o"), kSlowLink));
+}
+
+TEST_F(PlacementTest, ShippedInputs) {
+  Placement placement(&critical_path_);
+  placement.RecordRemoteRun(GetEdge("a.o"),
+                            base::TimeDelta::FromMilliseconds(1000),
+                            20 * kMB);
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+
+  placement.set_ship_inputs(true);
+  EXPECT_EQ(3000, placement.GetRemoteCost(GetEdge("app"), kSlowLink));
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+}
+
+TEST_F(PlacementTest, LocalBacklog) {
+  Placement placement(&critical_path_);
+  placement.RecordRemoteRun(GetEdge("app"),
+                            base::TimeDelta::FromMilliseconds(1500),
+                            100 * kMB);
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 5000));
+
+  // 11500ms remotely is no worse than 1000ms here after a wait of 10s, given
+  // kMaxRemoteSlowdown.
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 10000));
+
+  // The edges which only touch the file system stay here anyway.
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app.stamp"), kSlowLink,
+                                         10000));
+}
+
+TEST_F(PlacementTest, SampleLocalEdges) {
+  Placement placement(&critical_path_);
+  placement.RecordRemoteRun(GetEdge("app"),
+                            base::TimeDelta::FromMilliseconds(1500),
+                            100 * kMB);
+
+  // The stats of the rule are refreshed now and then.
+  for (int i = 1; i < Placement::kRemoteSampleInterval; ++i)
+    EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+  EXPECT_FALSE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+  EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+
+  // Not the edges which only touch the file system.
+  for (int i = 0; i < Placement::kRemoteSampleInterval; ++i)
+    EXPECT_TRUE(placement.ShouldRunLocally(GetEdge("app.stamp"), kSlowLink, 0));
+}
+
+TEST_F(PlacementTest, SaveAndLoad) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath path = temp_dir.path().AppendASCII("placement");
+
+  Placement placement(&critical_path_);
+  EXPECT_FALSE(placement.Load(path));
+  placement.RecordRemoteRun(GetEdge("app"),
+                            base::TimeDelta::FromMilliseconds(1500),
+                            100 * kMB);
+  ASSERT_TRUE(placement.Save(path));
+
+  Placement loaded(&critical_path_);
+  ASSERT_TRUE(loaded.Load(path));
+  EXPECT_EQ(placement.GetRemoteCost(GetEdge("app"), kSlowLink),
+            loaded.GetRemoteCost(GetEdge("app"), kSlowLink));
+  EXPECT_TRUE(loaded.ShouldRunLocally(GetEdge("app"), kSlowLink, 0));
+}
+
+}  // namespace ninja
@@ -0,0 +1,267 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/speculator.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "base/logging.h"
+#include "ninja/critical_path.h"
+
+namespace {
+
+// Weight of the newest sample in the moving average of executor slowness.
+const double kSlownessSampleWeight = 0.2;
+
+}  // namespace
+
+namespace ninja {
+
+// static
+const int Speculator::kLocalExecutor = -1;
+const double Speculator::kLateFactor = 1.5;
+const int64 Speculator::kMinLatenessMs = 5000;
+const size_t Speculator::kMaxCopies = 2;
+
+Speculator::EdgeCopies::EdgeCopies()
+    : claimed(false),
+      winner(kLocalExecutor) {
+}
+
+Speculator::Speculator(const CriticalPath* critical_path)
+    : critical_path_(critical_path), last_attempt_(0) {
+}
+
+Speculator::~Speculator() {
+}
+
+uint32 Speculator::EdgeStarted(Edge* edge,
+                               int executor,
+                               base::TimeTicks now) {
+  EdgeCopies& edge_copies = outstanding_edges_[edge];
+  DCHECK(edge_copies.copies.find(executor) == edge_copies.copies.end());
+  EdgeCopies::Copy& copy = edge_copies.copies[executor];
+  copy.start_time = now;
+  copy.run_time = executor == kLocalExecutor ? now : base::TimeTicks();
+  copy.attempt = ++last_attempt_;
+  return last_attempt_;
+}
+
+void Speculator::CopyRunning(Edge* edge,
+                             int executor,
+                             uint32 attempt,
+                             base::TimeDelta wait_time) {
+  EdgeCopiesMap::iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return;
+  EdgeCopies::CopyMap::iterator copy = it->second.copies.find(executor);
+  if (copy == it->second.copies.end() || copy->second.attempt != attempt)
+    return;
+  copy->second.run_time = copy->second.start_time + wait_time;
+}
+
+bool Speculator::IsCurrentAttempt(Edge* edge,
+                                  int executor,
+                                  uint32 attempt) const {
+  EdgeCopiesMap::const_iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return false;
+  EdgeCopies::CopyMap::const_iterator copy = it->second.copies.find(executor);
+  return copy != it->second.copies.end() && copy->second.attempt == attempt;
+}
+
+void Speculator::SetLocalOnly(Edge* edge) {
+  local_only_edges_.insert(edge);
+}
+
+bool Speculator::CanRunOn(Edge* edge, int executor) const {
+  if (IsRunningOn(edge, executor))
+    return false;
+  return executor == kLocalExecutor ||
+         local_only_edges_.find(edge) == local_only_edges_.end();
+}
+
+bool Speculator::IsOutstanding(Edge* edge) const {
+  return outstanding_edges_.find(edge) != outstanding_edges_.end();
+}
+
+bool Speculator::IsRunningOn(Edge* edge, int executor) const {
+  EdgeCopiesMap::const_iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return false;
+  return it->second.copies.find(executor) != it->second.copies.end();
+}
+
+bool Speculator::IsRunningElsewhere(Edge* edge, int executor) const {
+  EdgeCopiesMap::const_iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return false;
+  for (EdgeCopies::CopyMap::const_iterator copy = it->second.copies.begin();
+       copy != it->second.copies.end();
+       ++copy) {
+    if (copy->first != executor)
+      return true;
+  }
+  return false;
+}
+
+bool Speculator::GetStartTime(Edge* edge,
+                              int executor,
+                              base::TimeTicks* start) const {
+  EdgeCopiesMap::const_iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return false;
+  EdgeCopies::CopyMap::const_iterator copy = it->second.copies.find(executor);
+  if (copy == it->second.copies.end())
+    return false;
+  *start = copy->second.start_time;
+  return true;
+}
+
+bool Speculator::ClaimResult(Edge* edge, int executor, base::TimeTicks now) {
+  EdgeCopiesMap::iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end() || it->second.claimed)
+    return false;
+
+  EdgeCopies::CopyMap::iterator copy = it->second.copies.find(executor);
+  if (copy == it->second.copies.end())
+    return false;
+
+  it->second.claimed = true;
+  it->second.winner = executor;
+
+  int64 expected = critical_path_->GetEstimatedDuration(edge);
+  if (expected > 0) {
+    base::TimeTicks run_time = copy->second.run_time.is_null() ?
+                                   copy->second.start_time :
+                                   copy->second.run_time;
+    double ratio =
+        (now - run_time).InMillisecondsF() / static_cast<double>(expected);
+    SlownessMap::iterator slowness = slowness_.find(executor);
+    if (slowness == slowness_.end()) {
+      slowness_[executor] = ratio;
+    } else {
+      slowness->second = (1 - kSlownessSampleWeight) * slowness->second +
+                         kSlownessSampleWeight * ratio;
+    }
+  }
+
+  return true;
+}
+
+void Speculator::EdgeFinished(Edge* edge, std::vector<int>* losers) {
+  // The edge is gone if CancelAll() has been called in the meantime.
+  EdgeCopiesMap::iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return;
+
+  DCHECK(it->second.claimed);
+  for (EdgeCopies::CopyMap::iterator copy = it->second.copies.begin();
+       copy != it->second.copies.end();
+       ++copy) {
+    if (copy->first != it->second.winner)
+      losers->push_back(copy->first);
+  }
+  outstanding_edges_.erase(it);
+  local_only_edges_.erase(edge);
+}
+
+bool Speculator::CopyFailed(Edge* edge, int executor) {
+  EdgeCopiesMap::iterator it = outstanding_edges_.find(edge);
+  if (it == outstanding_edges_.end())
+    return false;
+
+  // The edge is kept outstanding even if there is no copy left, it is still
+  // started from the point of view of the build status.
+  if (it->second.copies.erase(executor) == 0)
+    return false;
+  if (it->second.claimed && it->second.winner == executor)
+    it->second.claimed = false;
+  return it->second.copies.empty();
+}
+
+void Speculator::ExecutorLost(int executor, std::vector<Edge*>* orphans) {
+  for (EdgeCopiesMap::iterator it = outstanding_edges_.begin();
+       it != outstanding_edges_.end();
+       ++it) {
+    // The fetch of a claimed copy reports on its own, whether it succeeds or
+    // not.
+    if (it->second.claimed && it->second.winner == executor)
+      continue;
+    if (it->second.copies.erase(executor) > 0 && it->second.copies.empty())
+      orphans->push_back(it->first);
+  }
+}
+
+void Speculator::CancelAll(CopyVector* copies) {
+  for (EdgeCopiesMap::iterator it = outstanding_edges_.begin();
+       it != outstanding_edges_.end();
+       ++it) {
+    for (EdgeCopies::CopyMap::iterator copy = it->second.copies.begin();
+         copy != it->second.copies.end();
+         ++copy) {
+      // The claimed copy has exited already.
+      if (it->second.claimed && copy->first == it->second.winner)
+        continue;
+      copies->push_back(std::make_pair(it->first, copy->first));
+    }
+  }
+  outstanding_edges_.clear();
+  local_only_edges_.clear();
+}
+
+void Speculator::GetLateEdges(base::TimeTicks now,
+                              std::vector<Edge*>* edges) const {
+  std::vector<std::pair<int64, Edge*> > late_edges;
+  for (EdgeCopiesMap::const_iterator it = outstanding_edges_.begin();
+       it != outstanding_edges_.end();
+       ++it) {
+    const EdgeCopies& edge_copies = it->second;
+    if (edge_copies.claimed || edge_copies.copies.empty() ||
+        edge_copies.copies.size() >= kMaxCopies) {
+      continue;
+    }
+    // The master is the only executor of a local only edge.
+    if (local_only_edges_.find(it->first) != local_only_edges_.end() &&
+        edge_copies.copies.find(kLocalExecutor) != edge_copies.copies.end()) {
+      continue;
+    }
+
+    // Lateness is measured from the earliest copy whose command runs, the
+    // wait on a busy slave is left to work stealing.
+    base::TimeTicks run_time;
+    for (EdgeCopies::CopyMap::const_iterator copy =
+             edge_copies.copies.begin();
+         copy != edge_copies.copies.end();
+         ++copy) {
+      if (!copy->second.run_time.is_null() &&
+          (run_time.is_null() || copy->second.run_time < run_time)) {
+        run_time = copy->second.run_time;
+      }
+    }
+    if (run_time.is_null())
+      continue;
+
+    int64 expected = critical_path_->GetEstimatedDuration(it->first);
+    if ((now - run_time).InMilliseconds() >
+        expected * kLateFactor + kMinLatenessMs) {
+      late_edges.push_back(
+          std::make_pair(critical_path_->GetPriority(it->first), it->first));
+    }
+  }
+
+  std::sort(late_edges.begin(), late_edges.end(),
+            std::greater<std::pair<int64, Edge*> >());
+  for (size_t i = 0; i < late_edges.size(); ++i)
+    edges->push_back(late_edges[i].second);
+}
+
+double Speculator::GetSlowness(int executor) const {
+  SlownessMap::const_iterator it = slowness_.find(executor);
+  return it != slowness_.end() ? it->second : 1.0;
+}
+
+}  // namespace ninja
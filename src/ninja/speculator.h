@@ -0,0 +1,153 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_SPECULATOR_H_
+#define  NINJA_SPECULATOR_H_
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/time/time.h"
+
+struct Edge;
+
+namespace ninja {
+
+class CriticalPath;
+
+// Speculator tracks every copy of every started edge, so that a backup copy
+// of a straggler can be started on another executor, i.e. the master itself
+// or a slave. The first successful result that reaches the MAIN thread wins,
+// results of the other copies are discarded.
+class Speculator {
+ public:
+  // Executor id of the master itself, slaves use their connection id.
+  static const int kLocalExecutor;
+
+  // An edge is late once it has run longer than
+  //   expected duration * kLateFactor + kMinLatenessMs.
+  static const double kLateFactor;
+  static const int64 kMinLatenessMs;
+
+  // The maximum amount of copies of an edge running at the same time.
+  static const size_t kMaxCopies;
+
+  explicit Speculator(const CriticalPath* critical_path);
+  ~Speculator();
+
+  // A copy of |edge| is started on |executor| at |now|. Returns the attempt id
+  // of the copy, which tells its results from those of an earlier copy on the
+  // same executor, e.g. one which has been stolen or canceled.
+  uint32 EdgeStarted(Edge* edge, int executor, base::TimeTicks now);
+
+  // The copy |attempt| of |edge| on |executor|, a slave, started to run its
+  // command after waiting |wait_time| there. A remote copy is not late before
+  // its command runs, copies on the master run at once.
+  void CopyRunning(Edge* edge,
+                   int executor,
+                   uint32 attempt,
+                   base::TimeDelta wait_time);
+
+  // Returns true if the copy of |edge| on |executor| is |attempt|. Results of
+  // other attempts are stale and must be dropped.
+  bool IsCurrentAttempt(Edge* edge, int executor, uint32 attempt) const;
+
+  // |edge| may only run on the master, e.g. it is the generator edge, or it
+  // failed remotely. Its backup copies stay on the master as well, until it
+  // finishes.
+  void SetLocalOnly(Edge* edge);
+
+  // Returns true if a copy of |edge| may be started on |executor|, i.e. none
+  // runs there yet and |edge| is not kept on the master.
+  bool CanRunOn(Edge* edge, int executor) const;
+
+  // Returns true if |edge| has been started and is not finished yet.
+  bool IsOutstanding(Edge* edge) const;
+  bool IsRunningOn(Edge* edge, int executor) const;
+
+  // Returns true if a copy of |edge| runs on another executor than
+  // |executor|.
+  bool IsRunningElsewhere(Edge* edge, int executor) const;
+
+  // Sets |start| to the start time of the copy of |edge| on |executor|.
+  // Returns false if there is no such copy.
+  bool GetStartTime(Edge* edge, int executor, base::TimeTicks* start) const;
+
+  // The copy of |edge| on |executor| succeeded at |now|. Returns true if it is
+  // the first result of |edge|, which must then be followed by EdgeFinished()
+  // or CopyFailed(). Returns false if the result should be discarded.
+  bool ClaimResult(Edge* edge, int executor, base::TimeTicks now);
+
+  // The claimed result of |edge| has been applied. Fills |losers| with the
+  // executors which still run a useless copy of |edge|, they should be
+  // canceled.
+  void EdgeFinished(Edge* edge, std::vector<int>* losers);
+
+  // The copy of |edge| on |executor| failed, or its outputs could not be
+  // fetched. Returns true if no other copy of |edge| is running, in that case
+  // the caller has to start it again. Returns false if there is no such copy,
+  // e.g. it has been stolen or canceled already.
+  bool CopyFailed(Edge* edge, int executor);
+
+  // |executor| is gone, e.g. the connection of the slave closed. Forgets its
+  // copies, except a claimed one whose outputs are being fetched, and fills
+  // |orphans| with the edges which have no copy left and must be started
+  // again.
+  void ExecutorLost(int executor, std::vector<Edge*>* orphans);
+
+  // Forgets every outstanding edge, e.g. when the build fails. Fills |copies|
+  // with the edge and executor of every copy which is still running.
+  typedef std::vector<std::pair<Edge*, int> > CopyVector;
+  void CancelAll(CopyVector* copies);
+
+  // Fills |edges| with late edges which can get a backup copy, ordered by
+  // descending critical path priority.
+  void GetLateEdges(base::TimeTicks now, std::vector<Edge*>* edges) const;
+
+  // Returns the mean ratio of actual to expected duration of the results
+  // won by |executor|. Lower is faster, 1.0 if unknown.
+  double GetSlowness(int executor) const;
+
+ private:
+  struct EdgeCopies {
+    EdgeCopies();
+
+    // When the copy has been started, and when its command started to run,
+    // null until it does.
+    struct Copy {
+      base::TimeTicks start_time;
+      base::TimeTicks run_time;
+      uint32 attempt;
+    };
+
+    // Map the executor id to the copy.
+    typedef std::map<int, Copy> CopyMap;
+    CopyMap copies;
+
+    // Whether a result of the edge has been claimed, by |winner|.
+    bool claimed;
+    int winner;
+  };
+
+  const CriticalPath* critical_path_;
+
+  typedef std::map<Edge*, EdgeCopies> EdgeCopiesMap;
+  EdgeCopiesMap outstanding_edges_;
+
+  std::set<Edge*> local_only_edges_;
+
+  typedef std::map<int, double> SlownessMap;
+  SlownessMap slowness_;
+
+  uint32 last_attempt_;
+
+  DISALLOW_COPY_AND_ASSIGN(Speculator);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_SPECULATOR_H_
@@ -0,0 +1,250 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include <vector>
+
+#include "ninja/critical_path.h"
+#include "ninja/placement.h"
+#include "ninja/speculator.h"
+#include "ninja/test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const char kManifest[] =
+    "rule cc\n"
+    "  command = cc $in -o $out\n"
+    "build a.o: cc a.c\n"
+    "build b.o: cc b.c\n"
+    "rule regen\n"
+    "  command = gen\n"
+    "  generator = 1\n"
+    "build build.ninja: regen build.gen\n";
+
+const int kSlave = 1;
+const int kAnotherSlave = 2;
+
+}  // namespace
+
+namespace ninja {
+
+class SpeculatorTest : public ManifestTest {
+ protected:
+  SpeculatorTest() : ManifestTest(kManifest), speculator_(&critical_path_) {}
+
+  void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(ManifestTest::SetUp());
+    a_ = GetEdge("a.o");
+    b_ = GetEdge("b.o");
+    generator_ = GetEdge("build.ninja");
+
+    build_log_.RecordCommand(a_, 0, 1000);
+    build_log_.RecordCommand(b_, 0, 1000);
+    build_log_.RecordCommand(generator_, 0, 1000);
+    critical_path_.Compute(edges_, &build_log_);
+  }
+
+  base::TimeTicks After(int64 milliseconds) {
+    return start_ + base::TimeDelta::FromMilliseconds(milliseconds);
+  }
+
+  CriticalPath critical_path_;
+  Speculator speculator_;
+  base::TimeTicks start_;
+  Edge* a_;
+  Edge* b_;
+  Edge* generator_;
+};
+
+TEST_F(SpeculatorTest, FirstResultWins) {
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  speculator_.EdgeStarted(a_, Speculator::kLocalExecutor, After(100));
+  EXPECT_TRUE(speculator_.IsRunningOn(a_, kSlave));
+  EXPECT_FALSE(speculator_.IsRunningOn(a_, kAnotherSlave));
+  EXPECT_TRUE(speculator_.IsRunningElsewhere(a_, kSlave));
+  EXPECT_FALSE(speculator_.IsRunningElsewhere(b_, kSlave));
+
+  EXPECT_TRUE(speculator_.ClaimResult(a_, Speculator::kLocalExecutor,
+                                      After(1100)));
+  EXPECT_FALSE(speculator_.ClaimResult(a_, kSlave, After(1200)));
+
+  std::vector<int> losers;
+  speculator_.EdgeFinished(a_, &losers);
+  ASSERT_EQ(1u, losers.size());
+  EXPECT_EQ(kSlave, losers[0]);
+  EXPECT_FALSE(speculator_.IsOutstanding(a_));
+
+  // Late results of a finished edge are discarded too.
+  EXPECT_FALSE(speculator_.ClaimResult(a_, kSlave, After(1300)));
+}
+
+TEST_F(SpeculatorTest, StartTime) {
+  speculator_.EdgeStarted(a_, kSlave, After(1000));
+
+  base::TimeTicks start;
+  EXPECT_FALSE(speculator_.GetStartTime(a_, kAnotherSlave, &start));
+  EXPECT_FALSE(speculator_.GetStartTime(b_, kSlave, &start));
+  ASSERT_TRUE(speculator_.GetStartTime(a_, kSlave, &start));
+  EXPECT_EQ(After(1000), start);
+}
+
+TEST_F(SpeculatorTest, LateEdges) {
+  speculator_.EdgeStarted(a_, Speculator::kLocalExecutor, After(0));
+  uint32 attempt = speculator_.EdgeStarted(b_, kSlave, After(3000));
+  speculator_.CopyRunning(b_, kSlave, attempt, base::TimeDelta());
+
+  // 1000 * kLateFactor + kMinLatenessMs = 6500.
+  std::vector<Edge*> late_edges;
+  speculator_.GetLateEdges(After(6000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  ASSERT_EQ(1u, late_edges.size());
+  EXPECT_EQ(a_, late_edges[0]);
+
+  // An edge which already has a backup copy is not late anymore.
+  speculator_.EdgeStarted(a_, kAnotherSlave, After(7000));
+  late_edges.clear();
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+}
+
+TEST_F(SpeculatorTest, LatenessFromRunTime) {
+  uint32 attempt = speculator_.EdgeStarted(a_, kSlave, After(0));
+
+  // The command waits on the slave, it is not late.
+  std::vector<Edge*> late_edges;
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+
+  // Results of other attempts are ignored.
+  speculator_.CopyRunning(a_, kSlave, attempt + 1, base::TimeDelta());
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+
+  speculator_.CopyRunning(a_, kSlave, attempt,
+                          base::TimeDelta::FromMilliseconds(3000));
+  speculator_.GetLateEdges(After(9000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+  speculator_.GetLateEdges(After(10000), &late_edges);
+  ASSERT_EQ(1u, late_edges.size());
+  EXPECT_EQ(a_, late_edges[0]);
+
+  // The slowness of the slave does not include the wait either.
+  EXPECT_TRUE(speculator_.ClaimResult(a_, kSlave, After(5000)));
+  EXPECT_DOUBLE_EQ(2.0, speculator_.GetSlowness(kSlave));
+}
+
+TEST_F(SpeculatorTest, LocalOnlyEdges) {
+  ASSERT_FALSE(Placement::CanRunRemotely(generator_));
+  speculator_.SetLocalOnly(generator_);
+  EXPECT_TRUE(speculator_.CanRunOn(generator_, Speculator::kLocalExecutor));
+  EXPECT_FALSE(speculator_.CanRunOn(generator_, kSlave));
+  EXPECT_TRUE(speculator_.CanRunOn(a_, kSlave));
+
+  // The master already runs the only copy a local only edge may have.
+  speculator_.EdgeStarted(generator_, Speculator::kLocalExecutor, After(0));
+  EXPECT_FALSE(speculator_.CanRunOn(generator_, Speculator::kLocalExecutor));
+  std::vector<Edge*> late_edges;
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+
+  // An edge failed remotely and queued on the master gets no remote backup.
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  EXPECT_TRUE(speculator_.CopyFailed(a_, kSlave));
+  speculator_.SetLocalOnly(a_);
+  speculator_.EdgeStarted(a_, Speculator::kLocalExecutor, After(100));
+  EXPECT_FALSE(speculator_.CanRunOn(a_, kAnotherSlave));
+  speculator_.GetLateEdges(After(7000), &late_edges);
+  EXPECT_TRUE(late_edges.empty());
+
+  // It may run remotely again once it is finished, e.g. if its outputs are
+  // lost later.
+  ASSERT_TRUE(speculator_.ClaimResult(a_, Speculator::kLocalExecutor,
+                                      After(1100)));
+  std::vector<int> losers;
+  speculator_.EdgeFinished(a_, &losers);
+  EXPECT_TRUE(speculator_.CanRunOn(a_, kSlave));
+}
+
+TEST_F(SpeculatorTest, CopyFailed) {
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  speculator_.EdgeStarted(a_, kAnotherSlave, After(0));
+
+  EXPECT_TRUE(speculator_.ClaimResult(a_, kSlave, After(1000)));
+  EXPECT_FALSE(speculator_.CopyFailed(a_, kSlave));
+  EXPECT_FALSE(speculator_.IsRunningElsewhere(a_, kAnotherSlave));
+  EXPECT_TRUE(speculator_.CopyFailed(a_, kAnotherSlave));
+  EXPECT_FALSE(speculator_.CopyFailed(a_, kAnotherSlave));
+
+  // Still outstanding, it has to be started again.
+  EXPECT_TRUE(speculator_.IsOutstanding(a_));
+  speculator_.EdgeStarted(a_, Speculator::kLocalExecutor, After(2000));
+  EXPECT_TRUE(speculator_.ClaimResult(a_, Speculator::kLocalExecutor,
+                                      After(3000)));
+}
+
+TEST_F(SpeculatorTest, Attempts) {
+  uint32 stolen = speculator_.EdgeStarted(a_, kSlave, After(0));
+  EXPECT_TRUE(speculator_.IsCurrentAttempt(a_, kSlave, stolen));
+  EXPECT_FALSE(speculator_.IsCurrentAttempt(a_, kAnotherSlave, stolen));
+  EXPECT_TRUE(speculator_.CopyFailed(a_, kSlave));
+  EXPECT_FALSE(speculator_.IsCurrentAttempt(a_, kSlave, stolen));
+
+  // The edge goes back to the same slave, the result of the stolen copy is
+  // stale.
+  uint32 attempt = speculator_.EdgeStarted(a_, kSlave, After(1000));
+  EXPECT_NE(stolen, attempt);
+  EXPECT_FALSE(speculator_.IsCurrentAttempt(a_, kSlave, stolen));
+  EXPECT_TRUE(speculator_.IsCurrentAttempt(a_, kSlave, attempt));
+}
+
+TEST_F(SpeculatorTest, ExecutorLost) {
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  speculator_.EdgeStarted(a_, kAnotherSlave, After(0));
+  speculator_.EdgeStarted(b_, kSlave, After(0));
+
+  std::vector<Edge*> orphans;
+  speculator_.ExecutorLost(kSlave, &orphans);
+  ASSERT_EQ(1u, orphans.size());
+  EXPECT_EQ(b_, orphans[0]);
+  EXPECT_FALSE(speculator_.IsRunningOn(a_, kSlave));
+  EXPECT_TRUE(speculator_.IsRunningOn(a_, kAnotherSlave));
+  EXPECT_TRUE(speculator_.IsOutstanding(b_));
+
+  // A claimed copy is left to its fetch.
+  EXPECT_TRUE(speculator_.ClaimResult(a_, kAnotherSlave, After(1000)));
+  orphans.clear();
+  speculator_.ExecutorLost(kAnotherSlave, &orphans);
+  EXPECT_TRUE(orphans.empty());
+  EXPECT_TRUE(speculator_.IsRunningOn(a_, kAnotherSlave));
+}
+
+TEST_F(SpeculatorTest, CancelAll) {
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  speculator_.EdgeStarted(a_, kAnotherSlave, After(0));
+  speculator_.EdgeStarted(b_, Speculator::kLocalExecutor, After(0));
+  EXPECT_TRUE(speculator_.ClaimResult(a_, kSlave, After(1000)));
+
+  Speculator::CopyVector copies;
+  speculator_.CancelAll(&copies);
+  ASSERT_EQ(2u, copies.size());
+  EXPECT_FALSE(speculator_.IsOutstanding(a_));
+  EXPECT_FALSE(speculator_.IsOutstanding(b_));
+
+  // The claimed result may still be applied afterwards.
+  std::vector<int> losers;
+  speculator_.EdgeFinished(a_, &losers);
+  EXPECT_TRUE(losers.empty());
+}
+
+TEST_F(SpeculatorTest, Slowness) {
+  EXPECT_DOUBLE_EQ(1.0, speculator_.GetSlowness(kSlave));
+
+  speculator_.EdgeStarted(a_, kSlave, After(0));
+  EXPECT_TRUE(speculator_.ClaimResult(a_, kSlave, After(2000)));
+  EXPECT_DOUBLE_EQ(2.0, speculator_.GetSlowness(kSlave));
+}
+
+}  // namespace ninja
@@ -0,0 +1,30 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#include "ninja/test_util.h"
+
+#include <string>
+
+#include "third_party/ninja/src/manifest_parser.h"
+
+namespace ninja {
+
+ManifestTest::ManifestTest(const char* manifest) : manifest_(manifest) {
+}
+
+ManifestTest::~ManifestTest() {
+}
+
+void ManifestTest::SetUp() {
+  ManifestParser parser(&state_, NULL);
+  std::string error;
+  ASSERT_TRUE(parser.ParseTest(manifest_, &error)) << error;
+  edges_.insert(state_.edges_.begin(), state_.edges_.end());
+}
+
+Edge* ManifestTest::GetEdge(const char* output) {
+  return state_.LookupNode(output)->in_edge();
+}
+
+}  // namespace ninja
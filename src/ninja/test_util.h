@@ -0,0 +1,46 @@
+// Copyright (c) 2015 Chaobin Zhang. All rights reserved.
+// Use of this source code is governed by the BSD license that can be
+// found in the LICENSE file.
+
+#ifndef  NINJA_TEST_UTIL_H_
+#define  NINJA_TEST_UTIL_H_
+
+#include <set>
+
+#include "base/basictypes.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/ninja/src/build_log.h"
+#include "third_party/ninja/src/state.h"
+
+struct Edge;
+
+namespace ninja {
+
+// ManifestTest parses the manifest of the test into |state_| before each
+// test, for the tests of the scheduling of edges, e.g. CriticalPath.
+// |build_log_| is empty, tests record the durations they need.
+class ManifestTest : public testing::Test {
+ protected:
+  explicit ManifestTest(const char* manifest);
+  ~ManifestTest() override;
+
+  void SetUp() override;
+
+  // Returns the edge which builds |output|.
+  Edge* GetEdge(const char* output);
+
+  State state_;
+  BuildLog build_log_;
+
+  // Every edge of the manifest.
+  std::set<Edge*> edges_;
+
+ private:
+  const char* manifest_;
+
+  DISALLOW_COPY_AND_ASSIGN(ManifestTest);
+};
+
+}  // namespace ninja
+
+#endif  // NINJA_TEST_UTIL_H_
@@ -7,12 +7,18 @@
 #include <set>
 #include <vector>
 
+#include "base/atomic_ref_count.h"
 #include "base/bind.h"
+#include "base/command_line.h"
 #include "base/files/file_util.h"
-#include "base/hash.h"
-#include "base/md5.h"
 #include "base/stl_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/threading/thread_restrictions.h"
+#include "common/action_cache.h"
+#include "common/compression.h"
+#include "common/curl_helper.h"
+#include "common/digest.h"
+#include "common/options.h"
 #include "common/util.h"
 #include "ninja/ninja_main.h"
 #include "proto/slave_services.pb.h"
@@ -22,6 +28,10 @@
 
 namespace {
 
+const char kHttp[] = "http://";
+
+const int64 kDefaultActionCacheSizeInMB = 10 * 1024;
+
 slave::RunCommandResponse::ExitStatus TransformExitStatus(ExitStatus status) {
   switch (status) {
   case ExitSuccess:
@@ -36,6 +46,38 @@ slave::RunCommandResponse::ExitStatus TransformExitStatus(ExitStatus status) {
   }
 }
 
+void LookUpOnBlockingPool(
+    scoped_refptr<common::ActionCache> action_cache,
+    const std::string& command,
+    const common::ActionCache::PathVector& inputs,
+    const common::ActionCache::PathVector& outputs,
+    const std::string& depfile,
+    const base::Callback<void(const std::string&,
+                              bool,
+                              const std::string&)>& callback) {
+  std::string key;
+  common::ActionCache::PathVector deps;
+  std::string output;
+  bool hit = action_cache->Lookup(command, inputs, outputs, depfile, &key,
+                                  &deps, &output);
+  NinjaThread::PostTask(NinjaThread::MAIN,
+                        FROM_HERE,
+                        base::Bind(callback, key, hit, output));
+}
+
+void StoreOnBlockingPool(scoped_refptr<common::ActionCache> action_cache,
+                         const std::string& key,
+                         const common::ActionCache::PathVector& outputs,
+                         const std::string& depfile,
+                         const std::string& output) {
+  // The slave has no deps log, the discovered deps come from the depfile.
+  common::ActionCache::PathVector deps;
+  if (!depfile.empty() && !common::ActionCache::ReadDepfile(depfile, &deps))
+    return;
+  if (!action_cache->Store(key, deps, outputs, output))
+    LOG(WARNING) << "Failed to store " << outputs[0] << " in action cache.";
+}
+
 void FindAllEdges(Edge* e, std::set<Edge*>* seen, std::vector<Edge*>* edges) {
   if (e == NULL || seen->insert(e).second == false)
     return;
@@ -50,45 +92,188 @@ void FindAllEdges(Edge* e, std::set<Edge*>* seen, std::vector<Edge*>* edges) {
 
 namespace slave {
 
+struct SlaveMainRunner::OutputDigests
+    : public base::RefCountedThreadSafe<OutputDigests> {
+  explicit OutputDigests(const RunCommandContext& context)
+      : context(context),
+        digests(context.request->output_paths_size()),
+        compressed(context.request->output_paths_size()),
+        sizes(context.request->output_paths_size(), -1),
+        chunk_digests(context.request->output_paths_size()),
+        pending(context.request->output_paths_size()) {
+  }
+
+  RunCommandContext context;
+
+  // Sent along with the digests, see RunCommandResponse.depfile. Empty
+  // unless the edge has gcc-style deps.
+  std::string depfile;
+
+  // Indexed like RunCommandRequest.output_paths, and set from different
+  // threads, hence no vector<bool>.
+  std::vector<std::string> digests;
+  std::vector<char> compressed;
+  std::vector<int64> sizes;
+  std::vector<std::vector<std::string> > chunk_digests;
+
+  // The number of outputs which are not hashed yet.
+  base::AtomicRefCount pending;
+
+ private:
+  friend class base::RefCountedThreadSafe<OutputDigests>;
+  ~OutputDigests() {}
+};
+
 SlaveMainRunner::SlaveMainRunner(const std::string& master, uint16 port)
     : master_(master),
       port_(port),
       command_executor_(new common::CommandExecutor()) {
   command_executor_->AddObserver(this);
+
+  // Shipped inputs are fetched with curl, see the comment in
+  // MasterMainRunner::MasterMainRunner.
+  curl_global_init(CURL_GLOBAL_ALL);
 }
 
 SlaveMainRunner::~SlaveMainRunner() {
   command_executor_->RemoveObserver(this);
+  curl_global_cleanup();
 }
 
-void SlaveMainRunner::OnCommandStarted(const std::string& command) {
+void SlaveMainRunner::OnCommandStarted(Edge* edge) {
+  RunCommandContextMap::iterator it = run_command_context_map_.find(edge);
+  if (it == run_command_context_map_.end() || !it->second.start_time.is_null())
+    return;
+
+  it->second.start_time = base::TimeTicks::Now();
+  NinjaThread::PostTask(
+      NinjaThread::RPC, FROM_HERE,
+      base::Bind(&SlaveRPC::OnCommandStarted,
+                 base::Unretained(slave_rpc_.get()),
+                 it->second.request->edge_id(),
+                 it->second.request->attempt_id(),
+                 it->second.start_time - it->second.receive_time));
 }
 
-void SlaveMainRunner::OnCommandFinished(const std::string& command,
-                                        const CommandRunner::Result* result) {
-  uint32 command_hash = base::Hash(command);
-  DCHECK(command_hash_edge_map_.find(command_hash) !=
-         command_hash_edge_map_.end());
-  plan_.EdgeFinished(command_hash_edge_map_[command_hash]);
-  StartReadyEdges();
+void SlaveMainRunner::OnCommandFinished(const CommandRunner::Result* result) {
+  std::map<Edge*, std::string>::iterator key = action_keys_.find(result->edge);
+  if (key != action_keys_.end()) {
+    if (result->success()) {
+      Edge* edge = result->edge;
+      common::ActionCache::PathVector outputs;
+      for (size_t i = 0; i < edge->outputs_.size(); ++i)
+        outputs.push_back(edge->outputs_[i]->path());
+      NinjaThread::PostBlockingPoolTask(
+          FROM_HERE,
+          base::Bind(&StoreOnBlockingPool,
+                     action_cache_,
+                     key->second,
+                     outputs,
+                     edge->GetUnescapedDepfile(),
+                     result->output));
+    }
+    action_keys_.erase(key);
+  }
+
+  if (canceled_edges_.erase(result->edge) > 0 &&
+      result->status == ExitInterrupted &&
+      ContainsKey(run_command_context_map_, result->edge)) {
+    Edge* edge = result->edge;
+    RunCommandContext context = run_command_context_map_[edge];
+    if (!ContainsKey(shipped_edges_, edge)) {
+      if (StartEdge(edge))
+        return;
+    } else {
+      InputFiles inputs(context.request->inputs().begin(),
+                        context.request->inputs().end());
+      FetchInputs(edge, inputs, static_cast<common::DigestType>(
+                                    context.request->digest_type()));
+      return;
+    }
+  }
+
+  if (shipped_edges_.erase(result->edge) == 0) {
+    if (result->success()) {
+      plan_.EdgeFinished(result->edge);
+      StartReadyEdges();
+    } else {
+      EdgeFailed(result->edge);
+    }
+  }
+  FinishRunCommand(result);
+}
 
+void SlaveMainRunner::EdgeFailed(Edge* edge) {
+  failed_edges_.insert(edge);
+
+  // The requested edges which wait for |edge| would never start.
+  std::vector<Edge*> blocked_edges;
+  for (RunCommandContextMap::iterator it = run_command_context_map_.begin();
+       it != run_command_context_map_.end();
+       ++it) {
+    if (it->first == edge || ContainsKey(shipped_edges_, it->first))
+      continue;
+    std::set<Edge*> seen;
+    std::vector<Edge*> dependencies;
+    FindAllEdges(it->first, &seen, &dependencies);
+    if (ContainsKey(seen, edge))
+      blocked_edges.push_back(it->first);
+  }
+
+  for (size_t i = 0; i < blocked_edges.size(); ++i) {
+    CommandRunner::Result result;
+    result.edge = blocked_edges[i];
+    result.status = ExitFailure;
+    result.output = "Failed to build " + edge->outputs_[0]->path() + ".";
+    FinishRunCommand(&result);
+  }
+}
+
+void SlaveMainRunner::FinishRunCommand(const CommandRunner::Result* result) {
+  // Dependencies of the requested edges have no context.
   RunCommandContextMap::iterator it =
-      run_command_context_map_.find(command_hash);
+      run_command_context_map_.find(result->edge);
   if (it == run_command_context_map_.end())
     return;
 
   it->second.response->set_output(result->output);
   it->second.response->set_status(TransformExitStatus(result->status));
-  NinjaThread::PostBlockingPoolTask(
-      FROM_HERE,
-      base::Bind(&SlaveMainRunner::MD5OutputsOnBlockingPool, this, it->second));
+  if (!it->second.start_time.is_null()) {
+    it->second.response->set_wait_ms(
+        (it->second.start_time - it->second.receive_time).InMilliseconds());
+  }
+  DigestOutputs(it->first, it->second);
   run_command_context_map_.erase(it);
 }
 
 bool SlaveMainRunner::PostCreateThreads() {
-  slave_rpc_.reset(new SlaveRPC(master_, port_, this));
+  base::FilePath build_dir = base::FilePath::FromUTF8Unsafe(
+      ninja_main()->build_dir().empty() ? "." : ninja_main()->build_dir());
+  slave_rpc_.reset(new SlaveRPC(master_, port_, build_dir, this));
   slave_file_thread_.reset(new SlaveFileThread());
 
+  const base::CommandLine* command_line =
+      base::CommandLine::ForCurrentProcess();
+  if (command_line->HasSwitch(switches::kActionCacheDir)) {
+    int64 size_in_mb = kDefaultActionCacheSizeInMB;
+    if (command_line->HasSwitch(switches::kActionCacheSize)) {
+      base::StringToInt64(
+          command_line->GetSwitchValueASCII(switches::kActionCacheSize),
+          &size_in_mb);
+    }
+    action_cache_ = new common::ActionCache(
+        command_line->GetSwitchValuePath(switches::kActionCacheDir),
+        size_in_mb * 1024 * 1024);
+    if (!action_cache_->Init()) {
+      LOG(ERROR) << "Failed to initialize action cache.";
+      action_cache_ = NULL;
+    }
+  }
+
+  // The compressed copies of the last run are stale, nobody fetches them.
+  base::DeleteFile(base::FilePath::FromUTF8Unsafe(common::GetCompressedDir()),
+                   true);
+
   std::set<Edge*> edges;
   ninja_main()->GetAllEdges(&edges);
   for (std::set<Edge*>::iterator it = edges.begin(); it != edges.end(); ++it) {
@@ -106,6 +291,7 @@ void SlaveMainRunner::RunCommand(const RunCommandRequest* request,
                                  ::google::protobuf::Closure* done) {
   uint32 edge_id = request->edge_id();
   response->set_edge_id(edge_id);
+  response->set_attempt_id(request->attempt_id());
 
   if (!ContainsKey(hash_edge_map_, edge_id)) {
     response->set_status(RunCommandResponse::kExitFailure);
@@ -119,13 +305,26 @@ void SlaveMainRunner::RunCommand(const RunCommandRequest* request,
   }
 
   Edge* edge = hash_edge_map_[edge_id];
-  const std::string& command = edge->EvaluateCommand();
-  run_command_context_map_[base::Hash(command)] = {request, response, done};
+  run_command_context_map_[edge] =
+      {request, response, done, base::TimeTicks::Now(), base::TimeTicks()};
+
+  // The state of the outputs is unknown until the inputs are fetched, so run
+  // the edge anyway. If a canceled copy of the edge is still around, it
+  // answers this request instead.
+  if (request->ship_inputs()) {
+    if (shipped_edges_.insert(edge).second) {
+      InputFiles inputs(request->inputs().begin(), request->inputs().end());
+      FetchInputs(edge, inputs,
+                  static_cast<common::DigestType>(request->digest_type()));
+    }
+    return;
+  }
 
   if (edge->outputs_ready()) {
     CommandRunner::Result result;
+    result.edge = edge;
     result.status = ExitSuccess;
-    OnCommandFinished(edge->EvaluateCommand(), &result);
+    FinishRunCommand(&result);
     return;
   }
 
@@ -136,9 +335,89 @@ void SlaveMainRunner::RunCommand(const RunCommandRequest* request,
     }
   }
 
+  // Edges which failed or were canceled for an earlier request are still
+  // wanted by |plan_|, which won't start them again.
+  if (!failed_edges_.empty()) {
+    std::set<Edge*> seen;
+    std::vector<Edge*> dependencies;
+    FindAllEdges(edge, &seen, &dependencies);
+    for (size_t i = 0; i < dependencies.size(); ++i) {
+      if (failed_edges_.erase(dependencies[i]) > 0 &&
+          !StartEdge(dependencies[i])) {
+        failed_edges_.insert(dependencies[i]);
+      }
+    }
+  }
+
   StartReadyEdges();
 }
 
+void SlaveMainRunner::CancelCommand(uint32 edge_id, uint32 attempt_id) {
+  HashEdgeMap::iterator edge = hash_edge_map_.find(edge_id);
+  if (edge == hash_edge_map_.end())
+    return;
+
+  RunCommandContextMap::iterator it =
+      run_command_context_map_.find(edge->second);
+  if (it == run_command_context_map_.end() ||
+      it->second.request->attempt_id() != attempt_id) {
+    return;  // Finished already.
+  }
+
+  it->second.response->set_status(RunCommandResponse::kExitInterrupted);
+  it->second.response->set_output("Canceled by master.");
+  NinjaThread::PostTask(
+      NinjaThread::RPC, FROM_HERE,
+      base::Bind(&SlaveRPC::OnRunCommandDone,
+                 base::Unretained(slave_rpc_.get()),
+                 it->second.done));
+  run_command_context_map_.erase(it);
+
+  // Dependencies of the edge which are still running are left alone, since
+  // other requests may need them.
+  KillCommand(edge->second);
+}
+
+void SlaveMainRunner::StealCommands(int max_commands,
+                                    StealCommandsResponse* response,
+                                    google::protobuf::Closure* done) {
+  // Nothing can start in the meantime since the executor runs on this thread,
+  // so a stolen command never runs here.
+  std::vector<Edge*> pending_edges;
+  command_executor_->GetPendingEdges(&pending_edges);
+  std::vector<google::protobuf::Closure*> stolen;
+  for (std::vector<Edge*>::reverse_iterator edge = pending_edges.rbegin();
+       edge != pending_edges.rend() &&
+           static_cast<int>(stolen.size()) < max_commands;
+       ++edge) {
+    // Dependencies of the requested commands stay here.
+    RunCommandContextMap::iterator it = run_command_context_map_.find(*edge);
+    if (it == run_command_context_map_.end())
+      continue;
+
+    response->add_edge_ids(it->second.response->edge_id());
+    response->add_attempt_ids(it->second.response->attempt_id());
+    it->second.response->set_status(RunCommandResponse::kExitInterrupted);
+    it->second.response->set_output("Stolen by master.");
+    stolen.push_back(it->second.done);
+    run_command_context_map_.erase(it);
+    KillCommand(*edge);
+  }
+
+  // Tasks run in order on the RPC thread, so the master learns about the
+  // steal before it gets the results of the stolen commands.
+  NinjaThread::PostTask(
+      NinjaThread::RPC, FROM_HERE,
+      base::Bind(&google::protobuf::Closure::Run, base::Unretained(done)));
+  for (size_t i = 0; i < stolen.size(); ++i) {
+    NinjaThread::PostTask(
+        NinjaThread::RPC, FROM_HERE,
+        base::Bind(&SlaveRPC::OnRunCommandDone,
+                   base::Unretained(slave_rpc_.get()),
+                   stolen[i]));
+  }
+}
+
 void SlaveMainRunner::Wait() {
 }
 
@@ -160,24 +439,88 @@ bool SlaveMainRunner::CreateDirsAndResponseFile(
   return true;
 }
 
-void SlaveMainRunner::MD5OutputsOnBlockingPool(
-    const RunCommandContext& context) {
-  if (context.response->status() == slave::RunCommandResponse::kExitSuccess) {
-    for (int i = 0; i < context.request->output_paths_size(); ++i) {
-      base::FilePath filename =
-          base::FilePath::FromUTF8Unsafe(context.request->output_paths(i));
-      std::string md5 = "";
-      if (base::PathExists(filename)) {
-        md5 = common::GetMd5Digest(filename);
-        if (md5.empty()) {
-          LOG(ERROR) << "GetMd5Digest of " << filename.value();
-        }
-      }
+void SlaveMainRunner::DigestOutputs(Edge* edge,
+                                    const RunCommandContext& context) {
+  int count = context.request->output_paths_size();
+  if (context.response->status() != RunCommandResponse::kExitSuccess ||
+      count == 0) {
+    NinjaThread::PostTask(
+        NinjaThread::RPC, FROM_HERE,
+        base::Bind(&SlaveRPC::OnRunCommandDone,
+                   base::Unretained(slave_rpc_.get()),
+                   context.done));
+    return;
+  }
 
-      context.response->add_md5()->assign(md5);
-    }
+  scoped_refptr<OutputDigests> digests(new OutputDigests(context));
+  if (edge->GetBinding("deps") == "gcc")
+    digests->depfile = edge->GetUnescapedDepfile();
+  for (int i = 0; i < count; ++i) {
+    NinjaThread::PostBlockingPoolTask(
+        FROM_HERE,
+        base::Bind(&SlaveMainRunner::DigestOutputOnBlockingPool,
+                   this,
+                   digests,
+                   i));
+  }
+}
+
+void SlaveMainRunner::DigestOutputOnBlockingPool(
+    scoped_refptr<OutputDigests> digests,
+    int index) {
+  const RunCommandContext& context = digests->context;
+  const std::string& path = context.request->output_paths(index);
+  base::FilePath filename = base::FilePath::FromUTF8Unsafe(path);
+  common::DigestType type =
+      static_cast<common::DigestType>(context.request->digest_type());
+  std::string digest;
+  int64 size = -1;
+  if (base::PathExists(filename)) {
+    digest = common::GetFileDigest(filename, type);
+    if (digest.empty())
+      LOG(ERROR) << "GetFileDigest of " << filename.value();
+    else if (!base::GetFileSize(filename, &size))
+      size = -1;
+  }
+  digests->digests[index] = digest;
+  digests->sizes[index] = size;
+
+  // The compressed copy is served next to the build directory, outputs
+  // outside of it are sent as they are.
+  int level = context.request->compression_level();
+  if (level > 0 && !digest.empty() && !filename.IsAbsolute() &&
+      !filename.ReferencesParent()) {
+    digests->compressed[index] = common::CompressFile(
+        filename,
+        base::FilePath::FromUTF8Unsafe(common::GetCompressedPath(path)),
+        level);
   }
 
+  // A large output is fetched in chunks, which are checked on their own.
+  int64 range_size = context.request->range_size();
+  if (range_size > 0 && size > range_size && !digests->compressed[index] &&
+      !common::ComputeChunkDigests(filename, type, range_size,
+                                   &digests->chunk_digests[index])) {
+    digests->chunk_digests[index].clear();
+  }
+
+  // The last output to finish answers the command.
+  if (base::AtomicRefCountDec(&digests->pending))
+    return;
+
+  for (size_t i = 0; i < digests->digests.size(); ++i) {
+    context.response->add_digest()->assign(digests->digests[i]);
+    context.response->add_compressed(digests->compressed[i] != 0);
+    context.response->add_size(digests->sizes[i]);
+    RunCommandResponse::ChunkDigests* chunk_digests =
+        context.response->add_chunk_digests();
+    for (size_t j = 0; j < digests->chunk_digests[i].size(); ++j)
+      chunk_digests->add_digest(digests->chunk_digests[i][j]);
+  }
+  if (!digests->depfile.empty()) {
+    base::ReadFileToString(base::FilePath::FromUTF8Unsafe(digests->depfile),
+                           context.response->mutable_depfile());
+  }
   NinjaThread::PostTask(
       NinjaThread::RPC, FROM_HERE,
       base::Bind(&SlaveRPC::OnRunCommandDone,
@@ -185,17 +528,137 @@ void SlaveMainRunner::MD5OutputsOnBlockingPool(
                  context.done));
 }
 
+void SlaveMainRunner::FetchInputs(Edge* edge,
+                                  const InputFiles& inputs,
+                                  common::DigestType type) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
+  DCHECK(!ContainsKey(pending_inputs_, edge));
+  int amount = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!inputs[i].digest().empty())
+      ++amount;
+  }
+  if (amount == 0) {
+    OnInputsFetched(edge, true);
+    return;
+  }
+
+  pending_inputs_[edge] = std::make_pair(amount, true);
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!inputs[i].digest().empty())
+      WaitForInput(edge, inputs[i], type);
+  }
+}
+
+void SlaveMainRunner::WaitForInput(Edge* edge,
+                                   const InputFile& input,
+                                   common::DigestType type) {
+  InputFetchMap::iterator it = input_fetches_.find(input.path());
+  if (it == input_fetches_.end()) {
+    InputFetch& fetch = input_fetches_[input.path()];
+    fetch.input = input;
+    fetch.type = type;
+    fetch.waiters.push_back(std::make_pair(edge, input));
+    NinjaThread::PostBlockingPoolTask(
+        FROM_HERE,
+        base::Bind(&SlaveMainRunner::FetchInputOnBlockingPool,
+                   this,
+                   input,
+                   type));
+    return;
+  }
+  it->second.waiters.push_back(std::make_pair(edge, input));
+}
+
+void SlaveMainRunner::FetchInputOnBlockingPool(const InputFile& input,
+                                               common::DigestType type) {
+  const std::string& digest = input.digest();
+  base::FilePath filename = base::FilePath::FromUTF8Unsafe(input.path());
+  bool success = base::PathExists(filename) &&
+                 common::GetFileDigest(filename, type) == digest;
+  if (!success && base::CreateDirectory(filename.DirName())) {
+    std::vector<std::string> hosts;
+    if (input.has_host())
+      hosts.push_back(input.host());
+    hosts.push_back(master_ + ":" + options::kMongooseServerPort);
+
+    common::CurlHelper curl_helper;
+    for (size_t i = 0; i < hosts.size() && !success; ++i) {
+      std::string url = kHttp + hosts[i] + "/" + input.path();
+      success = curl_helper.Get(url, filename, type, digest);
+      if (!success)
+        LOG(ERROR) << "Curl " << url << "|" << digest;
+    }
+  }
+
+  NinjaThread::PostTask(
+      NinjaThread::MAIN, FROM_HERE,
+      base::Bind(&SlaveMainRunner::OnInputFetched, this, input.path(),
+                 success));
+}
+
+void SlaveMainRunner::OnInputFetched(const std::string& path, bool success) {
+  InputFetchMap::iterator it = input_fetches_.find(path);
+  DCHECK(it != input_fetches_.end());
+  InputFetch fetch = it->second;
+  input_fetches_.erase(it);
+
+  std::vector<Edge*> ready_edges;
+  for (size_t i = 0; i < fetch.waiters.size(); ++i) {
+    Edge* edge = fetch.waiters[i].first;
+    const InputFile& input = fetch.waiters[i].second;
+    if (input.digest() != fetch.input.digest()) {
+      WaitForInput(edge, input, fetch.type);
+      continue;
+    }
+
+    std::pair<int, bool>& pending = pending_inputs_[edge];
+    pending.second = pending.second && success;
+    if (--pending.first == 0)
+      ready_edges.push_back(edge);
+  }
+
+  for (size_t i = 0; i < ready_edges.size(); ++i) {
+    bool all_fetched = pending_inputs_[ready_edges[i]].second;
+    pending_inputs_.erase(ready_edges[i]);
+    OnInputsFetched(ready_edges[i], all_fetched);
+  }
+}
+
+void SlaveMainRunner::OnInputsFetched(Edge* edge, bool success) {
+  // The command may have been canceled in the meantime.
+  if (!ContainsKey(run_command_context_map_, edge)) {
+    shipped_edges_.erase(edge);
+    return;
+  }
+
+  if (success && StartEdge(edge))
+    return;
+
+  shipped_edges_.erase(edge);
+  CommandRunner::Result result;
+  result.edge = edge;
+  result.status = ExitFailure;
+  result.output = success ? "Failed to prepare outputs." :
+                            "Failed to fetch inputs from master.";
+  FinishRunCommand(&result);
+}
+
 bool SlaveMainRunner::StartEdge(Edge* edge) {
   if (edge->is_phony())
     return true;
 
-  // Create directories necessary for outputs.
+  // Create directories necessary for outputs. The compressed copies of the
+  // outputs are stale once the edge runs again.
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
     base::FilePath dir =
         base::FilePath::FromUTF8Unsafe((*o)->path());
     if (!base::CreateDirectory(dir.DirName()))
       return false;
+    base::DeleteFile(
+        base::FilePath::FromUTF8Unsafe(common::GetCompressedPath((*o)->path())),
+        false);
   }
 
   // Create response file, if needed
@@ -206,18 +669,99 @@ bool SlaveMainRunner::StartEdge(Edge* edge) {
       return false;
   }
 
-  std::string command = edge->EvaluateCommand();
-  command_executor_->RunCommand(edge->EvaluateCommand());
+  RunOrLookUpCommand(edge);
   return true;
 }
 
+void SlaveMainRunner::KillCommand(Edge* edge) {
+  if (ContainsKey(looking_up_edges_, edge)) {
+    canceled_edges_.insert(edge);
+    return;
+  }
+  if (!command_executor_->HasCommand(edge))
+    return;
+
+  canceled_edges_.insert(edge);
+  command_executor_->CancelCommand(edge);
+}
+
+void SlaveMainRunner::RunOrLookUpCommand(Edge* edge) {
+  // msvc-style deps are only in the output stream, they are not cached.
+  std::string deps_type = edge->GetBinding("deps");
+  if (action_cache_.get() == NULL ||
+      (!deps_type.empty() && deps_type != "gcc")) {
+    command_executor_->RunCommand(edge, edge->EvaluateCommand());
+    return;
+  }
+
+  // Order-only inputs don't change the outputs.
+  common::ActionCache::PathVector inputs;
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end() - edge->order_only_deps_;
+       ++i) {
+    inputs.push_back((*i)->path());
+  }
+  common::ActionCache::PathVector outputs;
+  for (size_t i = 0; i < edge->outputs_.size(); ++i)
+    outputs.push_back(edge->outputs_[i]->path());
+
+  // The command is evaluated once, it runs on a miss.
+  std::string command = edge->EvaluateCommand();
+  looking_up_edges_.insert(edge);
+  NinjaThread::PostBlockingPoolTask(
+      FROM_HERE,
+      base::Bind(&LookUpOnBlockingPool,
+                 action_cache_,
+                 common::ActionCache::GetKeyCommand(
+                     command, edge->GetBinding("rspfile_content")),
+                 inputs,
+                 outputs,
+                 edge->GetUnescapedDepfile(),
+                 base::Bind(&SlaveMainRunner::OnActionCacheLookupDone,
+                            this,
+                            edge,
+                            command)));
+}
+
+void SlaveMainRunner::OnActionCacheLookupDone(Edge* edge,
+                                              const std::string& command,
+                                              const std::string& key,
+                                              bool hit,
+                                              const std::string& output) {
+  looking_up_edges_.erase(edge);
+
+  // The restored outputs are served by |slave_file_thread_| as if the
+  // command had run, even if its request has been canceled meanwhile.
+  if (hit) {
+    canceled_edges_.erase(edge);
+    CommandRunner::Result result;
+    result.edge = edge;
+    result.status = ExitSuccess;
+    result.output = output;
+    OnCommandFinished(&result);
+    return;
+  }
+
+  // Don't run the command of a canceled or stolen request, unless the edge
+  // has been requested again.
+  if (canceled_edges_.erase(edge) > 0 &&
+      !ContainsKey(run_command_context_map_, edge)) {
+    CommandRunner::Result result;
+    result.edge = edge;
+    result.status = ExitInterrupted;
+    OnCommandFinished(&result);
+    return;
+  }
+
+  if (!key.empty())
+    action_keys_[edge] = key;
+  command_executor_->RunCommand(edge, command);
+}
+
 void SlaveMainRunner::StartReadyEdges() {
   Edge* ready_edge = NULL;
-  while ((ready_edge = plan_.FindWork()) != NULL) {
-    std::string command = ready_edge->EvaluateCommand();
-    command_hash_edge_map_[base::Hash(command)] = ready_edge;
+  while ((ready_edge = plan_.FindWork()) != NULL)
     StartEdge(ready_edge);
-  }
 }
 
 }  // namespace slave
@@ -9,15 +9,19 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "base/memory/ref_counted.h"
+#include "base/time/time.h"
 #include "common/main_runner.h"
 #include "common/command_executor.h"
+#include "common/digest.h"
+#include "proto/slave_services.pb.h"
 #include "third_party/ninja/src/build.h"
 
-namespace slave {
-class RunCommandRequest;
-class RunCommandResponse;
-}  // namespace slave
+namespace common {
+class ActionCache;
+}  // namespace common
 
 namespace google {
 namespace protobuf {
@@ -36,9 +40,8 @@ class SlaveMainRunner : public common::CommandExecutor::Observer,
   SlaveMainRunner(const std::string& master, uint16 port);
 
   // slave::CommandExecutor::Observer implementations.
-  void OnCommandStarted(const std::string& command) override;
-  void OnCommandFinished(const std::string& command,
-                         const CommandRunner::Result* result) override;
+  void OnCommandStarted(Edge* edge) override;
+  void OnCommandFinished(const CommandRunner::Result* result) override;
 
   // common::MainRunner implementations.
   bool PostCreateThreads() override;
@@ -46,6 +49,19 @@ class SlaveMainRunner : public common::CommandExecutor::Observer,
   void RunCommand(const RunCommandRequest* request,
                   RunCommandResponse* response,
                   google::protobuf::Closure* done);
+
+  // Answers the pending RunCommand of |edge_id| with kExitInterrupted and
+  // kills its command, or removes it from the queue of |command_executor_|.
+  // Nothing happens unless the pending request is |attempt_id|.
+  void CancelCommand(uint32 edge_id, uint32 attempt_id);
+
+  // Takes up to |max_commands| commands requested by the master out of the
+  // queue of |command_executor_|, the newest one first. They are listed in
+  // |response|, which is answered before their results, see
+  // StealCommandsResponse.
+  void StealCommands(int max_commands,
+                     StealCommandsResponse* response,
+                     google::protobuf::Closure* done);
   void Wait();
 
  private:
@@ -53,6 +69,11 @@ class SlaveMainRunner : public common::CommandExecutor::Observer,
     const RunCommandRequest* request;
     RunCommandResponse* response;
     google::protobuf::Closure* done;
+
+    // When the request arrived, and when its command started, see
+    // RunCommandResponse.wait_ms.
+    base::TimeTicks receive_time;
+    base::TimeTicks start_time;
   };
 
   friend class base::RefCountedThreadSafe<SlaveMainRunner>;
@@ -62,10 +83,58 @@ class SlaveMainRunner : public common::CommandExecutor::Observer,
   // if needed. Note: this will block.
   bool CreateDirsAndResponseFile(const RunCommandRequest* request);
 
-  void MD5OutputsOnBlockingPool(const RunCommandContext& context);
+  // Answers the RunCommand request of |result->edge|, if there is one.
+  void FinishRunCommand(const CommandRunner::Result* result);
+
+  // |edge| of |plan_| failed or has been canceled. It stays wanted by
+  // |plan_|, without outputs, so that it runs again for the next request
+  // which needs it. The pending requests which wait for it fail.
+  void EdgeFailed(Edge* edge);
+
+  // Answers the command of |context| for |edge| once the digests of its
+  // outputs are computed. Outputs are hashed in parallel on the blocking
+  // pool, since a command with a large output set would otherwise hash them
+  // one by one.
+  struct OutputDigests;
+  void DigestOutputs(Edge* edge, const RunCommandContext& context);
+  void DigestOutputOnBlockingPool(scoped_refptr<OutputDigests> digests,
+                                  int index);
+
+  // Fetches the |inputs| of |edge| whose local digest differs from the one
+  // given by the master, see RunCommandRequest.ship_inputs, then runs
+  // OnInputsFetched(). Edges which need the same input at the same time share
+  // its download, see |input_fetches_|.
+  typedef std::vector<InputFile> InputFiles;
+  void FetchInputs(Edge* edge,
+                   const InputFiles& inputs,
+                   common::DigestType type);
+  void WaitForInput(Edge* edge,
+                    const InputFile& input,
+                    common::DigestType type);
+
+  // Downloads |input|, unless the local file matches already. It is fetched
+  // from the slave which built it first, if any, then from the master.
+  void FetchInputOnBlockingPool(const InputFile& input,
+                                common::DigestType type);
+  void OnInputFetched(const std::string& path, bool success);
+  void OnInputsFetched(Edge* edge, bool success);
 
   bool StartEdge(Edge* edge);
 
+  // Kills the command of |edge|, if it runs, or stops it from running once
+  // its action cache lookup is done. Its result is dropped, see
+  // |canceled_edges_|.
+  void KillCommand(Edge* edge);
+
+  // Runs the command of |edge|, unless |action_cache_| has its outputs. The
+  // lookup runs on the blocking pool.
+  void RunOrLookUpCommand(Edge* edge);
+  void OnActionCacheLookupDone(Edge* edge,
+                               const std::string& command,
+                               const std::string& key,
+                               bool hit,
+                               const std::string& output);
+
   void StartReadyEdges();
 
   std::string master_;
@@ -81,13 +150,48 @@ class SlaveMainRunner : public common::CommandExecutor::Observer,
   std::set<Edge*> started_edge_set_;
 
   // RunCommandContextMap is used to hold the context of running a command from
-  // master. Key is the hash of |request->command()|.
-  typedef std::map<uint32, RunCommandContext> RunCommandContextMap;
+  // master. Key is the edge of |request->edge_id()|.
+  typedef std::map<Edge*, RunCommandContext> RunCommandContextMap;
   RunCommandContextMap run_command_context_map_;
 
+  // Edges run with shipped inputs, they are not part of |plan_|.
+  std::set<Edge*> shipped_edges_;
+
+  // The downloads of shipped inputs in flight, keyed by path, and the edges
+  // which wait for each of them with the input they need. A waiter which
+  // needs another content of the file fetches it once the download is done.
+  struct InputFetch {
+    InputFile input;
+    common::DigestType type;
+    std::vector<std::pair<Edge*, InputFile> > waiters;
+  };
+  typedef std::map<std::string, InputFetch> InputFetchMap;
+  InputFetchMap input_fetches_;
+
+  // The amount of inputs each shipped edge still waits for, and whether all
+  // of its inputs fetched so far succeeded.
+  std::map<Edge*, std::pair<int, bool> > pending_inputs_;
+
+  // Edges of |plan_| whose last run failed, see EdgeFailed().
+  std::set<Edge*> failed_edges_;
+
+  // Edges whose command has been killed for a canceled or stolen request.
+  // If the master requests the edge again before the killed command exits,
+  // the edge runs again rather than answering with the interruption.
+  std::set<Edge*> canceled_edges_;
+
+  // Keeps the outputs of the commands run by this slave across builds. NULL
+  // unless switches::kActionCacheDir is given.
+  scoped_refptr<common::ActionCache> action_cache_;
+
+  // The input key of edges which missed |action_cache_|, see
+  // common::ActionCache.
+  std::map<Edge*, std::string> action_keys_;
+
+  // Edges whose |action_cache_| lookup is in flight on the blocking pool.
+  std::set<Edge*> looking_up_edges_;
+
   Plan plan_;
-  typedef std::map<uint32, Edge*> CommandHashEdgeMap;
-  CommandHashEdgeMap command_hash_edge_map_;
 
   DISALLOW_COPY_AND_ASSIGN(SlaveMainRunner);
 };
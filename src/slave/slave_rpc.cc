@@ -4,10 +4,16 @@
 
 #include "slave/slave_rpc.h"
 
+#include <algorithm>
+
 #include "base/bind.h"
+#include "base/command_line.h"
+#include "base/files/file_util.h"
 #include "base/message_loop/message_loop.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/sys_info.h"
+#include "common/options.h"
 #include "common/util.h"
 #include "proto/rpc_message.pb.h"
 #include "rpc/rpc_connection.h"
@@ -20,6 +26,13 @@
 
 namespace {
 
+// The amount of commands queued beyond the executor slots by default.
+const int kDefaultPrefetchDepth = 2;
+
+// How often the cached status of the slave is refreshed, see
+// SlaveRPC::GetStatus().
+const int kStatusRefreshSeconds = 1;
+
 void QuitFileThreadHelper() {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::FILE));
   slave::SlaveFileThread::QuitPool();
@@ -30,6 +43,69 @@ void QuitFileThreadHelper() {
       base::MessageLoop::current()->QuitClosure());
 }
 
+// Returns the "some avg10" value of the Linux pressure stall information of
+// |resource|, e.g. "cpu" or "io", or -1 if it is not available.
+double GetPressure(const char* resource) {
+#if defined(OS_LINUX)
+  std::string content;
+  base::FilePath path = base::FilePath("/proc/pressure").Append(resource);
+  if (!base::ReadFileToString(path, &content))
+    return -1;
+
+  // The first line looks like:
+  //   some avg10=1.53 avg60=0.87 avg300=0.27 total=1217355
+  static const char kSomeAvg10[] = "some avg10=";
+  if (!StartsWithASCII(content, kSomeAvg10, true))
+    return -1;
+
+  size_t start = arraysize(kSomeAvg10) - 1;
+  size_t end = content.find(' ', start);
+  double pressure;
+  if (!base::StringToDouble(content.substr(start, end - start), &pressure))
+    return -1;
+  return pressure;
+#else
+  return -1;
+#endif
+}
+
+// The system information and status read /proc and the disk, which may
+// block, so they are filled in on the blocking pool. |done| runs back on the
+// RPC thread.
+void RunOnRPCThread(google::protobuf::Closure* done) {
+  NinjaThread::PostTask(
+      NinjaThread::RPC, FROM_HERE,
+      base::Bind(&google::protobuf::Closure::Run, base::Unretained(done)));
+}
+
+void GetSystemInfoOnBlockingPool(slave::SystemInfoResponse* response,
+                                 google::protobuf::Closure* done) {
+  response->set_number_of_processors(base::SysInfo::NumberOfProcessors());
+  response->set_amount_of_physical_memory(
+      base::SysInfo::AmountOfPhysicalMemory());
+  response->set_amount_of_virtual_memory(
+      base::SysInfo::AmountOfVirtualMemory());
+  response->set_operating_system_name(base::SysInfo::OperatingSystemName());
+  response->set_operating_system_version(
+      base::SysInfo::OperatingSystemVersion());
+  response->set_operating_system_architecture(
+      base::SysInfo::OperatingSystemArchitecture());
+  RunOnRPCThread(done);
+}
+
+void RefreshStatusOnBlockingPool(const base::FilePath& build_dir,
+                                 slave::StatusResponse* status,
+                                 const base::Closure& callback) {
+  status->set_load_average(GetLoadAverage());
+  status->set_amount_of_available_physical_memory(
+      base::SysInfo::AmountOfAvailablePhysicalMemory());
+  status->set_cpu_pressure(GetPressure("cpu"));
+  status->set_io_pressure(GetPressure("io"));
+  status->set_amount_of_free_disk_space(
+      base::SysInfo::AmountOfFreeDiskSpace(build_dir));
+  NinjaThread::PostTask(NinjaThread::RPC, FROM_HERE, callback);
+}
+
 void QuitMainThreadHelper() {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::MAIN));
   NinjaThread::PostTask(
@@ -44,12 +120,21 @@ namespace slave {
 
 SlaveRPC::SlaveRPC(const std::string& master_ip,
                    uint16 port,
+                   const base::FilePath& build_dir,
                    SlaveMainRunner* main_runner)
     : master_ip_(master_ip),
       port_(port),
+      build_dir_(build_dir),
       slave_main_runner_(main_runner),
       amount_of_running_commands_(0),
-      parallelism_(common::GuessParallelism()) {
+      parallelism_(common::GuessParallelism()),
+      wait_response_(NULL),
+      wait_done_(NULL),
+      is_send_results_scheduled_(false),
+      is_refreshing_status_(false) {
+  status_.set_load_average(-1);
+  status_.set_amount_of_running_commands(0);
+  status_.set_amount_of_available_physical_memory(0);
   NinjaThread::SetDelegate(NinjaThread::RPC, this);
 }
 
@@ -64,9 +149,18 @@ void SlaveRPC::Init() {
 void SlaveRPC::InitAsync() {
   rpc_socket_client_.reset(new rpc::RpcSocketClient(master_ip_, port_));
   rpc_socket_client_->Connect();
+
+  // The status is read from /proc and the disk, which may block. It is
+  // refreshed in the background, so that a status request is answered at
+  // once even when the blocking pool is busy, e.g. with fetches or hashing.
+  RefreshStatus();
+  status_timer_.Start(FROM_HERE,
+                      base::TimeDelta::FromSeconds(kStatusRefreshSeconds),
+                      this, &SlaveRPC::RefreshStatus);
 }
 
 void SlaveRPC::CleanUp() {
+  status_timer_.Stop();
   rpc::ServiceManager::GetInstance()->UnregisterService(this);
   rpc_socket_client_->Disconnect();
   rpc_socket_client_.reset();
@@ -76,43 +170,99 @@ void SlaveRPC::SystemInfo(google::protobuf::RpcController* /* controller */,
                           const slave::SystemInfoRequest* /* request */,
                           slave::SystemInfoResponse* response,
                           google::protobuf::Closure* done) {
-  response->set_number_of_processors(base::SysInfo::NumberOfProcessors());
-  response->set_amount_of_physical_memory(
-      base::SysInfo::AmountOfPhysicalMemory());
-  response->set_amount_of_virtual_memory(
-      base::SysInfo::AmountOfVirtualMemory());
-  response->set_operating_system_name(base::SysInfo::OperatingSystemName());
-  response->set_operating_system_version(
-      base::SysInfo::OperatingSystemVersion());
-  response->set_operating_system_architecture(
-      base::SysInfo::OperatingSystemArchitecture());
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  int prefetch_depth = kDefaultPrefetchDepth;
+  const base::CommandLine* command_line =
+      base::CommandLine::ForCurrentProcess();
+  if (command_line->HasSwitch(switches::kPrefetchDepth)) {
+    base::StringToInt(
+        command_line->GetSwitchValueASCII(switches::kPrefetchDepth),
+        &prefetch_depth);
+  }
+  // A queue deeper than a round of the slots only keeps edges away from the
+  // idle slaves, until they are stolen.
+  prefetch_depth = std::min(std::max(prefetch_depth, 0),
+                            std::max(parallelism_, kDefaultPrefetchDepth));
+  response->set_amount_of_slots(parallelism_);
+  response->set_prefetch_depth(prefetch_depth);
+
+  NinjaThread::PostBlockingPoolTask(
+      FROM_HERE,
+      base::Bind(&GetSystemInfoOnBlockingPool, response, done));
+}
 
+void SlaveRPC::RunCommands(google::protobuf::RpcController* /* controller */,
+                           const slave::RunCommandsRequest* request,
+                           slave::RunCommandsResponse* /* response */,
+                           google::protobuf::Closure* done) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  for (int i = 0; i < request->commands_size(); ++i) {
+    // |request| is gone once |done| runs, so every command gets its own copy.
+    // Both are deleted in |OnCommandResultReady|.
+    slave::RunCommandRequest* command =
+        new slave::RunCommandRequest(request->commands(i));
+    slave::RunCommandResponse* result = new slave::RunCommandResponse();
+    ++amount_of_running_commands_;
+    NinjaThread::PostTask(
+        NinjaThread::MAIN, FROM_HERE,
+        base::Bind(&SlaveMainRunner::RunCommand, slave_main_runner_,
+                   command, result,
+                   google::protobuf::NewCallback(
+                       this, &SlaveRPC::OnCommandResultReady,
+                       command, result)));
+  }
   done->Run();
 }
 
-void SlaveRPC::RunCommand(google::protobuf::RpcController* /* controller */,
-                          const slave::RunCommandRequest* request,
-                          slave::RunCommandResponse* response,
-                          google::protobuf::Closure* done) {
+void SlaveRPC::WaitForResults(
+    google::protobuf::RpcController* /* controller */,
+    const slave::WaitForResultsRequest* /* request */,
+    slave::WaitForResultsResponse* response,
+    google::protobuf::Closure* done) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  DCHECK(wait_done_ == NULL) << "Only one WaitForResults at a time.";
+  wait_response_ = response;
+  wait_done_ = done;
+  if (pending_results_.results_size() > 0)
+    ScheduleSendResults();
+}
+
+void SlaveRPC::CancelCommand(
+    google::protobuf::RpcController* /* controller */,
+    const slave::CancelCommandRequest* request,
+    slave::CancelCommandResponse* /* response */,
+    google::protobuf::Closure* done) {
   DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
-  ++amount_of_running_commands_;
   NinjaThread::PostTask(
       NinjaThread::MAIN, FROM_HERE,
-      base::Bind(&SlaveMainRunner::RunCommand, slave_main_runner_,
-                 request, response, done));
+      base::Bind(&SlaveMainRunner::CancelCommand, slave_main_runner_,
+                 request->edge_id(), request->attempt_id()));
+  done->Run();
 }
 
 void SlaveRPC::GetStatus(google::protobuf::RpcController* /* controller */,
                          const slave::StatusRequest* /* request */,
                          slave::StatusResponse* response,
                          google::protobuf::Closure* done) {
-  response->set_load_average(GetLoadAverage());
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  response->CopyFrom(status_);
   response->set_amount_of_running_commands(amount_of_running_commands_);
-  response->set_amount_of_available_physical_memory(
-      base::SysInfo::AmountOfAvailablePhysicalMemory());
+  response->mutable_started_commands()->Swap(&started_commands_);
   done->Run();
 }
 
+void SlaveRPC::StealCommands(
+    google::protobuf::RpcController* /* controller */,
+    const slave::StealCommandsRequest* request,
+    slave::StealCommandsResponse* response,
+    google::protobuf::Closure* done) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  NinjaThread::PostTask(
+      NinjaThread::MAIN, FROM_HERE,
+      base::Bind(&SlaveMainRunner::StealCommands, slave_main_runner_,
+                 request->max_commands(), response, done));
+}
+
 void SlaveRPC::Quit(google::protobuf::RpcController* /*controller*/,
                     const slave::QuitRequest* request,
                     slave::QuitResponse* /* response */,
@@ -139,4 +289,67 @@ void SlaveRPC::OnRunCommandDone(google::protobuf::Closure* done) {
   done->Run();
 }
 
+void SlaveRPC::OnCommandStarted(uint32 edge_id,
+                                uint32 attempt_id,
+                                base::TimeDelta wait_time) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  slave::StartedCommand* command = started_commands_.Add();
+  command->set_edge_id(edge_id);
+  command->set_attempt_id(attempt_id);
+  command->set_wait_ms(wait_time.InMilliseconds());
+}
+
+void SlaveRPC::RefreshStatus() {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  if (is_refreshing_status_)
+    return;
+
+  is_refreshing_status_ = true;
+  slave::StatusResponse* status = new slave::StatusResponse();
+  NinjaThread::PostBlockingPoolTask(
+      FROM_HERE,
+      base::Bind(&RefreshStatusOnBlockingPool, build_dir_, status,
+                 base::Bind(&SlaveRPC::OnStatusRefreshed,
+                            base::Unretained(this),
+                            base::Owned(status))));
+}
+
+void SlaveRPC::OnStatusRefreshed(slave::StatusResponse* status) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  is_refreshing_status_ = false;
+  status_.Swap(status);
+}
+
+void SlaveRPC::OnCommandResultReady(slave::RunCommandRequest* raw_request,
+                                    slave::RunCommandResponse* raw_response) {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  scoped_ptr<slave::RunCommandRequest> request(raw_request);
+  scoped_ptr<slave::RunCommandResponse> response(raw_response);
+  pending_results_.add_results()->Swap(response.get());
+  ScheduleSendResults();
+}
+
+void SlaveRPC::ScheduleSendResults() {
+  if (is_send_results_scheduled_)
+    return;
+
+  is_send_results_scheduled_ = true;
+  NinjaThread::PostTask(
+      NinjaThread::RPC, FROM_HERE,
+      base::Bind(&SlaveRPC::SendResults, base::Unretained(this)));
+}
+
+void SlaveRPC::SendResults() {
+  DCHECK(NinjaThread::CurrentlyOn(NinjaThread::RPC));
+  is_send_results_scheduled_ = false;
+  if (wait_done_ == NULL || pending_results_.results_size() == 0)
+    return;
+
+  wait_response_->Swap(&pending_results_);
+  google::protobuf::Closure* done = wait_done_;
+  wait_response_ = NULL;
+  wait_done_ = NULL;
+  done->Run();
+}
+
 }  // namespace slave
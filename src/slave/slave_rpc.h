@@ -9,7 +9,10 @@
 #include <map>
 
 #include "base/basictypes.h"
+#include "base/files/file_path.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/time/time.h"
+#include "base/timer/timer.h"
 #include "google/protobuf/service.h"
 #include "proto/slave_services.pb.h"
 #include "thread/ninja_thread_delegate.h"
@@ -26,6 +29,7 @@ class SlaveRPC : public NinjaThreadDelegate, public slave::SlaveService {
  public:
   SlaveRPC(const std::string& master_ip,
            uint16 port,
+           const base::FilePath& build_dir,
            SlaveMainRunner* main_runner);
   virtual ~SlaveRPC();
 
@@ -39,14 +43,26 @@ class SlaveRPC : public NinjaThreadDelegate, public slave::SlaveService {
                   const slave::SystemInfoRequest* request,
                   slave::SystemInfoResponse* response,
                   google::protobuf::Closure* done) override;
-  void RunCommand(google::protobuf::RpcController* controller,
-                  const slave::RunCommandRequest* request,
-                  slave::RunCommandResponse* response,
-                  google::protobuf::Closure* done) override;
+  void RunCommands(google::protobuf::RpcController* controller,
+                   const slave::RunCommandsRequest* request,
+                   slave::RunCommandsResponse* response,
+                   google::protobuf::Closure* done) override;
+  void WaitForResults(google::protobuf::RpcController* controller,
+                      const slave::WaitForResultsRequest* request,
+                      slave::WaitForResultsResponse* response,
+                      google::protobuf::Closure* done) override;
+  void CancelCommand(google::protobuf::RpcController* controller,
+                     const slave::CancelCommandRequest* request,
+                     slave::CancelCommandResponse* response,
+                     google::protobuf::Closure* done) override;
   void GetStatus(google::protobuf::RpcController* controller,
                  const slave::StatusRequest* request,
                  slave::StatusResponse* response,
                  google::protobuf::Closure* done) override;
+  void StealCommands(google::protobuf::RpcController* controller,
+                     const slave::StealCommandsRequest* request,
+                     slave::StealCommandsResponse* response,
+                     google::protobuf::Closure* done) override;
   void Quit(google::protobuf::RpcController* controller,
             const slave::QuitRequest* request,
             slave::QuitResponse* response,
@@ -54,14 +70,51 @@ class SlaveRPC : public NinjaThreadDelegate, public slave::SlaveService {
 
   void OnRunCommandDone(google::protobuf::Closure* done);
 
+  // The command of |edge_id| started after waiting |wait_time| on the slave.
+  // It is reported with the next status, see StatusResponse.started_commands.
+  void OnCommandStarted(uint32 edge_id,
+                        uint32 attempt_id,
+                        base::TimeDelta wait_time);
+
  private:
+  // Reads the status of the machine on the blocking pool into |status_|.
+  void RefreshStatus();
+  void OnStatusRefreshed(slave::StatusResponse* status);
+
+  // Queues the result of a command started by RunCommands().
+  void OnCommandResultReady(slave::RunCommandRequest* raw_request,
+                            slave::RunCommandResponse* raw_response);
+
+  // Answers the pending WaitForResults with every queued result. It is
+  // posted, so that results which are ready in the same tick of the RPC
+  // thread go back in one message.
+  void ScheduleSendResults();
+  void SendResults();
+
   std::string master_ip_;
   uint16 port_;
+  base::FilePath build_dir_;
   scoped_ptr<rpc::RpcSocketClient> rpc_socket_client_;
   SlaveMainRunner* slave_main_runner_;
   int amount_of_running_commands_;
   int parallelism_;
 
+  // Started commands which have not been reported to the master yet.
+  google::protobuf::RepeatedPtrField<slave::StartedCommand> started_commands_;
+
+  // Results which have not been returned to the master yet.
+  slave::WaitForResultsResponse pending_results_;
+
+  // The pending WaitForResults call, if any.
+  slave::WaitForResultsResponse* wait_response_;
+  google::protobuf::Closure* wait_done_;
+  bool is_send_results_scheduled_;
+
+  // The last status read by RefreshStatus(), which answers GetStatus().
+  slave::StatusResponse status_;
+  bool is_refreshing_status_;
+  base::RepeatingTimer<SlaveRPC> status_timer_;
+
   DISALLOW_COPY_AND_ASSIGN(SlaveRPC);
 };
 